@@ -1,521 +1,5668 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <random>
+#include <set>
+#include <shared_mutex>
+#include <span>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 namespace car_rental {
 
-struct CarRecord {
-    std::string id;
-    std::string model;
-    std::string condition;
-    double pricePerDay{0.0};
-    std::string status{"Available"};
+// Always-on process metrics. Counters and histograms are registered once by name and then
+// updated with relaxed atomics, so instrumented paths pay a few increments, not a lock.
+class Counter {
+public:
+    void add(std::uint64_t amount = 1) { value_.fetch_add(amount, std::memory_order_relaxed); }
+    std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
 };
 
-class CarRecordValidator {
+// Log2-bucketed latency histogram in nanoseconds. Quantiles report the upper edge of the
+// bucket they fall in (capped at the observed maximum), so they are accurate to within 2x.
+class LatencyHistogram {
 public:
-    bool validate(const CarRecord &record) const {
-        static const std::vector<std::string> allowed{
-            "excellent", "good", "fair", "minordamages", "majordamages"};
-
-        if (record.id.empty() || record.model.empty()) {
-            return false;
+    static constexpr size_t bucketCount = 48;
+
+    struct Summary {
+        std::uint64_t count{0};
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds p50{0};
+        std::chrono::nanoseconds p90{0};
+        std::chrono::nanoseconds p99{0};
+        std::chrono::nanoseconds max{0};
+    };
+
+    void record(std::chrono::nanoseconds elapsed) {
+        const auto nanos = static_cast<std::uint64_t>(std::max<std::int64_t>(elapsed.count(), 0));
+        const auto bucket = std::min<size_t>(bucketCount - 1, static_cast<size_t>(std::bit_width(nanos)));
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(nanos, std::memory_order_relaxed);
+        std::uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (nanos > seen && !max_.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {
         }
+    }
 
-        const bool isConditionValid = std::find(allowed.begin(), allowed.end(), record.condition) != allowed.end();
-        if (!isConditionValid) {
-            return false;
+    Summary summary() const {
+        std::array<std::uint64_t, bucketCount> counts{};
+        std::uint64_t count = 0;
+        for (size_t i = 0; i < bucketCount; ++i) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+            count += counts[i];
         }
-
-        if (!std::isfinite(record.pricePerDay) || record.pricePerDay <= 0) {
-            return false;
+        Summary summary;
+        summary.count = count;
+        summary.total = std::chrono::nanoseconds(total_.load(std::memory_order_relaxed));
+        summary.max = std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+        const auto quantile = [&](double q) {
+            const auto rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count)));
+            std::uint64_t seen = 0;
+            for (size_t i = 0; i < bucketCount; ++i) {
+                seen += counts[i];
+                if (seen >= std::max<std::uint64_t>(rank, 1)) {
+                    const std::uint64_t upper = i == 0 ? 0 : (std::uint64_t{1} << i) - 1;
+                    return std::min(std::chrono::nanoseconds(upper), summary.max);
+                }
+            }
+            return summary.max;
+        };
+        if (count > 0) {
+            summary.p50 = quantile(0.50);
+            summary.p90 = quantile(0.90);
+            summary.p99 = quantile(0.99);
         }
-
-        return true;
+        return summary;
     }
+
+private:
+    std::array<std::atomic<std::uint64_t>, bucketCount> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<std::uint64_t> max_{0};
 };
 
-class CarRecordParser {
+class MetricsRegistry {
 public:
-    explicit CarRecordParser(std::shared_ptr<CarRecordValidator> validator)
-        : validator_(std::move(validator)) {}
+    static MetricsRegistry &instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
 
-    std::optional<CarRecord> parse(const std::string &line) const {
-        if (line.empty()) {
-            return std::nullopt;
+    // References stay valid for the life of the process; hot paths look them up once.
+    Counter &counter(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &slot = counters_[name];
+        if (!slot) {
+            slot = std::make_unique<Counter>();
         }
+        return *slot;
+    }
 
-        std::vector<std::string> tokens;
-        std::string token;
-        std::stringstream ss(line);
-        while (std::getline(ss, token, ',')) {
-            tokens.push_back(token);
+    LatencyHistogram &histogram(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &slot = histograms_[name];
+        if (!slot) {
+            slot = std::make_unique<LatencyHistogram>();
         }
+        return *slot;
+    }
 
-        if (tokens.size() < 4) {
-            throw std::runtime_error("Malformed car record: " + line);
+    void writeText(std::ostream &out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &[name, counter] : counters_) {
+            out << "  " << name << ": " << counter->value() << std::endl;
         }
-
-        CarRecord record;
-        if (tokens.size() >= 4) {
-            record.id = tokens[0];
-            record.model = tokens.size() > 4 ? tokens[1] : tokens[0];
-            record.condition = tokens.size() > 4 ? tokens[2] : tokens[1];
-            record.pricePerDay = std::stod(tokens.size() > 4 ? tokens[3] : tokens[2]);
-            record.status = tokens.size() > 4 ? tokens[4] : (tokens.size() > 3 ? tokens[3] : "Available");
-        } else {
-            throw std::runtime_error("Malformed car record: " + line);
+        for (const auto &[name, histogram] : histograms_) {
+            const auto summary = histogram->summary();
+            if (summary.count == 0) {
+                continue;
+            }
+            out << "  " << name << ": n=" << summary.count << " p50 " << micros(summary.p50) << " us, p90 "
+                << micros(summary.p90) << " us, p99 " << micros(summary.p99) << " us, max " << micros(summary.max)
+                << " us, total " << micros(summary.total) / 1000 << " ms" << std::endl;
         }
+    }
 
-        if (!validator_->validate(record)) {
-            throw std::runtime_error("Validation failed for line: " + line);
+    void writeJson(std::ostream &out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out << "{\"counters\": {";
+        const char *separator = "";
+        for (const auto &[name, counter] : counters_) {
+            out << separator << "\"" << name << "\": " << counter->value();
+            separator = ", ";
         }
-
-        return record;
+        out << "}, \"histograms_us\": {";
+        separator = "";
+        for (const auto &[name, histogram] : histograms_) {
+            const auto summary = histogram->summary();
+            out << separator << "\"" << name << "\": {\"count\": " << summary.count << ", \"total\": "
+                << micros(summary.total) << ", \"p50\": " << micros(summary.p50) << ", \"p90\": "
+                << micros(summary.p90) << ", \"p99\": " << micros(summary.p99) << ", \"max\": "
+                << micros(summary.max) << "}";
+            separator = ", ";
+        }
+        out << "}}" << std::endl;
     }
 
-    std::string serialize(const CarRecord &record) const {
-        if (!validator_->validate(record)) {
-            throw std::runtime_error("Attempted to serialize invalid record: " + record.id);
-        }
+private:
+    MetricsRegistry() = default;
 
-        std::ostringstream oss;
-        oss << record.id << ',' << record.model << ',' << record.condition << ','
-            << record.pricePerDay << ',' << record.status;
-        return oss.str();
+    static long long micros(std::chrono::nanoseconds value) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(value).count();
     }
 
-private:
-    std::shared_ptr<CarRecordValidator> validator_;
+    mutable std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<Counter>> counters_;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms_;
 };
 
-class TransactionalFileWriter {
+// Records the lifetime of the scope into a histogram.
+class ScopedTimer {
 public:
-    explicit TransactionalFileWriter(std::string targetPath)
-        : targetPath_(std::move(targetPath)) {}
+    explicit ScopedTimer(LatencyHistogram &histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram_.record(std::chrono::steady_clock::now() - start_); }
 
-    void write(const std::vector<std::string> &lines) const {
-        namespace fs = std::filesystem;
-        fs::path target(targetPath_);
-        if (!target.has_parent_path()) {
-            target = fs::current_path() / target;
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    LatencyHistogram &histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// ScopedTimer for per-record paths: only every `every`-th pass through the scope is
+// timed (per thread, counted in `tick`), which keeps the clock reads off the hot path.
+class SampledTimer {
+public:
+    SampledTimer(LatencyHistogram &histogram, std::uint32_t &tick, std::uint32_t every = 64)
+        : histogram_(histogram), sampled_(++tick % every == 0) {
+        if (sampled_) {
+            start_ = std::chrono::steady_clock::now();
         }
-        if (!target.parent_path().empty()) {
-            fs::create_directories(target.parent_path());
+    }
+    ~SampledTimer() {
+        if (sampled_) {
+            histogram_.record(std::chrono::steady_clock::now() - start_);
         }
+    }
 
-        const fs::path temp = target; // overwritten with .tmp extension
-        fs::path tmpPath = temp;
-        tmpPath += ".tmp";
+    SampledTimer(const SampledTimer &) = delete;
+    SampledTimer &operator=(const SampledTimer &) = delete;
 
-        std::ofstream output(tmpPath, std::ios::binary | std::ios::trunc);
-        if (!output.is_open()) {
-            throw std::runtime_error("Unable to open temporary file for transactional write");
-        }
+private:
+    LatencyHistogram &histogram_;
+    bool sampled_;
+    std::chrono::steady_clock::time_point start_;
+};
 
-        std::vector<char> buffer(1 << 16);
-        output.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
-        for (const auto &line : lines) {
-            output << line << '\n';
-        }
-        output.flush();
-        output.close();
+// Process-wide pool of immutable strings for low-cardinality fields such as car models.
+// Entries are never released, which is the right trade for a handful of distinct values.
+class StringPool {
+public:
+    static StringPool &instance() {
+        static StringPool pool;
+        return pool;
+    }
 
-        if (fs::exists(target)) {
-            fs::remove(target);
+    const std::string *intern(std::string_view text) {
+        // Recently interned values are answered without touching the shared lock.
+        thread_local std::array<const std::string *, 8> recent{};
+        thread_local size_t nextSlot = 0;
+        for (const std::string *candidate : recent) {
+            if (candidate && *candidate == text) {
+                return candidate;
+            }
         }
-        fs::rename(tmpPath, target);
+
+        const std::string *value = lookup(text);
+        recent[nextSlot++ % recent.size()] = value;
+        return value;
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return strings_.size();
     }
 
 private:
-    std::string targetPath_;
+    const std::string *lookup(std::string_view text) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            const auto it = strings_.find(text);
+            if (it != strings_.end()) {
+                return &*it;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        return &*strings_.emplace(text).first;
+    }
+
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view text) const { return std::hash<std::string_view>{}(text); }
+    };
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_set<std::string, Hash, std::equal_to<>> strings_;
 };
 
-class CarFilePipeline {
+// A pointer into StringPool: copying and equality are pointer-sized. Values with one
+// entry per car, which would grow the pool forever, are made with unpooled() instead: a
+// reference-counted string outside the pool, told apart by the pointer's low bit.
+class InternedString {
 public:
-    CarFilePipeline(std::string path, std::shared_ptr<CarRecordValidator> validator)
-        : path_(std::move(path)), parser_(std::move(validator)) {}
+    InternedString() : bits_(pooled(emptyValue())) {}
+    InternedString(std::string_view text) : bits_(pooled(StringPool::instance().intern(text))) {}
+    InternedString(const std::string &text) : InternedString(std::string_view(text)) {}
+    InternedString(const char *text) : InternedString(std::string_view(text)) {}
+
+    static InternedString unpooled(std::string_view text) {
+        InternedString value;
+        value.bits_ = reinterpret_cast<std::uintptr_t>(new Unpooled{{1}, std::string(text)}) | unpooledBit;
+        return value;
+    }
 
-    std::vector<CarRecord> readAll() const {
-        std::vector<CarRecord> records;
-        stream([&records](CarRecord &&record) {
-            records.emplace_back(std::move(record));
-        });
-        return records;
+    InternedString(const InternedString &other) : bits_(other.bits_) { retain(); }
+    InternedString(InternedString &&other) noexcept : bits_(std::exchange(other.bits_, pooled(emptyValue()))) {}
+    InternedString &operator=(const InternedString &other) {
+        if (this != &other) {
+            other.retain();
+            release();
+            bits_ = other.bits_;
+        }
+        return *this;
+    }
+    InternedString &operator=(InternedString &&other) noexcept {
+        if (this != &other) {
+            release();
+            bits_ = std::exchange(other.bits_, pooled(emptyValue()));
+        }
+        return *this;
     }
+    ~InternedString() { release(); }
 
-    void stream(const std::function<void(CarRecord &&)> &consumer) const {
-        namespace fs = std::filesystem;
-        fs::path filePath(path_);
-        if (!fs::exists(filePath)) {
-            return;
+    const std::string &str() const {
+        return (bits_ & unpooledBit) ? owned()->text : *reinterpret_cast<const std::string *>(bits_);
+    }
+    bool empty() const { return str().empty(); }
+
+    // Two pooled values are equal only if they are the same entry.
+    friend bool operator==(const InternedString &lhs, const InternedString &rhs) {
+        return lhs.bits_ == rhs.bits_ || (((lhs.bits_ | rhs.bits_) & unpooledBit) && lhs.str() == rhs.str());
+    }
+    friend bool operator==(const InternedString &lhs, std::string_view rhs) { return lhs.str() == rhs; }
+    friend bool operator==(const InternedString &lhs, const std::string &rhs) { return lhs.str() == rhs; }
+    friend bool operator==(const InternedString &lhs, const char *rhs) { return lhs.str() == rhs; }
+    friend std::ostream &operator<<(std::ostream &out, const InternedString &text) { return out << text.str(); }
+
+private:
+    static constexpr std::uintptr_t unpooledBit = 1;
+
+    struct Unpooled {
+        std::atomic<size_t> references;
+        std::string text;
+    };
+
+    static const std::string *emptyValue() {
+        static const std::string *empty = StringPool::instance().intern({});
+        return empty;
+    }
+
+    static std::uintptr_t pooled(const std::string *value) { return reinterpret_cast<std::uintptr_t>(value); }
+
+    Unpooled *owned() const { return reinterpret_cast<Unpooled *>(bits_ & ~unpooledBit); }
+
+    void retain() const {
+        if (bits_ & unpooledBit) {
+            owned()->references.fetch_add(1, std::memory_order_relaxed);
         }
+    }
 
-        std::ifstream input(path_);
-        if (!input.is_open()) {
-            throw std::runtime_error("Unable to open " + path_);
+    void release() {
+        if ((bits_ & unpooledBit) && owned()->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete owned();
         }
+    }
 
-        std::vector<char> buffer(1 << 16);
-        input.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    std::uintptr_t bits_;
+};
 
-        std::string line;
-        while (std::getline(input, line)) {
-            try {
-                auto record = parser_.parse(line);
-                if (record.has_value()) {
-                    consumer(std::move(*record));
-                }
-            } catch (const std::exception &ex) {
-                std::cerr << "[WARN] Skipping line: " << ex.what() << std::endl;
-            }
+enum class CarCondition : std::uint8_t { Excellent, Good, Fair, MinorDamages, MajorDamages };
+
+inline constexpr std::array<std::string_view, 5> conditionNames{
+    "excellent", "good", "fair", "minordamages", "majordamages"};
+
+inline std::string_view toString(CarCondition condition) {
+    return conditionNames[static_cast<size_t>(condition)];
+}
+
+inline std::optional<CarCondition> parseCondition(std::string_view text) {
+    for (size_t i = 0; i < conditionNames.size(); ++i) {
+        if (conditionNames[i] == text) {
+            return static_cast<CarCondition>(i);
         }
     }
+    return std::nullopt;
+}
 
-    void writeAll(const std::vector<CarRecord> &records) const {
-        std::vector<std::string> lines;
-        lines.reserve(records.size());
-        for (const auto &record : records) {
-            lines.push_back(parser_.serialize(record));
-        }
+enum class CarStatus : std::uint8_t { Available, Rented };
+
+// Calendar dates are stored as days since 1970-01-01; 0 doubles as "no due date", which
+// no rental made by this program can ever have.
+inline constexpr std::int32_t noDueDate = 0;
+inline constexpr std::int32_t rentalPeriodDays = 30;
+
+inline std::int32_t today() {
+    const auto days = std::chrono::floor<std::chrono::days>(std::chrono::system_clock::now());
+    return static_cast<std::int32_t>(days.time_since_epoch().count());
+}
 
-        TransactionalFileWriter writer(path_);
-        writer.write(lines);
+// Parses "YYYY-MM-DD"; anything else (including impossible dates) is rejected.
+inline std::optional<std::int32_t> parseDate(std::string_view text) {
+    int year = 0;
+    unsigned month = 0;
+    unsigned day = 0;
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-' ||
+        std::from_chars(text.data(), text.data() + 4, year).ptr != text.data() + 4 ||
+        std::from_chars(text.data() + 5, text.data() + 7, month).ptr != text.data() + 7 ||
+        std::from_chars(text.data() + 8, text.data() + 10, day).ptr != text.data() + 10) {
+        return std::nullopt;
     }
+    const std::chrono::year_month_day date{std::chrono::year{year}, std::chrono::month{month}, std::chrono::day{day}};
+    if (!date.ok()) {
+        return std::nullopt;
+    }
+    return static_cast<std::int32_t>(std::chrono::sys_days(date).time_since_epoch().count());
+}
 
-    const std::string &path() const { return path_; }
+inline void appendDate(std::int32_t days, std::string &out) {
+    const std::chrono::year_month_day date{std::chrono::sys_days(std::chrono::days(days))};
+    std::array<char, 16> text{};
+    const int length = std::snprintf(text.data(), text.size(), "%04d-%02u-%02u", static_cast<int>(date.year()),
+                                     static_cast<unsigned>(date.month()), static_cast<unsigned>(date.day()));
+    out.append(text.data(), static_cast<size_t>(length));
+}
 
-private:
-    std::string path_;
-    CarRecordParser parser_;
-};
+inline std::string formatDate(std::int32_t days) {
+    std::string text;
+    appendDate(days, text);
+    return text;
+}
 
-class StorageBackend {
-public:
-    virtual ~StorageBackend() = default;
-    virtual std::vector<CarRecord> loadCars() = 0;
-    virtual void persistCars(const std::vector<CarRecord> &records) = 0;
-    virtual std::string name() const = 0;
+struct CarRecord {
+    std::string id;
+    InternedString model;
+    CarCondition condition{CarCondition::Excellent};
+    double pricePerDay{0.0};
+    CarStatus status{CarStatus::Available};
+    // Only meaningful while status is Rented.
+    std::string renterId;
+    std::int32_t dueDate{noDueDate};
 };
 
-class FileStorageBackend : public StorageBackend {
-public:
-    FileStorageBackend(std::string path, std::shared_ptr<CarRecordValidator> validator)
-        : pipeline_(std::move(path), std::move(validator)) {}
+// A model equal to the car's id, as 4-column rows and legacy menu cars have it, is one
+// string per car, so it is kept out of the StringPool.
+inline InternedString modelName(std::string_view model, std::string_view id) {
+    return model == id ? InternedString::unpooled(model) : InternedString(model);
+}
 
-    std::vector<CarRecord> loadCars() override {
-        return pipeline_.readAll();
+inline constexpr int finePerLateDay = 20;
+
+// The fine owed as of `day` on a car kept past its due date: finePerLateDay per late day.
+inline int fineAsOf(const CarRecord &record, std::int32_t day) {
+    if (record.status != CarStatus::Rented || record.dueDate == noDueDate || day <= record.dueDate) {
+        return 0;
     }
+    return finePerLateDay * (day - record.dueDate);
+}
+
+inline constexpr std::string_view availableStatusText{"Available"};
+inline constexpr std::string_view rentedStatusPrefix{"Rented by the user ID: "};
 
-    void persistCars(const std::vector<CarRecord> &records) override {
-        pipeline_.writeAll(records);
+// The on-disk spelling of a record's status, e.g. "Rented by the user ID: C1001".
+inline std::string statusText(const CarRecord &record) {
+    if (record.status == CarStatus::Rented) {
+        return std::string(rentedStatusPrefix) + record.renterId;
     }
+    return std::string(availableStatusText);
+}
 
-    std::string name() const override {
-        return "file:" + pipeline_.path();
+inline std::optional<std::string_view> renterOf(const CarRecord &record) {
+    if (record.status != CarStatus::Rented) {
+        return std::nullopt;
     }
+    return std::string_view(record.renterId);
+}
+
+// Minimal stand-ins for C++23 std::expected/std::unexpected: either a value or an error.
+// T must be default-constructible; a failed result holds a default T it never exposes.
+template <typename E>
+struct Unexpected {
+    E error;
+};
+
+template <typename T, typename E>
+class Expected {
+public:
+    template <typename U = T,
+              typename = std::enable_if_t<std::is_constructible_v<T, U &&> &&
+                                          !std::is_same_v<std::decay_t<U>, Unexpected<E>>>>
+    Expected(U &&value) : value_(std::forward<U>(value)) {}
+    Expected(Unexpected<E> failure) : error_(failure.error), ok_(false) {}
+
+    bool has_value() const { return ok_; }
+    explicit operator bool() const { return ok_; }
+    T &value() & { return value_; }
+    T &&value() && { return std::move(value_); }
+    const T &value() const & { return value_; }
+    // Only meaningful when has_value() is false.
+    E error() const { return error_; }
 
 private:
-    CarFilePipeline pipeline_;
+    T value_{};
+    E error_{};
+    bool ok_{true};
 };
 
-class MemoryStorageBackend : public StorageBackend {
+enum class ParseError { Malformed, UnknownCondition, InvalidPrice, UnknownStatus, InvalidDueDate, ValidationFailed };
+
+inline std::string_view toString(ParseError error) {
+    switch (error) {
+    case ParseError::Malformed:
+        return "Malformed car record";
+    case ParseError::UnknownCondition:
+        return "Unknown condition";
+    case ParseError::InvalidPrice:
+        return "Invalid price";
+    case ParseError::UnknownStatus:
+        return "Unknown status";
+    case ParseError::InvalidDueDate:
+        return "Invalid due date";
+    case ParseError::ValidationFailed:
+        return "Validation failed";
+    }
+    return "Unknown parse error";
+}
+
+class CarRecordValidator {
 public:
-    MemoryStorageBackend() = default;
-    explicit MemoryStorageBackend(std::vector<CarRecord> seed) : records_(std::move(seed)) {}
+    bool validate(const CarRecord &record) const {
+        if (record.id.empty() || record.model.empty()) {
+            return false;
+        }
 
-    std::vector<CarRecord> loadCars() override {
-        return records_;
+        if (static_cast<size_t>(record.condition) >= conditionNames.size()) {
+            return false;
+        }
+
+        if (!std::isfinite(record.pricePerDay) || record.pricePerDay <= 0) {
+            return false;
+        }
+
+        return true;
+    }
+};
+
+// Finds the newlines and commas of a buffer 64 bytes at a time: each block becomes one
+// bitmask of delimiter positions, and lines and fields are cut by walking its set bits
+// instead of searching byte by byte. The block kernel is chosen once at runtime.
+class DelimiterScanner {
+public:
+    enum class Level { Scalar, Sse2, Avx2 };
+
+    // One line and its first fields. `count` keeps counting past the stored fields, and an
+    // empty last field is not counted, as CarRecordParser::tryParse(std::string_view) does.
+    struct Line {
+        // Without the newline but with any carriage return, as read.
+        std::string_view text;
+        size_t offset{0};
+        std::array<std::string_view, 6> fields;
+        size_t count{0};
+    };
+
+    static Level best() {
+        static const Level level = detect();
+        return level;
     }
 
-    void persistCars(const std::vector<CarRecord> &records) override {
-        records_ = records;
+    // Levels the CPU lacks fall back to the best one it has.
+    explicit DelimiterScanner(std::string_view data, Level level = best())
+        : data_(data), kernel_(kernelFor(std::min(level, best()))) {
+        load(0);
     }
 
-    std::string name() const override {
-        return "in-memory";
+    // False once the data is exhausted; a last line without a newline is still returned.
+    bool next(Line &line) {
+        if (lineStart_ >= data_.size()) {
+            return false;
+        }
+        line.offset = lineStart_;
+        line.count = 0;
+        size_t fieldStart = lineStart_;
+        for (;;) {
+            const size_t at = nextDelimiter();
+            if (at == data_.size() || data_[at] == '\n') {
+                const size_t end = at > lineStart_ && data_[at - 1] == '\r' ? at - 1 : at;
+                if (fieldStart < end) {
+                    push(line, fieldStart, end);
+                }
+                line.text = data_.substr(lineStart_, at - lineStart_);
+                lineStart_ = at + 1;
+                return true;
+            }
+            push(line, fieldStart, at);
+            fieldStart = at + 1;
+        }
     }
 
 private:
-    std::vector<CarRecord> records_;
-};
+    static constexpr size_t blockSize = 64;
+    using Kernel = std::uint64_t (*)(const char *block);
+
+    static Level detect() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Level::Avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return Level::Sse2;
+        }
+#endif
+        return Level::Scalar;
+    }
 
-enum class BackendType { File, Memory };
+    static Kernel kernelFor(Level level) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (level == Level::Avx2) {
+            return avx2Mask;
+        }
+        if (level == Level::Sse2) {
+            return sse2Mask;
+        }
+#endif
+        (void)level;
+        return scalarMask;
+    }
 
-class StorageBackendFactory {
-public:
-    static std::shared_ptr<StorageBackend> create(BackendType type,
-                                                  const std::string &path,
-                                                  std::shared_ptr<CarRecordValidator> validator) {
-        switch (type) {
-        case BackendType::File:
-            return std::make_shared<FileStorageBackend>(path, std::move(validator));
-        case BackendType::Memory:
-            return std::make_shared<MemoryStorageBackend>();
+    // Eight bytes per step in a general register: a byte of `word ^ pattern` is zero where
+    // the byte matched, and the classic exact zero-byte test turns that into its top bit.
+    static std::uint64_t scalarMask(const char *block) {
+        constexpr std::uint64_t low = 0x7f7f7f7f7f7f7f7fULL;
+        const auto matches = [](std::uint64_t word, std::uint64_t pattern) {
+            const std::uint64_t bytes = word ^ pattern;
+            return ~(((bytes & low) + low) | bytes | low);
+        };
+        std::uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; i += 8) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, block + i, sizeof(word));
+            if constexpr (std::endian::native == std::endian::big) {
+                word = __builtin_bswap64(word);
+            }
+            const std::uint64_t hits = matches(word, 0x0a0a0a0a0a0a0a0aULL) | matches(word, 0x2c2c2c2c2c2c2c2cULL);
+            // Gathers the top bit of each byte into the low eight bits, byte 0 first.
+            mask |= (((hits >> 7) * 0x0102040810204080ULL) >> 56) << i;
         }
-        throw std::invalid_argument("Unknown backend type");
+        return mask;
     }
-};
 
-class CarRepository {
-public:
-    explicit CarRepository(std::shared_ptr<StorageBackend> backend)
-        : backend_(std::move(backend)) {
-        reload();
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse2"))) static std::uint64_t sse2Mask(const char *block) {
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i comma = _mm_set1_epi8(',');
+        std::uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; i += 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i));
+            const __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, comma));
+            mask |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_movemask_epi8(hits))) << i;
+        }
+        return mask;
     }
 
-    void reload() {
-        records_.clear();
-        auto loaded = backend_->loadCars();
-        for (auto &record : loaded) {
-            records_[record.id] = record;
+    __attribute__((target("avx2"))) static std::uint64_t avx2Mask(const char *block) {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i comma = _mm256_set1_epi8(',');
+        std::uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; i += 32) {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + i));
+            const __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newline), _mm256_cmpeq_epi8(bytes, comma));
+            mask |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(hits))) << i;
         }
-        dirty_ = false;
+        return mask;
     }
+#endif
 
-    std::vector<CarRecord> all() const {
-        std::vector<CarRecord> snapshot;
-        snapshot.reserve(records_.size());
-        for (const auto &pair : records_) {
-            snapshot.push_back(pair.second);
+    // The last, partial block is copied out so the kernels never read past the data.
+    void load(size_t base) {
+        block_ = base;
+        const size_t remaining = data_.size() - base;
+        if (remaining >= blockSize) {
+            pending_ = kernel_(data_.data() + base);
+            return;
         }
-        std::sort(snapshot.begin(), snapshot.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
-            return lhs.id < rhs.id;
-        });
-        return snapshot;
+        std::array<char, blockSize> tail{};
+        std::memcpy(tail.data(), data_.data() + base, remaining);
+        pending_ = kernel_(tail.data());
     }
 
-    std::vector<CarRecord> available() const {
-        std::vector<CarRecord> output;
-        for (const auto &pair : records_) {
-            if (pair.second.status == "Available") {
-                output.push_back(pair.second);
+    // The position of the next newline or comma, or data_.size() when none is left.
+    size_t nextDelimiter() {
+        while (pending_ == 0) {
+            if (block_ + blockSize >= data_.size()) {
+                return data_.size();
             }
+            load(block_ + blockSize);
         }
-        std::sort(output.begin(), output.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
-            return lhs.id < rhs.id;
-        });
-        return output;
+        const size_t at = block_ + static_cast<size_t>(std::countr_zero(pending_));
+        pending_ &= pending_ - 1;
+        return at;
     }
 
-    std::optional<CarRecord> find(const std::string &id) const {
-        auto it = records_.find(id);
-        if (it == records_.end()) {
-            return std::nullopt;
+    void push(Line &line, size_t begin, size_t end) const {
+        if (line.count < line.fields.size()) {
+            line.fields[line.count] = data_.substr(begin, end - begin);
+        }
+        ++line.count;
+    }
+
+    std::string_view data_;
+    Kernel kernel_;
+    size_t block_{0};
+    std::uint64_t pending_{0};
+    size_t lineStart_{0};
+};
+
+inline std::string_view toString(DelimiterScanner::Level level) {
+    switch (level) {
+    case DelimiterScanner::Level::Scalar:
+        return "scalar";
+    case DelimiterScanner::Level::Sse2:
+        return "sse2";
+    case DelimiterScanner::Level::Avx2:
+        return "avx2";
+    }
+    return "scalar";
+}
+
+class CarRecordParser {
+public:
+    explicit CarRecordParser(std::shared_ptr<CarRecordValidator> validator)
+        : validator_(std::move(validator)) {}
+
+    // Throwing wrapper over tryParse() for callers that treat a bad line as fatal.
+    std::optional<CarRecord> parse(std::string_view line) const {
+        auto result = tryParse(line);
+        if (!result) {
+            throw std::runtime_error(std::string(toString(result.error())) + ": " + std::string(line));
+        }
+        return std::move(result).value();
+    }
+
+    // Tokenizes in place over `line`; only the final CarRecord fields are allocated. Blank
+    // lines yield an empty optional and bad lines an error code, so rejecting a line costs
+    // no more than accepting one.
+    Expected<std::optional<CarRecord>, ParseError> tryParse(std::string_view line) const {
+        static LatencyHistogram &parseLatency = MetricsRegistry::instance().histogram("parse");
+        thread_local std::uint32_t parseTick = 0;
+        const SampledTimer timer(parseLatency, parseTick);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            return std::optional<CarRecord>();
+        }
+
+        DelimiterScanner::Line tokens;
+        size_t &count = tokens.count;
+        size_t begin = 0;
+        while (begin < line.size()) {
+            const size_t comma = line.find(',', begin);
+            const size_t end = comma == std::string_view::npos ? line.size() : comma;
+            if (count < tokens.fields.size()) {
+                tokens.fields[count] = line.substr(begin, end - begin);
+            }
+            ++count;
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            begin = comma + 1;
+        }
+        return parseFields(tokens);
+    }
+
+    // The same for a line DelimiterScanner has already cut into fields.
+    Expected<std::optional<CarRecord>, ParseError> tryParse(const DelimiterScanner::Line &line) const {
+        static LatencyHistogram &parseLatency = MetricsRegistry::instance().histogram("parse");
+        thread_local std::uint32_t parseTick = 0;
+        const SampledTimer timer(parseLatency, parseTick);
+        if (line.count == 0) {
+            return std::optional<CarRecord>();
+        }
+        return parseFields(line);
+    }
+
+    std::string serialize(const CarRecord &record) const {
+        std::string line;
+        appendTo(record, line);
+        return line;
+    }
+
+    bool validate(const CarRecord &record) const {
+        static LatencyHistogram &validateLatency = MetricsRegistry::instance().histogram("validate");
+        thread_local std::uint32_t validateTick = 0;
+        const SampledTimer timer(validateLatency, validateTick);
+        return validator_->validate(record);
+    }
+
+    // Appends the serialized line (without a newline) to `out`.
+    void appendTo(const CarRecord &record, std::string &out) const {
+        if (!validator_->validate(record)) {
+            throw std::runtime_error("Attempted to serialize invalid record: " + record.id);
+        }
+
+        out += record.id;
+        out += ',';
+        out += record.model.str();
+        out += ',';
+        out += toString(record.condition);
+        out += ',';
+        appendPrice(record.pricePerDay, out);
+        out += ',';
+        if (record.status == CarStatus::Rented) {
+            out += rentedStatusPrefix;
+            out += record.renterId;
+        } else {
+            out += availableStatusText;
+        }
+        // The optional sixth column; records without a due date keep the 5-column form.
+        if (record.dueDate != noDueDate) {
+            out += ',';
+            appendDate(record.dueDate, out);
+        }
+    }
+
+private:
+    // Shortest fixed notation that round-trips, so 2500 stays "2500" and 1234567 is no
+    // longer rounded to "1.23457e+06" as the default ostream precision did. Prices too wide
+    // for fixed notation (1e64 and up) take the shortest general form, which parsePrice
+    // reads back just the same.
+    static void appendPrice(double price, std::string &out) {
+        std::array<char, 64> digits{};
+        auto result = std::to_chars(digits.data(), digits.data() + digits.size(), price,
+                                    std::chars_format::fixed);
+        if (result.ec == std::errc::value_too_large) {
+            result = std::to_chars(digits.data(), digits.data() + digits.size(), price,
+                                   std::chars_format::general);
+        }
+        if (result.ec != std::errc()) {
+            throw std::runtime_error("Unable to format price");
+        }
+        out.append(digits.data(), result.ptr);
+    }
+
+    static std::optional<double> parsePrice(std::string_view token) {
+        while (!token.empty() && std::isspace(static_cast<unsigned char>(token.front()))) {
+            token.remove_prefix(1);
+        }
+        double price = 0.0;
+        const auto [end, ec] = std::from_chars(token.data(), token.data() + token.size(), price);
+        if (ec != std::errc() || end != token.data() + token.size()) {
+            return std::nullopt;
+        }
+        return price;
+    }
+
+    Expected<std::optional<CarRecord>, ParseError> parseFields(const DelimiterScanner::Line &line) const {
+        const auto &tokens = line.fields;
+        const size_t count = line.count;
+        if (count < 4) {
+            return Unexpected<ParseError>{ParseError::Malformed};
+        }
+
+        const bool hasModel = count > 4;
+        const auto condition = parseCondition(hasModel ? tokens[2] : tokens[1]);
+        if (!condition) {
+            return Unexpected<ParseError>{ParseError::UnknownCondition};
+        }
+        const auto price = parsePrice(hasModel ? tokens[3] : tokens[2]);
+        if (!price) {
+            return Unexpected<ParseError>{ParseError::InvalidPrice};
+        }
+        const auto status = hasModel ? tokens[4] : tokens[3];
+        const bool available = status == availableStatusText;
+        if (!available && status.substr(0, rentedStatusPrefix.size()) != rentedStatusPrefix) {
+            return Unexpected<ParseError>{ParseError::UnknownStatus};
+        }
+        std::int32_t dueDate = noDueDate;
+        if (count > 5 && !tokens[5].empty() && tokens[5] != "None") {
+            const auto parsedDate = parseDate(tokens[5]);
+            if (!parsedDate) {
+                return Unexpected<ParseError>{ParseError::InvalidDueDate};
+            }
+            dueDate = *parsedDate;
+        }
+
+        std::optional<CarRecord> parsed(std::in_place);
+        CarRecord &record = *parsed;
+        record.id.assign(tokens[0]);
+        record.model = modelName(hasModel ? tokens[1] : tokens[0], tokens[0]);
+        record.condition = *condition;
+        record.pricePerDay = *price;
+        if (!available) {
+            record.status = CarStatus::Rented;
+            record.renterId.assign(status.substr(rentedStatusPrefix.size()));
+        }
+        record.dueDate = dueDate;
+
+        if (!validate(record)) {
+            return Unexpected<ParseError>{ParseError::ValidationFailed};
+        }
+
+        return parsed;
+    }
+
+    std::shared_ptr<CarRecordValidator> validator_;
+};
+
+// FNV-1a over the bytes of a file; identifies which snapshot a journal was written against.
+class ContentChecksum {
+public:
+    void update(std::string_view bytes) {
+        for (const unsigned char byte : bytes) {
+            value_ ^= byte;
+            value_ *= 1099511628211ULL;
+        }
+    }
+
+    std::uint64_t value() const { return value_; }
+
+private:
+    std::uint64_t value_{14695981039346656037ULL};
+};
+
+// How far a commit goes before it is acknowledged. DataSync flushes file contents
+// (fdatasync); Full additionally fsyncs the containing directory after a rename so the
+// new name itself survives power loss.
+enum class DurabilityMode { None, DataSync, Full };
+
+inline std::string_view toString(DurabilityMode mode) {
+    switch (mode) {
+    case DurabilityMode::None:
+        return "none";
+    case DurabilityMode::DataSync:
+        return "data";
+    case DurabilityMode::Full:
+        return "full";
+    }
+    return "unknown";
+}
+
+// Thin owner of a POSIX file descriptor; used where the writers need to sync.
+class FileDescriptor {
+public:
+    FileDescriptor(const std::string &path, int flags) : path_(path) {
+        fd_ = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Unable to open " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+    void writeAll(std::string_view bytes) {
+        while (!bytes.empty()) {
+            const ssize_t written = ::write(fd_, bytes.data(), bytes.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Failed to write " + path_ + ": " + std::strerror(errno));
+            }
+            bytes.remove_prefix(static_cast<size_t>(written));
+        }
+    }
+
+    void sync(DurabilityMode mode) {
+        if (mode == DurabilityMode::None) {
+            return;
+        }
+#if defined(__APPLE__)
+        const int result = ::fsync(fd_);
+#else
+        const int result = mode == DurabilityMode::DataSync ? ::fdatasync(fd_) : ::fsync(fd_);
+#endif
+        if (result != 0) {
+            throw std::runtime_error("Failed to sync " + path_ + ": " + std::strerror(errno));
+        }
+    }
+
+    off_t size() const {
+        struct stat info {};
+        if (::fstat(fd_, &info) != 0) {
+            throw std::runtime_error("Failed to stat " + path_ + ": " + std::strerror(errno));
+        }
+        return info.st_size;
+    }
+
+    void truncate(off_t length) {
+        if (::ftruncate(fd_, length) != 0) {
+            throw std::runtime_error("Failed to truncate " + path_ + ": " + std::strerror(errno));
+        }
+    }
+
+    void close() {
+        const int fd = fd_;
+        fd_ = -1;
+        if (fd >= 0 && ::close(fd) != 0) {
+            throw std::runtime_error("Failed to close " + path_ + ": " + std::strerror(errno));
+        }
+    }
+
+    static void syncDirectory(const std::string &directory) {
+        FileDescriptor dir(directory, O_RDONLY | O_DIRECTORY);
+        dir.sync(DurabilityMode::Full);
+    }
+
+private:
+    std::string path_;
+    int fd_{-1};
+};
+
+// Byte count and per-phase latency of one commit; renameTime is zero for journal appends.
+struct CommitStats {
+    std::uint64_t checksum{0};
+    size_t bytes{0};
+    // Producing the bytes; writeTime below is only the time spent in write(2).
+    std::chrono::microseconds serializeTime{0};
+    std::chrono::microseconds writeTime{0};
+    std::chrono::microseconds syncTime{0};
+    std::chrono::microseconds renameTime{0};
+};
+
+// Accumulates output lines and hands them to the file in large writes.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(FileDescriptor &out, size_t capacity = 1 << 20)
+        : out_(out), capacity_(capacity) {
+        buffer_.reserve(capacity_ + 256);
+    }
+
+    // The line being built; producers append to it and then call endLine().
+    std::string &line() { return buffer_; }
+
+    void endLine() {
+        buffer_ += '\n';
+        if (buffer_.size() >= capacity_) {
+            drain();
+        }
+    }
+
+    // Raw bytes for non-line formats.
+    void append(std::string_view bytes) {
+        buffer_ += bytes;
+        if (buffer_.size() >= capacity_) {
+            drain();
+        }
+    }
+
+    void drain() {
+        checksum_.update(buffer_);
+        const auto start = std::chrono::steady_clock::now();
+        out_.writeAll(buffer_);
+        writeTime_ += std::chrono::steady_clock::now() - start;
+        bytes_ += buffer_.size();
+        buffer_.clear();
+    }
+
+    std::uint64_t checksum() const { return checksum_.value(); }
+    size_t bytes() const { return bytes_; }
+    std::chrono::steady_clock::duration writeTime() const { return writeTime_; }
+
+private:
+    FileDescriptor &out_;
+    size_t capacity_;
+    std::string buffer_;
+    ContentChecksum checksum_;
+    size_t bytes_{0};
+    std::chrono::steady_clock::duration writeTime_{};
+};
+
+class TransactionalFileWriter {
+public:
+    explicit TransactionalFileWriter(std::string targetPath, DurabilityMode durability = DurabilityMode::None)
+        : targetPath_(std::move(targetPath)), durability_(durability) {}
+
+    CommitStats write(const std::vector<std::string> &lines) const {
+        return writeWith([&lines](OutputBuffer &out) {
+            for (const auto &line : lines) {
+                out.line() += line;
+                out.endLine();
+            }
+        });
+    }
+
+    // Streams whatever `produce` appends straight into the temp file, so callers never
+    // need to materialise the full set of lines. The temp file is renamed over the
+    // target, which atomically replaces it: readers see the old or the new contents,
+    // never a missing file.
+    CommitStats writeWith(const std::function<void(OutputBuffer &)> &produce) const {
+        namespace fs = std::filesystem;
+        using Clock = std::chrono::steady_clock;
+        fs::path target(targetPath_);
+        if (!target.has_parent_path()) {
+            target = fs::current_path() / target;
+        }
+        if (!target.parent_path().empty()) {
+            fs::create_directories(target.parent_path());
+        }
+
+        fs::path tmpPath = target;
+        tmpPath += ".tmp";
+
+        CommitStats stats;
+        const auto writeStart = Clock::now();
+        FileDescriptor output(tmpPath.string(), O_WRONLY | O_CREAT | O_TRUNC);
+        OutputBuffer buffer(output);
+        Clock::time_point syncStart;
+        Clock::time_point renameStart;
+        try {
+            produce(buffer);
+            buffer.drain();
+            syncStart = Clock::now();
+            output.sync(durability_);
+            output.close();
+            renameStart = Clock::now();
+            fs::rename(tmpPath, target);
+        } catch (...) {
+            // A half-written temp file is never renamed into place; don't leave it behind.
+            std::error_code ignored;
+            fs::remove(tmpPath, ignored);
+            throw;
+        }
+        const auto renameEnd = Clock::now();
+        if (durability_ == DurabilityMode::Full) {
+            FileDescriptor::syncDirectory(target.parent_path().string());
+        }
+        const auto end = Clock::now();
+
+        stats.checksum = buffer.checksum();
+        stats.bytes = buffer.bytes();
+        stats.serializeTime =
+            std::chrono::duration_cast<std::chrono::microseconds>(syncStart - writeStart - buffer.writeTime());
+        stats.writeTime = std::chrono::duration_cast<std::chrono::microseconds>(buffer.writeTime());
+        stats.syncTime = std::chrono::duration_cast<std::chrono::microseconds>(
+            (renameStart - syncStart) + (end - renameEnd));
+        stats.renameTime = std::chrono::duration_cast<std::chrono::microseconds>(renameEnd - renameStart);
+        return stats;
+    }
+
+private:
+    std::string targetPath_;
+    DurabilityMode durability_;
+};
+
+using RecordVisitor = std::function<void(const CarRecord &)>;
+// Calls the visitor once per record; lets writers pull records without a copied vector.
+using RecordSource = std::function<void(const RecordVisitor &)>;
+
+inline RecordSource sourceOf(const std::vector<CarRecord> &records) {
+    return [&records](const RecordVisitor &visit) {
+        for (const auto &record : records) {
+            visit(record);
+        }
+    };
+}
+
+// Read-only mapping of a regular file. mapped() is false for pipes, character devices or
+// when mmap itself fails, in which case callers fall back to buffered streams.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            size_ = static_cast<size_t>(info.st_size);
+            if (size_ == 0) {
+                mapped_ = true;
+            } else {
+                void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    ::madvise(data, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char *>(data);
+                    mapped_ = true;
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool mapped() const { return mapped_; }
+    std::string_view view() const { return data_ ? std::string_view(data_, size_) : std::string_view(); }
+
+private:
+    const char *data_{nullptr};
+    size_t size_{0};
+    bool mapped_{false};
+};
+
+// Auto maps regular files and streams everything else ("-" reads stdin).
+enum class ReadMode { Auto, Mapped, Stream };
+
+// A line the parser refused. `line` is 1-based and `offset` is the byte offset of the line,
+// both counted from the start of the data being scanned; `text` is only valid during the
+// handler call unless the data outlives it (as a mapped ingest input does).
+struct LineRejection {
+    size_t line{0};
+    size_t offset{0};
+    std::string_view text;
+    ParseError error{ParseError::Malformed};
+};
+// Without a handler rejected lines are reported on stderr.
+using RejectionHandler = std::function<void(const LineRejection &)>;
+
+class CarFilePipeline {
+public:
+    CarFilePipeline(std::string path, std::shared_ptr<CarRecordValidator> validator,
+                    ReadMode mode = ReadMode::Auto, DurabilityMode durability = DurabilityMode::None)
+        : path_(std::move(path)), parser_(std::move(validator)), mode_(mode), durability_(durability) {}
+
+    std::vector<CarRecord> readAll(std::uint64_t *checksum = nullptr) const {
+        std::vector<CarRecord> records;
+        stream([&records](CarRecord &&record) {
+            records.emplace_back(std::move(record));
+        }, checksum);
+        return records;
+    }
+
+    // When `checksum` is given it receives the ContentChecksum of the lines read.
+    void stream(const std::function<void(CarRecord &&)> &consumer, std::uint64_t *checksum = nullptr,
+                const RejectionHandler &onReject = {}) const {
+        namespace fs = std::filesystem;
+        ContentChecksum contents;
+        ContentChecksum *tracked = checksum ? &contents : nullptr;
+
+        if (path_ == "-") {
+            streamLines(std::cin, consumer, tracked, onReject);
+        } else if (fs::exists(fs::path(path_))) {
+            std::optional<MappedFile> mapped;
+            if (mode_ != ReadMode::Stream) {
+                mapped.emplace(path_);
+                if (!mapped->mapped() && mode_ == ReadMode::Mapped) {
+                    throw std::runtime_error("Unable to map " + path_);
+                }
+            }
+
+            if (mapped && mapped->mapped()) {
+                scanLines(mapped->view(), consumer, tracked, onReject);
+            } else {
+                std::ifstream input(path_, std::ios::binary);
+                if (!input.is_open()) {
+                    throw std::runtime_error("Unable to open " + path_);
+                }
+                streamLines(input, consumer, tracked, onReject);
+            }
+        }
+
+        if (checksum) {
+            *checksum = contents.value();
+        }
+    }
+
+    CommitStats writeAll(const std::vector<CarRecord> &records) const {
+        return writeFrom(sourceOf(records));
+    }
+
+    // Serializes each record straight into the transactional writer's output buffer.
+    CommitStats writeFrom(const RecordSource &records) const {
+        TransactionalFileWriter writer(path_, durability_);
+        return writer.writeWith([&](OutputBuffer &out) {
+            records([&](const CarRecord &record) {
+                parser_.appendTo(record, out.line());
+                out.endLine();
+            });
+        });
+    }
+
+    // Parses every line of an in-memory buffer; safe to call from several threads.
+    void scan(std::string_view data, const std::function<void(CarRecord &&)> &consumer,
+              const RejectionHandler &onReject = {}) const {
+        scanLines(data, consumer, nullptr, onReject);
+    }
+
+    // Like scan(), additionally passing the offset just past each record's line. Returns
+    // the number of lines scanned.
+    size_t scanWithOffsets(std::string_view data, const std::function<void(CarRecord &&, size_t)> &consumer,
+                           const RejectionHandler &onReject = {}) const {
+        size_t parsed = 0;
+        size_t lines = 0;
+        DelimiterScanner scanner(data);
+        DelimiterScanner::Line line;
+        while (scanner.next(line)) {
+            const size_t lineEnd = std::min(data.size(), line.offset + line.text.size() + 1);
+            auto result = parseOrReject(line, ++lines, 0, onReject);
+            if (result && result.value()) {
+                consumer(std::move(*result.value()), lineEnd);
+                ++parsed;
+            }
+        }
+        parsedRecords().add(parsed);
+        return lines;
+    }
+
+    const std::string &path() const { return path_; }
+
+private:
+    void scanLines(std::string_view data, const std::function<void(CarRecord &&)> &consumer,
+                   ContentChecksum *checksum, const RejectionHandler &onReject) const {
+        size_t lines = 0;
+        parsedRecords().add(scanBlock(data, 0, lines, consumer, checksum, onReject));
+    }
+
+    // Reads 64 KB blocks and scans the complete lines of each; an unfinished line is
+    // carried into the next block, which grows when a single line outsizes it.
+    void streamLines(std::istream &input, const std::function<void(CarRecord &&)> &consumer,
+                     ContentChecksum *checksum, const RejectionHandler &onReject) const {
+        size_t parsed = 0;
+        size_t lines = 0;
+        size_t base = 0;
+        std::vector<char> buffer(1 << 16);
+        size_t filled = 0;
+        while (input) {
+            if (filled == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+            input.read(buffer.data() + filled, static_cast<std::streamsize>(buffer.size() - filled));
+            filled += static_cast<size_t>(input.gcount());
+            const std::string_view block(buffer.data(), filled);
+            const size_t complete = input ? block.rfind('\n') + 1 : filled;
+            parsed += scanBlock(block.substr(0, complete), base, lines, consumer, checksum, onReject);
+            std::memmove(buffer.data(), buffer.data() + complete, filled - complete);
+            filled -= complete;
+            base += complete;
+        }
+        parsedRecords().add(parsed);
+    }
+
+    // `base` is the offset of `data` and `lines` the number of lines before it.
+    size_t scanBlock(std::string_view data, size_t base, size_t &lines,
+                     const std::function<void(CarRecord &&)> &consumer, ContentChecksum *checksum,
+                     const RejectionHandler &onReject) const {
+        size_t parsed = 0;
+        DelimiterScanner scanner(data);
+        DelimiterScanner::Line line;
+        while (scanner.next(line)) {
+            parsed += handleLine(line, consumer, checksum, ++lines, base, onReject);
+        }
+        return parsed;
+    }
+
+    // Counted once per scan rather than per record to keep the shared counter cold.
+    static Counter &parsedRecords() {
+        static Counter &counter = MetricsRegistry::instance().counter("records.parsed");
+        return counter;
+    }
+
+    bool handleLine(const DelimiterScanner::Line &line, const std::function<void(CarRecord &&)> &consumer,
+                    ContentChecksum *checksum, size_t lineNumber, size_t base,
+                    const RejectionHandler &onReject) const {
+        if (checksum) {
+            checksum->update(line.text);
+            checksum->update("\n");
+        }
+        auto result = parseOrReject(line, lineNumber, base, onReject);
+        if (result && result.value()) {
+            consumer(std::move(*result.value()));
+            return true;
+        }
+        return false;
+    }
+
+    // Reports a failed line before handing the result back; records are consumed straight
+    // out of the result to save a move per line.
+    // `base` is added to the line's offset within the scanned block.
+    Expected<std::optional<CarRecord>, ParseError> parseOrReject(const DelimiterScanner::Line &line, size_t lineNumber,
+                                                                 size_t base, const RejectionHandler &onReject) const {
+        auto result = parser_.tryParse(line);
+        if (result) {
+            return result;
+        }
+        static Counter &rejected = MetricsRegistry::instance().counter("records.rejected");
+        rejected.add();
+        if (onReject) {
+            onReject(LineRejection{lineNumber, base + line.offset, line.text, result.error()});
+            return result;
+        }
+        static std::mutex warningMutex;
+        std::lock_guard<std::mutex> lock(warningMutex);
+        std::cerr << "[WARN] Skipping line " << lineNumber << ": " << toString(result.error()) << ": " << line.text
+                  << std::endl;
+        return result;
+    }
+
+    std::string path_;
+    CarRecordParser parser_;
+    ReadMode mode_;
+    DurabilityMode durability_;
+};
+
+// Pull-based counterpart of CarFilePipeline::stream for callers that walk several inputs in
+// step, such as a sorted merge. Regular files are mapped and scanned in place; pipes and
+// stdin are read in 64 KB blocks, so memory stays flat whatever the input size. A missing
+// file reads as empty.
+class CarRecordReader {
+public:
+    CarRecordReader(std::string path, std::shared_ptr<CarRecordValidator> validator, RejectionHandler onReject = {})
+        : path_(std::move(path)), parser_(std::move(validator)), onReject_(std::move(onReject)) {
+        if (path_ == "-") {
+            input_ = &std::cin;
+        } else if (std::filesystem::exists(path_)) {
+            // Only regular files are mapped: opening a pipe just to find it cannot be mapped
+            // would drop whatever a short-lived writer sent before the reopen.
+            if (std::filesystem::is_regular_file(path_)) {
+                mapped_.emplace(path_);
+            }
+            if (mapped_ && mapped_->mapped()) {
+                scanner_.emplace(mapped_->view());
+            } else {
+                file_.open(path_, std::ios::binary);
+                if (!file_.is_open()) {
+                    throw std::runtime_error("Unable to open " + path_);
+                }
+                input_ = &file_;
+            }
+        }
+        if (input_) {
+            buffer_.resize(1 << 16);
+        }
+    }
+
+    CarRecordReader(const CarRecordReader &) = delete;
+    CarRecordReader &operator=(const CarRecordReader &) = delete;
+
+    // Skips blank and rejected lines; false once the input is exhausted.
+    bool next(CarRecord &record) {
+        DelimiterScanner::Line line;
+        while (nextLine(line)) {
+            ++lines_;
+            checksum_.update(line.text);
+            checksum_.update("\n");
+            auto result = parser_.tryParse(line);
+            if (!result) {
+                ++rejected_;
+                if (onReject_) {
+                    onReject_(LineRejection{lines_, base_ + line.offset, line.text, result.error()});
+                } else {
+                    std::cerr << "[WARN] Skipping line " << lines_ << " of " << path_ << ": "
+                              << toString(result.error()) << ": " << line.text << std::endl;
+                }
+            } else if (result.value()) {
+                record = std::move(*result.value());
+                ++records_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::string &path() const { return path_; }
+    size_t lines() const { return lines_; }
+    size_t records() const { return records_; }
+    size_t rejected() const { return rejected_; }
+    // ContentChecksum of the lines read so far, as CarFilePipeline::stream reports it.
+    std::uint64_t checksum() const { return checksum_.value(); }
+
+private:
+    bool nextLine(DelimiterScanner::Line &line) {
+        while (!scanner_ || !scanner_->next(line)) {
+            if (!input_ || (scanner_ && !*input_)) {
+                return false;
+            }
+            refill();
+        }
+        return true;
+    }
+
+    // Same carry-over as CarFilePipeline::streamLines: only complete lines are scanned
+    // until the input ends, and the block grows when a single line outsizes it.
+    void refill() {
+        std::memmove(buffer_.data(), buffer_.data() + complete_, filled_ - complete_);
+        filled_ -= complete_;
+        base_ += complete_;
+        if (filled_ == buffer_.size()) {
+            buffer_.resize(buffer_.size() * 2);
+        }
+        input_->read(buffer_.data() + filled_, static_cast<std::streamsize>(buffer_.size() - filled_));
+        filled_ += static_cast<size_t>(input_->gcount());
+        const std::string_view block(buffer_.data(), filled_);
+        complete_ = *input_ ? block.rfind('\n') + 1 : filled_;
+        scanner_.emplace(block.substr(0, complete_));
+    }
+
+    std::string path_;
+    CarRecordParser parser_;
+    RejectionHandler onReject_;
+    std::optional<MappedFile> mapped_;
+    std::ifstream file_;
+    std::istream *input_{nullptr};
+    std::vector<char> buffer_;
+    size_t filled_{0};
+    size_t complete_{0};
+    size_t base_{0};
+    std::optional<DelimiterScanner> scanner_;
+    ContentChecksum checksum_;
+    size_t lines_{0};
+    size_t records_{0};
+    size_t rejected_{0};
+};
+
+// Append-only log of record upserts kept next to a snapshot file. The header names the
+// checksum of the snapshot the entries apply to, so a journal left behind by a crash
+// between a snapshot commit and the journal reset is recognised as stale and ignored.
+class CarJournal {
+public:
+    CarJournal(std::string path, std::shared_ptr<CarRecordValidator> validator,
+               DurabilityMode durability = DurabilityMode::None)
+        : path_(std::move(path)), parser_(std::move(validator)), durability_(durability) {}
+
+    size_t replay(std::uint64_t base, const std::function<void(CarRecord &&)> &upsert,
+                  const std::function<void(const std::string &)> &remove) {
+        out_.reset();
+        activeBase_.reset();
+        entries_ = 0;
+
+        std::ifstream input(path_);
+        if (!input.is_open()) {
+            return 0;
+        }
+
+        std::string line;
+        if (!std::getline(input, line)) {
+            return 0;
+        }
+        if (line != header(base)) {
+            std::cerr << "[WARN] Ignoring stale journal " << path_ << std::endl;
+            return 0;
+        }
+
+        activeBase_ = base;
+        while (std::getline(input, line)) {
+            // No trailing newline: the tail of an append that never completed.
+            if (input.eof()) {
+                std::cerr << "[WARN] Ignoring torn journal entry: " << line << std::endl;
+                break;
+            }
+            if (line.rfind("D,", 0) == 0 && line.size() > 2) {
+                remove(line.substr(2));
+                ++entries_;
+                continue;
+            }
+            if (line.rfind("U,", 0) != 0) {
+                std::cerr << "[WARN] Skipping journal entry: " << line << std::endl;
+                continue;
+            }
+            auto record = parser_.tryParse(std::string_view(line).substr(2));
+            if (!record) {
+                std::cerr << "[WARN] Skipping journal entry (" << toString(record.error()) << "): " << line << std::endl;
+            } else if (record.value().has_value()) {
+                upsert(std::move(*record.value()));
+                ++entries_;
+            }
+        }
+        return entries_;
+    }
+
+    // Upserts are written as `U,<record>` and removals as `D,<id>`.
+    CommitStats append(std::uint64_t base, const std::vector<CarRecord> &records,
+                       const std::vector<std::string> &removed = {}) {
+        using Clock = std::chrono::steady_clock;
+        if (!activeBase_ || *activeBase_ != base) {
+            reset(base);
+        }
+        if (!out_) {
+            out_.emplace(path_, O_WRONLY | O_APPEND | O_CREAT);
+        }
+
+        const auto serializeStart = Clock::now();
+        std::string batch;
+        if (torn_) {
+            // Ends the fragment a failed append could not cut off, so it stays a line of its own.
+            batch += '\n';
+        }
+        for (const auto &record : records) {
+            batch += "U,";
+            parser_.appendTo(record, batch);
+            batch += '\n';
+        }
+        for (const auto &id : removed) {
+            batch += "D,";
+            batch += id;
+            batch += '\n';
+        }
+        const auto writeStart = Clock::now();
+        const off_t end = out_->size();
+        Clock::time_point syncStart;
+        try {
+            out_->writeAll(batch);
+            syncStart = Clock::now();
+            out_->sync(durability_);
+        } catch (...) {
+            // Cut off whatever part of the batch reached the file, so the retried batch
+            // starts on a line of its own.
+            try {
+                out_->truncate(end);
+                torn_ = false;
+            } catch (const std::exception &) {
+                torn_ = true;
+            }
+            throw;
+        }
+        torn_ = false;
+        entries_ += records.size() + removed.size();
+
+        CommitStats stats;
+        stats.bytes = batch.size();
+        stats.serializeTime = std::chrono::duration_cast<std::chrono::microseconds>(writeStart - serializeStart);
+        stats.writeTime = std::chrono::duration_cast<std::chrono::microseconds>(syncStart - writeStart);
+        stats.syncTime = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - syncStart);
+        return stats;
+    }
+
+    void reset(std::uint64_t base) {
+        out_.reset();
+        TransactionalFileWriter writer(path_, durability_);
+        writer.write({header(base)});
+        activeBase_ = base;
+        entries_ = 0;
+        torn_ = false;
+    }
+
+    size_t entries() const { return entries_; }
+
+    // The snapshot checksum named in the journal header, for a caller that has not read
+    // the snapshot yet; unset when there is no journal.
+    std::optional<std::uint64_t> storedBase() const {
+        std::ifstream input(path_);
+        std::string line;
+        std::uint64_t base = 0;
+        const std::string prefix = "#car-journal base=";
+        if (!std::getline(input, line) || line.rfind(prefix, 0) != 0 ||
+            !(std::istringstream(line.substr(prefix.size())) >> std::hex >> base)) {
+            return std::nullopt;
+        }
+        return base;
+    }
+
+private:
+    static std::string header(std::uint64_t base) {
+        std::ostringstream oss;
+        oss << "#car-journal base=" << std::hex << base;
+        return oss.str();
+    }
+
+    std::string path_;
+    CarRecordParser parser_;
+    DurabilityMode durability_;
+    std::optional<FileDescriptor> out_;
+    std::optional<std::uint64_t> activeBase_;
+    size_t entries_{0};
+    // A failed append left bytes the truncate could not remove.
+    bool torn_{false};
+};
+
+// The snapshot half of a FileStorageBackend: how the full fleet is read and committed.
+// The journal alongside it stays text and is bound to the checksum read() reports.
+class SnapshotFormat {
+public:
+    virtual ~SnapshotFormat() = default;
+    virtual std::vector<CarRecord> read(std::uint64_t *checksum) const = 0;
+    virtual CommitStats write(const RecordSource &records) const = 0;
+    virtual const std::string &path() const = 0;
+    virtual std::string scheme() const = 0;
+    // A record-at-a-time reader over the snapshot, or null for formats that can only be
+    // read whole.
+    virtual std::unique_ptr<CarRecordReader> reader(std::shared_ptr<CarRecordValidator> validator) const {
+        (void)validator;
+        return nullptr;
+    }
+};
+
+class TextSnapshotFormat : public SnapshotFormat {
+public:
+    TextSnapshotFormat(std::string path, std::shared_ptr<CarRecordValidator> validator,
+                       DurabilityMode durability = DurabilityMode::None)
+        : pipeline_(std::move(path), std::move(validator), ReadMode::Auto, durability) {}
+
+    std::vector<CarRecord> read(std::uint64_t *checksum) const override { return pipeline_.readAll(checksum); }
+    CommitStats write(const RecordSource &records) const override { return pipeline_.writeFrom(records); }
+    const std::string &path() const override { return pipeline_.path(); }
+    std::string scheme() const override { return "file"; }
+    std::unique_ptr<CarRecordReader> reader(std::shared_ptr<CarRecordValidator> validator) const override {
+        return std::make_unique<CarRecordReader>(pipeline_.path(), std::move(validator));
+    }
+
+private:
+    CarFilePipeline pipeline_;
+};
+
+// Native-endian binary snapshot: a fixed header, an array of fixed-width entries and a
+// string table holding ids, models and renter ids (models and renters are stored once).
+// The header checksum covers everything after it, so a torn or corrupted file is
+// rejected instead of half-loaded. Loading maps the file and decodes it without parsing.
+class BinarySnapshotFormat : public SnapshotFormat {
+public:
+    static constexpr std::array<char, 8> magic{'C', 'A', 'R', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr std::uint32_t version = 1;
+
+    BinarySnapshotFormat(std::string path, std::shared_ptr<CarRecordValidator> validator,
+                         DurabilityMode durability = DurabilityMode::None)
+        : path_(std::move(path)), validator_(std::move(validator)), durability_(durability) {}
+
+    static bool isBinarySnapshot(const std::string &path) {
+        std::ifstream input(path, std::ios::binary);
+        std::array<char, 8> prefix{};
+        return input.read(prefix.data(), prefix.size()) && prefix == magic;
+    }
+
+    std::vector<CarRecord> read(std::uint64_t *checksum) const override {
+        std::vector<CarRecord> records;
+        MappedFile file(path_);
+        // Reading an unreadable snapshot as an empty fleet would let the next save wipe it.
+        if (!file.mapped() && std::filesystem::exists(path_)) {
+            throw std::runtime_error("Unable to open " + path_);
+        }
+        const std::string_view data = file.view();
+        if (data.empty()) {
+            if (checksum) {
+                *checksum = ContentChecksum().value();
+            }
+            return records;
+        }
+
+        Header header;
+        if (data.size() < sizeof(header)) {
+            corrupt("truncated header");
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != magic) {
+            corrupt("not a binary car snapshot");
+        }
+        if (header.byteOrder != byteOrderMark) {
+            corrupt("written on a host with a different byte order");
+        }
+        if (header.version != version || header.entrySize != sizeof(Entry)) {
+            corrupt("unsupported version " + std::to_string(header.version));
+        }
+        const std::uint64_t tableOffset = sizeof(Header) + header.records * sizeof(Entry);
+        if (header.records > data.size() / sizeof(Entry) || tableOffset + header.stringBytes != data.size()) {
+            corrupt("size does not match header");
+        }
+        if (bodyChecksum(data.substr(sizeof(Header))) != header.checksum) {
+            corrupt("checksum mismatch");
+        }
+        if (checksum) {
+            *checksum = header.checksum;
+        }
+
+        const std::string_view strings = data.substr(static_cast<size_t>(tableOffset));
+        std::unordered_map<std::uint32_t, InternedString> models;
+        records.reserve(static_cast<size_t>(header.records));
+        for (std::uint64_t i = 0; i < header.records; ++i) {
+            Entry entry;
+            std::memcpy(&entry, data.data() + sizeof(Header) + i * sizeof(Entry), sizeof(entry));
+            if (entry.condition >= conditionNames.size() || entry.status > static_cast<std::uint8_t>(CarStatus::Rented)) {
+                corrupt("invalid entry " + std::to_string(i));
+            }
+
+            CarRecord record;
+            record.id = std::string(slice(strings, entry.id, i));
+            const auto modelText = slice(strings, entry.model, i);
+            if (modelText == record.id) {
+                record.model = modelName(modelText, record.id);
+            } else {
+                auto model = models.find(entry.model.offset);
+                if (model == models.end()) {
+                    model = models.emplace(entry.model.offset, InternedString(modelText)).first;
+                }
+                record.model = model->second;
+            }
+            record.condition = static_cast<CarCondition>(entry.condition);
+            record.pricePerDay = entry.pricePerDay;
+            record.status = static_cast<CarStatus>(entry.status);
+            record.renterId = std::string(slice(strings, entry.renter, i));
+            record.dueDate = entry.dueDate;
+            if (!validator_->validate(record)) {
+                corrupt("entry " + std::to_string(i) + " fails validation");
+            }
+            records.emplace_back(std::move(record));
+        }
+        return records;
+    }
+
+    CommitStats write(const RecordSource &records) const override {
+        std::vector<Entry> entries;
+        std::string strings;
+        std::unordered_map<const std::string *, StringRef> models;
+        std::unordered_map<std::string, StringRef> renters;
+        records([&](const CarRecord &record) {
+            Entry entry{};
+            entry.id = store(strings, record.id);
+            auto model = models.find(&record.model.str());
+            if (model == models.end()) {
+                model = models.emplace(&record.model.str(), store(strings, record.model.str())).first;
+            }
+            entry.model = model->second;
+            if (!record.renterId.empty()) {
+                auto renter = renters.find(record.renterId);
+                if (renter == renters.end()) {
+                    renter = renters.emplace(record.renterId, store(strings, record.renterId)).first;
+                }
+                entry.renter = renter->second;
+            }
+            entry.pricePerDay = record.pricePerDay;
+            entry.condition = static_cast<std::uint8_t>(record.condition);
+            entry.status = static_cast<std::uint8_t>(record.status);
+            entry.dueDate = record.dueDate;
+            entries.push_back(entry);
+        });
+
+        std::string body(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Entry));
+        body += strings;
+
+        Header header{};
+        header.magic = magic;
+        header.version = version;
+        header.byteOrder = byteOrderMark;
+        header.records = entries.size();
+        header.stringBytes = strings.size();
+        header.checksum = bodyChecksum(body);
+        header.entrySize = sizeof(Entry);
+
+        TransactionalFileWriter writer(path_, durability_);
+        auto stats = writer.writeWith([&](OutputBuffer &out) {
+            out.append(std::string_view(reinterpret_cast<const char *>(&header), sizeof(header)));
+            out.append(body);
+        });
+        stats.checksum = header.checksum;
+        return stats;
+    }
+
+    const std::string &path() const override { return path_; }
+    std::string scheme() const override { return "binary"; }
+
+private:
+    static constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+    struct StringRef {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+    struct Header {
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t records;
+        std::uint64_t stringBytes;
+        std::uint64_t checksum;
+        std::uint32_t entrySize;
+        std::uint32_t reserved;
+    };
+
+    struct Entry {
+        StringRef id;
+        StringRef model;
+        StringRef renter;
+        double pricePerDay;
+        std::uint8_t condition;
+        std::uint8_t status;
+        std::uint16_t reserved;
+        // Was reserved (zero) before due dates existed, which reads back as noDueDate.
+        std::int32_t dueDate;
+    };
+
+    static_assert(sizeof(Header) == 48 && sizeof(Entry) == 40, "binary snapshot layout changed");
+
+    // FNV-1a over 64-bit words in four interleaved lanes: the byte-serial ContentChecksum
+    // would cost as much as decoding the snapshot itself.
+    static std::uint64_t bodyChecksum(std::string_view bytes) {
+        constexpr std::uint64_t prime = 1099511628211ULL;
+        std::array<std::uint64_t, 4> lanes{14695981039346656037ULL, 1, 2, 3};
+        size_t offset = 0;
+        for (; offset + 32 <= bytes.size(); offset += 32) {
+            for (size_t lane = 0; lane < lanes.size(); ++lane) {
+                std::uint64_t word;
+                std::memcpy(&word, bytes.data() + offset + lane * 8, sizeof(word));
+                lanes[lane] = (lanes[lane] ^ word) * prime;
+            }
+        }
+        ContentChecksum tail;
+        tail.update(bytes.substr(offset));
+        std::uint64_t hash = tail.value() ^ bytes.size();
+        for (const auto lane : lanes) {
+            hash = (hash ^ lane) * prime;
+        }
+        return hash;
+    }
+
+    static StringRef store(std::string &strings, std::string_view text) {
+        if (strings.size() + text.size() > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("Binary snapshot string table exceeds 4 GiB");
+        }
+        const StringRef ref{static_cast<std::uint32_t>(strings.size()), static_cast<std::uint32_t>(text.size())};
+        strings += text;
+        return ref;
+    }
+
+    std::string_view slice(std::string_view strings, StringRef ref, std::uint64_t entry) const {
+        if (static_cast<std::uint64_t>(ref.offset) + ref.length > strings.size()) {
+            corrupt("entry " + std::to_string(entry) + " points outside the string table");
+        }
+        return strings.substr(ref.offset, ref.length);
+    }
+
+    [[noreturn]] void corrupt(const std::string &reason) const {
+        throw std::runtime_error("Corrupt binary snapshot " + path_ + ": " + reason);
+    }
+
+    std::string path_;
+    std::shared_ptr<CarRecordValidator> validator_;
+    DurabilityMode durability_;
+};
+
+// Durability cost of a backend's commits, surfaced through the stats command.
+struct CommitMetrics {
+    DurabilityMode durability{DurabilityMode::None};
+    size_t snapshots{0};
+    size_t appends{0};
+    CommitStats lastSnapshot;
+    CommitStats lastAppend;
+    std::chrono::microseconds totalSyncTime{0};
+    // Filled in by GroupCommitBackend: submitted mutations and the batches they shared.
+    size_t groupedMutations{0};
+    size_t groupCommits{0};
+    // Filled in by ShardedStorageBackend: shard files, and the shard rewrites full writes
+    // skipped because the shard's contents had not changed.
+    size_t shards{0};
+    size_t skippedShardWrites{0};
+};
+
+// The `<prefix>.serialize|write|sync|rename` histograms one kind of commit feeds.
+struct CommitHistograms {
+    LatencyHistogram &serialize;
+    LatencyHistogram &write;
+    LatencyHistogram &sync;
+    LatencyHistogram &rename;
+
+    static CommitHistograms named(const std::string &prefix) {
+        auto &registry = MetricsRegistry::instance();
+        return {registry.histogram(prefix + ".serialize"), registry.histogram(prefix + ".write"),
+                registry.histogram(prefix + ".sync"), registry.histogram(prefix + ".rename")};
+    }
+
+    void record(const CommitStats &stats, bool renamed) const {
+        serialize.record(stats.serializeTime);
+        write.record(stats.writeTime);
+        sync.record(stats.syncTime);
+        if (renamed) {
+            rename.record(stats.renameTime);
+        }
+    }
+};
+
+// Outcome of StorageBackend::mergeSorted.
+struct MergeStats {
+    // Input records parsed, counting every record of a run of equal ids.
+    size_t inputRecords{0};
+    size_t rejectedLines{0};
+    size_t inserted{0};
+    size_t replaced{0};
+    // Records in the merged snapshot.
+    size_t written{0};
+    CommitStats commit;
+
+    std::string summary() const {
+        std::ostringstream oss;
+        oss << "Merged " << inputRecords << " records (" << inserted << " new, " << replaced
+            << " replaced) into a " << written << "-record snapshot";
+        return oss.str();
+    }
+};
+
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+    virtual std::vector<CarRecord> loadCars() = 0;
+    virtual void persistCars(const RecordSource &records) = 0;
+    virtual std::string name() const = 0;
+
+    // Backends that can record individual mutations override these; the repository
+    // falls back to persistCars() with a full snapshot otherwise.
+    virtual bool supportsIncrementalWrites() const { return false; }
+    // Upserts `changed` and drops the `removed` ids without rewriting anything else.
+    virtual void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) {
+        (void)changed;
+        (void)removed;
+        throw std::logic_error(name() + " does not support incremental writes");
+    }
+    void persistChanges(const std::vector<CarRecord> &changed) {
+        persistDelta(changed, {});
+    }
+    // Two-phase form of persistDelta() for callers that must enqueue under their own
+    // lock but wait for durability outside it. The ticket is handed to awaitDurable().
+    virtual std::uint64_t submitDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) {
+        persistDelta(changed, removed);
+        return 0;
+    }
+    virtual void awaitDurable(std::uint64_t ticket) { (void)ticket; }
+
+    virtual size_t journalEntries() const { return 0; }
+    virtual CommitMetrics commitMetrics() const { return {}; }
+
+    // Upserts every record of an id-sorted file by streaming it against the stored fleet,
+    // without loading either into memory. Unset, with nothing changed, when the backend
+    // has no record-at-a-time form to merge into.
+    virtual std::optional<MergeStats> mergeSorted(const std::string &input, const RejectionHandler &onReject) {
+        (void)input;
+        (void)onReject;
+        return std::nullopt;
+    }
+};
+
+// Snapshot file (text unless another SnapshotFormat is given) plus a write-ahead journal
+// (`<path>.journal`). Mutations are appended to the journal and folded back into the
+// snapshot once the journal outgrows it by half, which keeps the amortised cost of a
+// single-record change constant.
+class FileStorageBackend : public StorageBackend {
+public:
+    static constexpr size_t defaultCompactionThreshold = 1024;
+
+    FileStorageBackend(std::string path, std::shared_ptr<CarRecordValidator> validator,
+                       DurabilityMode durability = DurabilityMode::None,
+                       size_t compactionThreshold = defaultCompactionThreshold)
+        : FileStorageBackend(std::make_unique<TextSnapshotFormat>(std::move(path), validator, durability),
+                             validator, durability, compactionThreshold) {}
+
+    FileStorageBackend(std::unique_ptr<SnapshotFormat> snapshot, std::shared_ptr<CarRecordValidator> validator,
+                       DurabilityMode durability = DurabilityMode::None,
+                       size_t compactionThreshold = defaultCompactionThreshold)
+        : snapshot_(std::move(snapshot)), validator_(validator),
+          journal_(snapshot_->path() + ".journal", std::move(validator), durability),
+          compactionThreshold_(compactionThreshold) {
+        metrics_.durability = durability;
+    }
+
+    std::vector<CarRecord> loadCars() override {
+        std::uint64_t checksum = 0;
+        auto records = snapshot_->read(&checksum);
+        snapshotChecksum_ = checksum;
+        snapshotRecords_ = records.size();
+
+        std::unordered_map<std::string, size_t> positions;
+        std::vector<bool> dropped;
+        const auto indexPositions = [&] {
+            if (positions.empty()) {
+                positions.reserve(records.size());
+                for (size_t i = 0; i < records.size(); ++i) {
+                    positions[records[i].id] = i;
+                }
+            }
+        };
+        journal_.replay(
+            checksum,
+            [&](CarRecord &&record) {
+                indexPositions();
+                const auto [it, inserted] = positions.emplace(record.id, records.size());
+                if (inserted) {
+                    records.emplace_back(std::move(record));
+                } else {
+                    records[it->second] = std::move(record);
+                }
+            },
+            [&](const std::string &id) {
+                indexPositions();
+                const auto it = positions.find(id);
+                if (it != positions.end()) {
+                    dropped.resize(records.size());
+                    dropped[it->second] = true;
+                    positions.erase(it);
+                }
+            });
+        if (!dropped.empty()) {
+            size_t kept = 0;
+            for (size_t i = 0; i < records.size(); ++i) {
+                if (i >= dropped.size() || !dropped[i]) {
+                    records[kept++] = std::move(records[i]);
+                }
+            }
+            records.resize(kept);
+        }
+        return records;
+    }
+
+    void persistCars(const RecordSource &records) override {
+        size_t count = 0;
+        const auto stats = snapshot_->write([&](const RecordVisitor &visit) {
+            records([&](const CarRecord &record) {
+                visit(record);
+                ++count;
+            });
+        });
+        snapshotCommitted(stats, count);
+    }
+
+    std::string name() const override {
+        return snapshot_->scheme() + ":" + snapshot_->path();
+    }
+
+    bool supportsIncrementalWrites() const override { return true; }
+
+    void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+        if (!snapshotChecksum_) {
+            loadCars();
+        }
+        const auto stats = journal_.append(*snapshotChecksum_, changed, removed);
+        journalHistograms_.record(stats, false);
+        ++metrics_.appends;
+        metrics_.lastAppend = stats;
+        metrics_.totalSyncTime += stats.syncTime;
+        if (journal_.entries() >= std::max(compactionThreshold_, snapshotRecords_ / 2)) {
+            compact();
+        }
+    }
+
+    size_t journalEntries() const override { return journal_.entries(); }
+
+    CommitMetrics commitMetrics() const override { return metrics_; }
+
+    // Snapshot, journal and input are walked in id order and the result is streamed into
+    // the new snapshot, so only the journal is held in memory. Input records win over the
+    // journal, which wins over the snapshot, and the last of several equal input ids wins.
+    // Binary snapshots are built in memory when written, so they are not merged.
+    std::optional<MergeStats> mergeSorted(const std::string &input, const RejectionHandler &onReject) override {
+        if (!snapshot_->reader(validator_)) {
+            return std::nullopt;
+        }
+        // Without a cached checksum the snapshot is read through once up front to check the
+        // journal belongs to it: the input may be a pipe, so it can only be read once.
+        const bool verifyBase = !snapshotChecksum_;
+        const auto base = verifyBase ? journal_.storedBase() : snapshotChecksum_;
+        std::map<std::string, std::optional<CarRecord>> journaled;
+        if (base) {
+            journal_.replay(
+                *base,
+                [&](CarRecord &&record) {
+                    std::string id = record.id;
+                    journaled.insert_or_assign(std::move(id), std::move(record));
+                },
+                [&](const std::string &id) { journaled.insert_or_assign(id, std::nullopt); });
+        }
+        if (verifyBase && !journaled.empty()) {
+            auto current = snapshot_->reader(validator_);
+            for (CarRecord record; current->next(record);) {
+            }
+            if (current->checksum() != *base) {
+                std::cerr << "[WARN] Ignoring stale journal " << snapshot_->path() << ".journal" << std::endl;
+                journaled.clear();
+            }
+        }
+        return mergeWith(input, onReject, journaled);
+    }
+
+    // The journal replays in arrival order, so the folded snapshot is re-sorted to keep
+    // it mergeable.
+    void compact() {
+        auto records = loadCars();
+        std::sort(records.begin(), records.end(),
+                  [](const CarRecord &lhs, const CarRecord &rhs) { return lhs.id < rhs.id; });
+        persistCars(sourceOf(records));
+    }
+
+private:
+    // One id-sorted reader with each run of equal ids collapsed to its last record.
+    class SortedRun {
+    public:
+        explicit SortedRun(CarRecordReader &reader) : reader_(reader) { advance(); }
+
+        const CarRecord *peek() const { return head_ ? &*head_ : nullptr; }
+
+        CarRecord take() {
+            CarRecord record = std::move(*head_);
+            advance();
+            return record;
+        }
+
+    private:
+        void advance() {
+            head_ = std::move(next_);
+            next_.reset();
+            CarRecord record;
+            if (!head_) {
+                if (!reader_.next(record)) {
+                    return;
+                }
+                head_ = std::move(record);
+            }
+            while (reader_.next(record)) {
+                if (record.id < head_->id) {
+                    throw std::runtime_error(reader_.path() + " is not sorted by car ID (line " +
+                                             std::to_string(reader_.lines()) + ")");
+                }
+                if (record.id != head_->id) {
+                    next_ = std::move(record);
+                    return;
+                }
+                head_ = std::move(record);
+            }
+        }
+
+        CarRecordReader &reader_;
+        std::optional<CarRecord> head_;
+        std::optional<CarRecord> next_;
+    };
+
+    MergeStats mergeWith(const std::string &input, const RejectionHandler &onReject,
+                         std::map<std::string, std::optional<CarRecord>> &journaled) {
+        auto current = snapshot_->reader(validator_);
+        CarRecordReader incoming(input, validator_, onReject);
+        MergeStats merge;
+        const auto stats = snapshot_->write([&](const RecordVisitor &visit) {
+            SortedRun stored(*current);
+            SortedRun added(incoming);
+            auto logged = journaled.begin();
+            while (stored.peek() || logged != journaled.end() || added.peek()) {
+                const std::string *id = nullptr;
+                for (const std::string *candidate :
+                     {stored.peek() ? &stored.peek()->id : nullptr,
+                      logged != journaled.end() ? &logged->first : nullptr,
+                      added.peek() ? &added.peek()->id : nullptr}) {
+                    if (candidate && (!id || *candidate < *id)) {
+                        id = candidate;
+                    }
+                }
+                const bool fromStored = stored.peek() && stored.peek()->id == *id;
+                const bool fromLog = logged != journaled.end() && logged->first == *id;
+                const bool fromInput = added.peek() && added.peek()->id == *id;
+
+                std::optional<CarRecord> existing;
+                if (fromStored) {
+                    existing = stored.take();
+                }
+                if (fromLog) {
+                    existing = std::move(logged->second);
+                    ++logged;
+                }
+                if (fromInput) {
+                    ++(existing ? merge.replaced : merge.inserted);
+                    visit(added.take());
+                } else if (existing) {
+                    visit(*existing);
+                } else {
+                    continue;
+                }
+                ++merge.written;
+            }
+        });
+        merge.inputRecords = incoming.records();
+        merge.rejectedLines = incoming.rejected();
+        merge.commit = stats;
+        snapshotCommitted(stats, merge.written);
+        return merge;
+    }
+
+    void snapshotCommitted(const CommitStats &stats, size_t records) {
+        snapshotChecksum_ = stats.checksum;
+        snapshotRecords_ = records;
+        journal_.reset(stats.checksum);
+        snapshotHistograms_.record(stats, true);
+        ++metrics_.snapshots;
+        metrics_.lastSnapshot = stats;
+        metrics_.totalSyncTime += stats.syncTime;
+    }
+
+    std::unique_ptr<SnapshotFormat> snapshot_;
+    std::shared_ptr<CarRecordValidator> validator_;
+    CarJournal journal_;
+    size_t compactionThreshold_;
+    std::optional<std::uint64_t> snapshotChecksum_;
+    size_t snapshotRecords_{0};
+    CommitMetrics metrics_;
+    CommitHistograms snapshotHistograms_{CommitHistograms::named("snapshot")};
+    CommitHistograms journalHistograms_{CommitHistograms::named("journal")};
+};
+
+// Partitions the fleet over N file backends, `<path>.<i>` for shard i, by a hash of the
+// id; each shard keeps its own snapshot and journal. Shards load on parallel threads, a
+// delta appends only to the journals of the shards it touches, and a full write rewrites
+// (in parallel) only the shards whose records differ from the ones last loaded or written
+// there. Records found in the wrong file, as after a restart with another shard count,
+// are rehomed on load.
+class ShardedStorageBackend : public StorageBackend {
+public:
+    static constexpr size_t defaultShards = 16;
+
+    ShardedStorageBackend(std::string path, std::shared_ptr<CarRecordValidator> validator,
+                          DurabilityMode durability = DurabilityMode::None, size_t shards = defaultShards)
+        : path_(std::move(path)), validator_(validator), durability_(durability), digests_(shards) {
+        if (shards == 0) {
+            throw std::invalid_argument("shard count must be greater than zero");
+        }
+        for (size_t i = 0; i < shards; ++i) {
+            shards_.push_back(std::make_unique<FileStorageBackend>(shardPath(path_, i), validator, durability));
+        }
+    }
+
+    static std::string shardPath(const std::string &path, size_t index) {
+        return path + "." + std::to_string(index);
+    }
+
+    // FNV-1a rather than std::hash, so the placement survives a rebuild.
+    size_t shardOf(std::string_view id) const {
+        ContentChecksum hash;
+        hash.update(id);
+        return static_cast<size_t>(hash.value() % shards_.size());
+    }
+
+    size_t shardCount() const { return shards_.size(); }
+
+    std::vector<CarRecord> loadCars() override {
+        std::vector<std::vector<CarRecord>> loaded(shards_.size());
+        std::vector<size_t> all(shards_.size());
+        std::iota(all.begin(), all.end(), size_t{0});
+        inParallel(all, [&](size_t i) {
+            loaded[i] = shards_[i]->loadCars();
+            ContentChecksum digest;
+            for (const auto &record : loaded[i]) {
+                update(digest, record);
+            }
+            digests_[i] = digest.value();
+        });
+
+        // Files past the shard count were written by a run with more shards.
+        std::vector<std::string> strays;
+        for (size_t i = shards_.size(); std::filesystem::exists(shardPath(path_, i)); ++i) {
+            strays.push_back(shardPath(path_, i));
+            loaded.push_back(FileStorageBackend(strays.back(), validator_).loadCars());
+        }
+
+        bool misplaced = !strays.empty();
+        std::vector<CarRecord> records;
+        records.reserve(std::accumulate(loaded.begin(), loaded.end(), size_t{0},
+                                        [](size_t total, const auto &shard) { return total + shard.size(); }));
+        for (size_t i = 0; i < loaded.size(); ++i) {
+            for (auto &record : loaded[i]) {
+                misplaced = misplaced || shardOf(record.id) != i;
+                records.push_back(std::move(record));
+            }
+            loaded[i] = {};
+        }
+        if (misplaced) {
+            // A crash between the rewrite below and the removal of the strays leaves a car
+            // in two files; the first copy, from an in-range shard, is the rehomed one.
+            std::unordered_set<std::string> seen;
+            records.erase(std::remove_if(records.begin(), records.end(),
+                                         [&](const CarRecord &record) { return !seen.insert(record.id).second; }),
+                          records.end());
+            persistCars(sourceOf(records));
+            for (const auto &stray : strays) {
+                std::filesystem::remove(stray);
+                std::filesystem::remove(stray + ".journal");
+            }
+        }
+        return records;
+    }
+
+    // The first pass only digests each shard's share, which is cheap next to serializing,
+    // writing and syncing the shards that did not change. The source is walked once per
+    // rewritten shard, from several threads at once.
+    void persistCars(const RecordSource &records) override {
+        std::vector<ContentChecksum> contents(shards_.size());
+        records([&](const CarRecord &record) { update(contents[shardOf(record.id)], record); });
+        std::vector<size_t> dirty;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (shards_[i]->journalEntries() > 0 || digests_[i] != contents[i].value()) {
+                dirty.push_back(i);
+                // Unknown until this shard's write lands, so a failed write is retried.
+                digests_[i].reset();
+            }
+        }
+        skippedWrites_ += shards_.size() - dirty.size();
+        inParallel(dirty, [&](size_t i) {
+            shards_[i]->persistCars([&](const RecordVisitor &visit) {
+                records([&](const CarRecord &record) {
+                    if (shardOf(record.id) == i) {
+                        visit(record);
+                    }
+                });
+            });
+            digests_[i] = contents[i].value();
+        });
+        if (!dirty.empty()) {
+            lastSnapshotShard_ = dirty.back();
+        }
+    }
+
+    std::string name() const override {
+        return "sharded:" + path_ + "[" + std::to_string(shards_.size()) + "]";
+    }
+
+    bool supportsIncrementalWrites() const override { return true; }
+
+    void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+        std::vector<std::vector<CarRecord>> changedIn(shards_.size());
+        std::vector<std::vector<std::string>> removedIn(shards_.size());
+        for (const auto &record : changed) {
+            changedIn[shardOf(record.id)].push_back(record);
+        }
+        for (const auto &id : removed) {
+            removedIn[shardOf(id)].push_back(id);
+        }
+        std::vector<size_t> touched;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (!changedIn[i].empty() || !removedIn[i].empty()) {
+                touched.push_back(i);
+                // The journal may be folded into the snapshot along the way.
+                digests_[i].reset();
+            }
+        }
+        inParallel(touched, [&](size_t i) { shards_[i]->persistDelta(changedIn[i], removedIn[i]); });
+        if (!touched.empty()) {
+            lastAppendShard_ = touched.back();
+        }
+    }
+
+    size_t journalEntries() const override {
+        size_t entries = 0;
+        for (const auto &shard : shards_) {
+            entries += shard->journalEntries();
+        }
+        return entries;
+    }
+
+    // Counts and sync time are summed over the shards; the last commits are those of the
+    // shard written most recently.
+    CommitMetrics commitMetrics() const override {
+        CommitMetrics metrics;
+        metrics.durability = durability_;
+        for (const auto &shard : shards_) {
+            const auto inner = shard->commitMetrics();
+            metrics.snapshots += inner.snapshots;
+            metrics.appends += inner.appends;
+            metrics.totalSyncTime += inner.totalSyncTime;
+        }
+        metrics.lastSnapshot = shards_[lastSnapshotShard_]->commitMetrics().lastSnapshot;
+        metrics.lastAppend = shards_[lastAppendShard_]->commitMetrics().lastAppend;
+        metrics.shards = shards_.size();
+        metrics.skippedShardWrites = skippedWrites_;
+        return metrics;
+    }
+
+private:
+    // Every stored field, in binary; a shard's digest is taken over its records in order.
+    static void update(ContentChecksum &digest, const CarRecord &record) {
+        const auto bytes = [&](const auto &value) {
+            digest.update(std::string_view(reinterpret_cast<const char *>(&value), sizeof(value)));
+        };
+        digest.update(record.id);
+        bytes(record.id.size());
+        digest.update(record.model.str());
+        bytes(record.model.str().size());
+        bytes(record.condition);
+        bytes(record.pricePerDay);
+        bytes(record.status);
+        digest.update(record.renterId);
+        bytes(record.renterId.size());
+        bytes(record.dueDate);
+    }
+
+    // Runs `work` for every listed shard, on its own thread when there is more than one,
+    // and rethrows the first failure once all of them have finished.
+    static void inParallel(const std::vector<size_t> &indexes, const std::function<void(size_t)> &work) {
+        if (indexes.size() == 1) {
+            work(indexes.front());
+            return;
+        }
+        std::vector<std::exception_ptr> failures(indexes.size());
+        std::vector<std::thread> threads;
+        threads.reserve(indexes.size());
+        for (size_t slot = 0; slot < indexes.size(); ++slot) {
+            threads.emplace_back([&, slot] {
+                try {
+                    work(indexes[slot]);
+                } catch (...) {
+                    failures[slot] = std::current_exception();
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        for (const auto &failure : failures) {
+            if (failure) {
+                std::rethrow_exception(failure);
+            }
+        }
+    }
+
+    std::string path_;
+    std::shared_ptr<CarRecordValidator> validator_;
+    DurabilityMode durability_;
+    std::vector<std::unique_ptr<FileStorageBackend>> shards_;
+    // Digest of each shard's records as last loaded or written; unset once a delta has
+    // changed them.
+    std::vector<std::optional<std::uint64_t>> digests_;
+    size_t skippedWrites_{0};
+    size_t lastSnapshotShard_{0};
+    size_t lastAppendShard_{0};
+};
+
+struct GroupCommitOptions {
+    std::chrono::microseconds window{2000};
+    size_t maxOps{256};
+};
+
+// Decorator that funnels concurrent mutations through one committer thread. Changes
+// submitted while a batch is open (until `window` has passed since its first change or
+// `maxOps` mutations have arrived) are coalesced, last-writer-wins per id, into a single
+// persistDelta() on the wrapped backend, and every caller in the batch is released
+// once that write is durable.
+class GroupCommitBackend : public StorageBackend {
+public:
+    explicit GroupCommitBackend(std::shared_ptr<StorageBackend> inner, GroupCommitOptions options = {})
+        : inner_(std::move(inner)), options_(options) {
+        if (!inner_->supportsIncrementalWrites()) {
+            throw std::invalid_argument("Group commit needs a backend with incremental writes");
+        }
+        committer_ = std::thread([this] { run(); });
+    }
+
+    ~GroupCommitBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        committer_.join();
+    }
+
+    GroupCommitBackend(const GroupCommitBackend &) = delete;
+    GroupCommitBackend &operator=(const GroupCommitBackend &) = delete;
+
+    std::vector<CarRecord> loadCars() override {
+        drain();
+        std::lock_guard<std::mutex> lock(innerMutex_);
+        return inner_->loadCars();
+    }
+
+    // Queued batches are older than the snapshot, so they must land before it.
+    void persistCars(const RecordSource &records) override {
+        drain();
+        std::lock_guard<std::mutex> lock(innerMutex_);
+        inner_->persistCars(records);
+    }
+
+    std::string name() const override {
+        return inner_->name() + "+group-commit";
+    }
+
+    bool supportsIncrementalWrites() const override { return true; }
+
+    void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+        awaitDurable(submitDelta(changed, removed));
+    }
+
+    // An empty submission still returns the newest open or in-flight batch, so a caller
+    // whose change was picked up by someone else's flush waits for that batch too; with
+    // every batch already durable there is nothing to wait for and the ticket is 0.
+    std::uint64_t submitDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (changed.empty() && removed.empty()) {
+            if (!pending_.empty()) {
+                return hold(openBatch_);
+            }
+            return durableBatch_ + 1 < openBatch_ ? hold(openBatch_ - 1) : 0;
+        }
+        if (pending_.empty()) {
+            batchOpened_ = Clock::now();
+        }
+        for (const auto &record : changed) {
+            pending_[record.id] = record;
+        }
+        for (const auto &id : removed) {
+            pending_[id].reset();
+        }
+        const size_t ops = changed.size() + removed.size();
+        pendingOps_ += ops;
+        submittedOps_ += ops;
+        wake_.notify_all();
+        return hold(openBatch_);
+    }
+
+    // Every non-zero ticket must be awaited exactly once: the last holder of a failed
+    // batch's ticket drops its recorded failure.
+    void awaitDurable(std::uint64_t ticket) override {
+        if (ticket == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        durable_.wait(lock, [&] { return durableBatch_ >= ticket; });
+        std::exception_ptr failure;
+        if (const auto found = failures_.find(ticket); found != failures_.end()) {
+            failure = found->second;
+        }
+        const auto holders = holders_.find(ticket);
+        if (--holders->second == 0) {
+            holders_.erase(holders);
+            failures_.erase(ticket);
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    size_t journalEntries() const override {
+        std::lock_guard<std::mutex> lock(innerMutex_);
+        return inner_->journalEntries();
+    }
+
+    // Like a snapshot, the merge must follow every queued batch.
+    std::optional<MergeStats> mergeSorted(const std::string &input, const RejectionHandler &onReject) override {
+        drain();
+        std::lock_guard<std::mutex> lock(innerMutex_);
+        return inner_->mergeSorted(input, onReject);
+    }
+
+    CommitMetrics commitMetrics() const override {
+        CommitMetrics metrics;
+        {
+            std::lock_guard<std::mutex> lock(innerMutex_);
+            metrics = inner_->commitMetrics();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        metrics.groupedMutations = submittedOps_;
+        metrics.groupCommits = durableBatch_;
+        return metrics;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Counts a ticket handed out for `batch`. Callers hold mutex_.
+    std::uint64_t hold(std::uint64_t batch) {
+        ++holders_[batch];
+        return batch;
+    }
+
+    // Blocks until everything submitted so far is durable.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++drainRequests_;
+        wake_.notify_all();
+        durable_.wait(lock, [&] { return pending_.empty() && durableBatch_ + 1 == openBatch_; });
+        --drainRequests_;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            wake_.wait_until(lock, batchOpened_ + options_.window, [&] {
+                return stopping_ || drainRequests_ > 0 || pendingOps_ >= options_.maxOps;
+            });
+
+            std::vector<CarRecord> batch;
+            std::vector<std::string> removed;
+            batch.reserve(pending_.size());
+            for (auto &entry : pending_) {
+                if (entry.second) {
+                    batch.push_back(std::move(*entry.second));
+                } else {
+                    removed.push_back(entry.first);
+                }
+            }
+            pending_.clear();
+            pendingOps_ = 0;
+            const std::uint64_t sequence = openBatch_++;
+            lock.unlock();
+
+            std::exception_ptr failure;
+            try {
+                std::lock_guard<std::mutex> innerLock(innerMutex_);
+                inner_->persistDelta(batch, removed);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+
+            lock.lock();
+            // A batch nobody holds a ticket for has no one left to report to.
+            if (failure && holders_.count(sequence) > 0) {
+                failures_[sequence] = failure;
+            }
+            durableBatch_ = sequence;
+            durable_.notify_all();
+        }
+    }
+
+    std::shared_ptr<StorageBackend> inner_;
+    GroupCommitOptions options_;
+    mutable std::mutex innerMutex_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable durable_;
+    // An empty optional records a removal.
+    std::map<std::string, std::optional<CarRecord>> pending_;
+    Clock::time_point batchOpened_;
+    size_t pendingOps_{0};
+    size_t submittedOps_{0};
+    std::uint64_t openBatch_{1};
+    std::uint64_t durableBatch_{0};
+    // Failures of batches whose tickets are still held, and how many holders each has.
+    std::map<std::uint64_t, std::exception_ptr> failures_;
+    std::map<std::uint64_t, size_t> holders_;
+    size_t drainRequests_{0};
+    bool stopping_{false};
+    std::thread committer_;
+};
+
+// Keeps its copy keyed by id so flushes apply only the delta instead of copying the fleet.
+class MemoryStorageBackend : public StorageBackend {
+public:
+    MemoryStorageBackend() = default;
+    explicit MemoryStorageBackend(std::vector<CarRecord> seed) {
+        for (auto &record : seed) {
+            std::string id = record.id;
+            records_.insert_or_assign(std::move(id), std::move(record));
+        }
+    }
+
+    std::vector<CarRecord> loadCars() override {
+        std::vector<CarRecord> records;
+        records.reserve(records_.size());
+        for (const auto &entry : records_) {
+            records.push_back(entry.second);
+        }
+        return records;
+    }
+
+    void persistCars(const RecordSource &records) override {
+        records_.clear();
+        records([this](const CarRecord &record) {
+            records_.emplace_hint(records_.end(), record.id, record);
+        });
+    }
+
+    std::string name() const override {
+        return "in-memory";
+    }
+
+    bool supportsIncrementalWrites() const override { return true; }
+
+    void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+        for (const auto &record : changed) {
+            records_.insert_or_assign(record.id, record);
+        }
+        for (const auto &id : removed) {
+            records_.erase(id);
+        }
+    }
+
+private:
+    std::map<std::string, CarRecord> records_;
+};
+
+enum class BackendType { File, Binary, Memory, Sharded };
+
+struct BackendOptions {
+    DurabilityMode durability{DurabilityMode::None};
+    // When set, file-backed mutations are coalesced by a GroupCommitBackend.
+    std::optional<GroupCommitOptions> groupCommit;
+    // Shard files for BackendType::Sharded.
+    size_t shards{ShardedStorageBackend::defaultShards};
+};
+
+class StorageBackendFactory {
+public:
+    static std::shared_ptr<StorageBackend> create(BackendType type,
+                                                  const std::string &path,
+                                                  std::shared_ptr<CarRecordValidator> validator,
+                                                  const BackendOptions &options = {}) {
+        switch (type) {
+        case BackendType::File: {
+            std::shared_ptr<StorageBackend> file =
+                std::make_shared<FileStorageBackend>(path, std::move(validator), options.durability);
+            if (options.groupCommit) {
+                return std::make_shared<GroupCommitBackend>(std::move(file), *options.groupCommit);
+            }
+            return file;
+        }
+        case BackendType::Binary: {
+            std::shared_ptr<StorageBackend> binary = std::make_shared<FileStorageBackend>(
+                std::make_unique<BinarySnapshotFormat>(path, validator, options.durability), validator,
+                options.durability);
+            if (options.groupCommit) {
+                return std::make_shared<GroupCommitBackend>(std::move(binary), *options.groupCommit);
+            }
+            return binary;
+        }
+        case BackendType::Sharded: {
+            std::shared_ptr<StorageBackend> sharded =
+                std::make_shared<ShardedStorageBackend>(path, std::move(validator), options.durability, options.shards);
+            if (options.groupCommit) {
+                return std::make_shared<GroupCommitBackend>(std::move(sharded), *options.groupCommit);
+            }
+            return sharded;
+        }
+        case BackendType::Memory:
+            return std::make_shared<MemoryStorageBackend>();
+        }
+        throw std::invalid_argument("Unknown backend type");
+    }
+};
+
+// A stored record, shared with the repository rather than copied out of it.
+using CarRecordRef = std::shared_ptr<const CarRecord>;
+
+// An id-ordered view of the whole fleet as of one instant. The hashed store replaces records
+// rather than editing them in place, so a snapshot shares them instead of copying, and
+// reading one takes no locks and blocks no writer.
+class FleetSnapshot {
+public:
+    using Entry = CarRecordRef;
+
+    explicit FleetSnapshot(std::vector<Entry> records)
+        : records_(std::move(records)) {
+        std::sort(records_.begin(), records_.end(), [](const Entry &lhs, const Entry &rhs) {
+            return lhs->id < rhs->id;
+        });
+        for (const auto &record : records_) {
+            available_ += record->status == CarStatus::Available ? 1 : 0;
+        }
+    }
+
+    size_t size() const { return records_.size(); }
+    size_t availableCount() const { return available_; }
+    const std::vector<Entry> &records() const { return records_; }
+
+    const CarRecord *find(std::string_view id) const {
+        const auto it = std::lower_bound(records_.begin(), records_.end(), id, [](const Entry &entry, std::string_view key) {
+            return entry->id < key;
+        });
+        return it != records_.end() && (*it)->id == id ? it->get() : nullptr;
+    }
+
+private:
+    std::vector<Entry> records_;
+    size_t available_{0};
+};
+
+struct FleetCounts {
+    size_t total{0};
+    size_t available{0};
+};
+
+// Filters for CarRepository::query(); unset fields match every car.
+struct CarQuery {
+    enum class Order { Id, Price, PriceDescending };
+
+    std::optional<CarStatus> status;
+    std::optional<CarCondition> condition;
+    std::optional<std::string> model;
+    std::optional<std::string> renter;
+    std::optional<double> minPrice;
+    std::optional<double> maxPrice;
+    Order order{Order::Id};
+    size_t limit{std::numeric_limits<size_t>::max()};
+
+    // The checks on fixed-width fields, which a columnar store can run without building a record.
+    bool matchesColumns(CarStatus carStatus, CarCondition carCondition, double price) const {
+        return (!status || carStatus == *status) && (!condition || carCondition == *condition) &&
+               (!minPrice || price >= *minPrice) && (!maxPrice || price <= *maxPrice);
+    }
+
+    bool matches(const CarRecord &record) const {
+        return matchesColumns(record.status, record.condition, record.pricePerDay) &&
+               (!model || record.model == *model) && (!renter || record.renterId == *renter);
+    }
+};
+
+// How a repository shard keeps its records; see HashedCarStore and CompactCarStore.
+enum class StoreLayout { Hashed, Compact };
+
+inline std::string_view toString(StoreLayout layout) {
+    return layout == StoreLayout::Compact ? "compact" : "hashed";
+}
+
+// Record storage for one repository shard. CarRepository holds the shard's lock around
+// every call, so implementations do no locking of their own.
+class CarStore {
+public:
+    using Condition = std::function<bool(const CarRecord &)>;
+    using Mutator = std::function<void(CarRecord &)>;
+    // `shared` is the stored record when the store keeps one, null when `record` was built
+    // for the call and is gone once the visitor returns.
+    using Visitor = std::function<void(const CarRecord &record, const CarRecordRef &shared)>;
+
+    enum class Scope { All, Available, RentedBy };
+
+    // Walks one scope in id order; record() stays valid until the next call to next().
+    class Cursor {
+    public:
+        virtual ~Cursor() = default;
+        virtual bool valid() const = 0;
+        virtual const CarRecord &record() const = 0;
+        virtual CarRecordRef share() const = 0;
+        virtual void next() = 0;
+    };
+
+    virtual ~CarStore() = default;
+
+    virtual size_t size() const = 0;
+    virtual size_t availableCount() const = 0;
+    // Replaces the contents; when an id repeats, its last record wins.
+    virtual void load(std::vector<CarRecord> records) = 0;
+    // Null when the id is not stored.
+    virtual CarRecordRef find(const std::string &id) const = 0;
+    virtual bool contains(const std::string &id) const = 0;
+    virtual void put(CarRecordRef record) = 0;
+    // Moves the records in, leaving them moved-from; when an id repeats, its last record wins.
+    virtual void putAll(std::span<CarRecord> records) = 0;
+    // The mutator must not change the id.
+    virtual bool updateIf(const std::string &id, const Condition &condition, const Mutator &mutator) = 0;
+    virtual bool eraseIf(const std::string &id, const Condition &condition) = 0;
+    // Every record `query` matches, in no particular order; the query's order and limit are
+    // left to the caller.
+    virtual void scan(const CarQuery &query, const Visitor &visit) const = 0;
+    virtual std::unique_ptr<Cursor> cursor(Scope scope, const std::string &renter = {}) const = 0;
+    // Rented cars due before `day`, earliest due date first and by id within a day, read
+    // from an index ordered by due date.
+    virtual void scanDue(std::int32_t day, const Visitor &visit) const = 0;
+};
+
+// The default layout: a hash map of shared, immutable records plus ordered id indexes for
+// available cars and for each renter's cars.
+class HashedCarStore final : public CarStore {
+public:
+    size_t size() const override { return records_.size(); }
+    size_t availableCount() const override { return available_.size(); }
+
+    void load(std::vector<CarRecord> records) override {
+        records_.clear();
+        available_.clear();
+        rentedBy_.clear();
+        due_.clear();
+        records_.reserve(records.size());
+        adopt(std::make_shared<const std::vector<CarRecord>>(std::move(records)));
+    }
+
+    CarRecordRef find(const std::string &id) const override {
+        const auto it = records_.find(id);
+        return it == records_.end() ? nullptr : it->second;
+    }
+
+    bool contains(const std::string &id) const override {
+        return records_.count(id) != 0;
+    }
+
+    void put(CarRecordRef record) override {
+        auto it = records_.find(record->id);
+        if (it == records_.end()) {
+            it = records_.emplace(record->id, std::move(record)).first;
+        } else {
+            unindex(*it);
+            it->second = std::move(record);
+        }
+        index(*it);
+    }
+
+    void putAll(std::span<CarRecord> records) override {
+        adopt(std::make_shared<const std::vector<CarRecord>>(std::make_move_iterator(records.begin()),
+                                                             std::make_move_iterator(records.end())));
+    }
+
+    bool updateIf(const std::string &id, const Condition &condition, const Mutator &mutator) override {
+        const auto it = records_.find(id);
+        if (it == records_.end() || !condition(*it->second)) {
+            return false;
+        }
+        // Snapshots may still hold the old record, so it is replaced rather than edited.
+        auto next = std::make_shared<CarRecord>(*it->second);
+        mutator(*next);
+        unindex(*it);
+        it->second = std::move(next);
+        index(*it);
+        return true;
+    }
+
+    bool eraseIf(const std::string &id, const Condition &condition) override {
+        const auto it = records_.find(id);
+        if (it == records_.end() || !condition(*it->second)) {
+            return false;
+        }
+        unindex(*it);
+        records_.erase(it);
+        return true;
+    }
+
+    void scan(const CarQuery &query, const Visitor &visit) const override {
+        for (const auto &entry : records_) {
+            if (query.matches(*entry.second)) {
+                visit(*entry.second, entry.second);
+            }
+        }
+    }
+
+    std::unique_ptr<Cursor> cursor(Scope scope, const std::string &renter) const override {
+        if (scope == Scope::All) {
+            return std::make_unique<OrderedCursor>(records_);
+        }
+        static const IdIndex none;
+        const IdIndex *index = &available_;
+        if (scope == Scope::RentedBy) {
+            const auto it = rentedBy_.find(renter);
+            index = it == rentedBy_.end() ? &none : &it->second;
+        }
+        return std::make_unique<IndexCursor>(records_, *index);
+    }
+
+    void scanDue(std::int32_t day, const Visitor &visit) const override {
+        for (auto it = due_.begin(); it != due_.end() && it->first < day; ++it) {
+            const auto &record = records_.find(*it->second)->second;
+            visit(*record, record);
+        }
+    }
+
+private:
+    using Records = std::unordered_map<std::string, CarRecordRef>;
+
+    // Index entries point at the map's keys, which stay put for the node's lifetime.
+    struct IdLess {
+        bool operator()(const std::string *lhs, const std::string *rhs) const { return *lhs < *rhs; }
+    };
+    using IdIndex = std::set<const std::string *, IdLess>;
+
+    using DueEntry = std::pair<std::int32_t, const std::string *>;
+    struct DueLess {
+        bool operator()(const DueEntry &lhs, const DueEntry &rhs) const {
+            return lhs.first != rhs.first ? lhs.first < rhs.first : *lhs.second < *rhs.second;
+        }
+    };
+
+    class IndexCursor final : public Cursor {
+    public:
+        IndexCursor(const Records &records, const IdIndex &index)
+            : records_(records), at_(index.begin()), end_(index.end()) {
+            resolve();
+        }
+
+        bool valid() const override { return at_ != end_; }
+        const CarRecord &record() const override { return **current_; }
+        CarRecordRef share() const override { return *current_; }
+        void next() override {
+            ++at_;
+            resolve();
+        }
+
+    private:
+        // One hash lookup per step, however often the merge compares this cursor.
+        void resolve() {
+            current_ = at_ != end_ ? &records_.find(**at_)->second : nullptr;
+        }
+
+        const Records &records_;
+        IdIndex::const_iterator at_;
+        IdIndex::const_iterator end_;
+        const CarRecordRef *current_{nullptr};
+    };
+
+    // Sorts pointers to the shard's entries once; the records themselves are not copied.
+    class OrderedCursor final : public Cursor {
+    public:
+        explicit OrderedCursor(const Records &records) {
+            ordered_.reserve(records.size());
+            for (const auto &entry : records) {
+                ordered_.push_back(&entry);
+            }
+            std::sort(ordered_.begin(), ordered_.end(), [](const auto *lhs, const auto *rhs) {
+                return lhs->first < rhs->first;
+            });
+        }
+
+        bool valid() const override { return at_ < ordered_.size(); }
+        const CarRecord &record() const override { return *ordered_[at_]->second; }
+        CarRecordRef share() const override { return ordered_[at_]->second; }
+        void next() override { ++at_; }
+
+    private:
+        std::vector<const Records::value_type *> ordered_;
+        size_t at_{0};
+    };
+
+    // Snapshots are written in id order, so hinting at the end makes loading one
+    // amortised O(1) index insert per car; out-of-order ids just fall back to O(log n).
+    // A batch lives in one slab that its records share through aliasing pointers, so storing
+    // it costs one allocation rather than one per car. The slab is freed once the last of
+    // its records has been replaced or removed.
+    void adopt(const std::shared_ptr<const std::vector<CarRecord>> &slab) {
+        for (const auto &record : *slab) {
+            put(CarRecordRef(slab, &record));
+        }
+    }
+
+    void index(const Records::value_type &entry) {
+        if (entry.second->status == CarStatus::Available) {
+            available_.insert(available_.end(), &entry.first);
+            return;
+        }
+        if (const auto renter = renterOf(*entry.second)) {
+            rentedBy_[std::string(*renter)].insert(&entry.first);
+        }
+        if (entry.second->dueDate != noDueDate) {
+            due_.emplace(entry.second->dueDate, &entry.first);
+        }
+    }
+
+    void unindex(const Records::value_type &entry) {
+        if (entry.second->status == CarStatus::Available) {
+            available_.erase(&entry.first);
+            return;
+        }
+        if (const auto renter = renterOf(*entry.second)) {
+            const auto it = rentedBy_.find(std::string(*renter));
+            if (it != rentedBy_.end()) {
+                it->second.erase(&entry.first);
+                if (it->second.empty()) {
+                    rentedBy_.erase(it);
+                }
+            }
+        }
+        if (entry.second->dueDate != noDueDate) {
+            due_.erase(DueEntry(entry.second->dueDate, &entry.first));
+        }
+    }
+
+    Records records_;
+    IdIndex available_;
+    std::unordered_map<std::string, IdIndex> rentedBy_;
+    // Rented cars with a due date, by (due date, id).
+    std::set<DueEntry, DueLess> due_;
+};
+
+// A memory-lean layout for very large fleets: records live in id-sorted columns (ids packed
+// into one character arena, models and renters interned, status/condition/price/due date in
+// their own arrays), so a lookup is a binary search and an ordered read is a straight walk.
+// Cars new to the store collect in a small ordered map until it outgrows 1/16 of the
+// store; it is then merged into fresh columns as one sorted run, which also drops the rows
+// tombstoned by erase. Records are rebuilt on every read, so snapshots and query results
+// copy instead of share.
+class CompactCarStore final : public CarStore {
+public:
+    size_t size() const override { return liveRows_ + inserts_.size(); }
+    size_t availableCount() const override { return available_; }
+
+    void load(std::vector<CarRecord> records) override {
+        const auto byId = [](const CarRecord &lhs, const CarRecord &rhs) { return lhs.id < rhs.id; };
+        if (!std::is_sorted(records.begin(), records.end(), byId)) {
+            std::stable_sort(records.begin(), records.end(), byId);
+        }
+        columns_ = Columns{};
+        inserts_.clear();
+        rentedBy_.clear();
+        due_.clear();
+        available_ = 0;
+        liveRows_ = 0;
+        columns_.reserve(records.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (i + 1 == records.size() || records[i + 1].id != records[i].id) {
+                columns_.append(records[i]);
+                indexRow(columns_.size() - 1);
+                ++liveRows_;
+            }
+        }
+    }
+
+    CarRecordRef find(const std::string &id) const override {
+        if (const auto at = liveRow(id)) {
+            auto record = std::make_shared<CarRecord>();
+            columns_.materialize(*at, *record);
+            return record;
+        }
+        const auto it = inserts_.find(id);
+        return it == inserts_.end() ? nullptr : std::make_shared<const CarRecord>(it->second);
+    }
+
+    bool contains(const std::string &id) const override {
+        return liveRow(id).has_value() || inserts_.count(id) != 0;
+    }
+
+    void put(CarRecordRef record) override {
+        if (!overwrite(*record)) {
+            putPending(*record);
+            mergeIfDue();
+        }
+    }
+
+    // Cars already stored are overwritten in place. New ones wait in the pending map, or,
+    // when there are enough of them to trigger a merge anyway, are sorted into a run and
+    // merged with the columns directly.
+    void putAll(std::span<CarRecord> records) override {
+        std::vector<CarRecord *> fresh;
+        for (auto &record : records) {
+            if (overwrite(record)) {
+                continue;
+            }
+            if (const auto it = inserts_.find(record.id); it != inserts_.end()) {
+                replacePending(it->second, std::move(record));
+                continue;
+            }
+            fresh.push_back(&record);
+        }
+        if (!mergeDue(inserts_.size() + fresh.size())) {
+            for (auto *record : fresh) {
+                putPending(std::move(*record));
+            }
+            return;
+        }
+        std::stable_sort(fresh.begin(), fresh.end(), [](const CarRecord *lhs, const CarRecord *rhs) {
+            return lhs->id < rhs->id;
+        });
+        std::vector<const CarRecord *> run;
+        run.reserve(fresh.size());
+        for (size_t i = 0; i < fresh.size(); ++i) {
+            if (i + 1 == fresh.size() || fresh[i + 1]->id != fresh[i]->id) {
+                run.push_back(fresh[i]);
+            }
+        }
+        merge(run);
+    }
+
+    bool updateIf(const std::string &id, const Condition &condition, const Mutator &mutator) override {
+        if (const auto at = liveRow(id)) {
+            CarRecord record;
+            columns_.materialize(*at, record);
+            if (!condition(record)) {
+                return false;
+            }
+            mutator(record);
+            unindexRow(*at);
+            columns_.write(*at, record);
+            indexRow(*at);
+            return true;
+        }
+        const auto it = inserts_.find(id);
+        if (it == inserts_.end() || !condition(it->second)) {
+            return false;
+        }
+        unindex(it->second);
+        mutator(it->second);
+        index(it->second);
+        return true;
+    }
+
+    bool eraseIf(const std::string &id, const Condition &condition) override {
+        if (const auto at = liveRow(id)) {
+            CarRecord record;
+            columns_.materialize(*at, record);
+            if (!condition(record)) {
+                return false;
+            }
+            unindexRow(*at);
+            columns_.live[*at] = 0;
+            --liveRows_;
+            return true;
+        }
+        const auto it = inserts_.find(id);
+        if (it == inserts_.end() || !condition(it->second)) {
+            return false;
+        }
+        unindex(it->second);
+        inserts_.erase(it);
+        return true;
+    }
+
+    // Status, condition, price, model and renter are tested on their columns; only the
+    // matching rows are built into records.
+    void scan(const CarQuery &query, const Visitor &visit) const override {
+        static const CarRecordRef none;
+        CarRecord record;
+        for (size_t at = 0; at < columns_.size(); ++at) {
+            if (columns_.live[at] == 0 ||
+                !query.matchesColumns(columns_.statuses[at], columns_.conditions[at], columns_.prices[at]) ||
+                (query.model && !(columns_.models[at] == *query.model)) ||
+                (query.renter && !(columns_.renters[at] == *query.renter))) {
+                continue;
+            }
+            columns_.materialize(at, record);
+            visit(record, none);
+        }
+        for (const auto &entry : inserts_) {
+            if (query.matches(entry.second)) {
+                visit(entry.second, none);
+            }
+        }
+    }
+
+    std::unique_ptr<Cursor> cursor(Scope scope, const std::string &renter) const override {
+        if (scope == Scope::RentedBy) {
+            static const std::set<std::string> none;
+            const auto it = rentedBy_.find(renter);
+            return std::make_unique<RenterCursor>(*this, it == rentedBy_.end() ? none : it->second);
+        }
+        return std::make_unique<MergeCursor>(*this, scope == Scope::Available);
+    }
+
+    void scanDue(std::int32_t day, const Visitor &visit) const override {
+        static const CarRecordRef none;
+        CarRecord record;
+        for (auto it = due_.begin(); it != due_.end() && it->first < day; ++it) {
+            if (const auto at = liveRow(it->second)) {
+                columns_.materialize(*at, record);
+                visit(record, none);
+            } else {
+                visit(inserts_.find(it->second)->second, none);
+            }
+        }
+    }
+
+private:
+    using Pending = std::map<std::string, CarRecord, std::less<>>;
+
+    // A range of the id arena; offsets rather than pointers, so the arena can grow.
+    struct Slice {
+        std::uint32_t offset{0};
+        std::uint32_t size{0};
+    };
+
+    struct Columns {
+        std::string arena;
+        std::vector<Slice> ids;
+        std::vector<InternedString> models;
+        std::vector<CarCondition> conditions;
+        std::vector<double> prices;
+        std::vector<CarStatus> statuses;
+        std::vector<InternedString> renters;
+        std::vector<std::int32_t> dueDates;
+        // 0 for rows erased since the last merge.
+        std::vector<std::uint8_t> live;
+
+        size_t size() const { return ids.size(); }
+
+        std::string_view id(size_t at) const {
+            return std::string_view(arena).substr(ids[at].offset, ids[at].size);
+        }
+
+        void reserve(size_t rows) {
+            ids.reserve(rows);
+            models.reserve(rows);
+            conditions.reserve(rows);
+            prices.reserve(rows);
+            statuses.reserve(rows);
+            renters.reserve(rows);
+            dueDates.reserve(rows);
+            live.reserve(rows);
+        }
+
+        void materialize(size_t at, CarRecord &record) const {
+            record.id.assign(id(at));
+            record.model = models[at];
+            record.condition = conditions[at];
+            record.pricePerDay = prices[at];
+            record.status = statuses[at];
+            record.renterId.assign(renters[at].str());
+            record.dueDate = dueDates[at];
+        }
+
+        // Everything but the id, which a row keeps for life.
+        void write(size_t at, const CarRecord &record) {
+            models[at] = record.model;
+            conditions[at] = record.condition;
+            prices[at] = record.pricePerDay;
+            statuses[at] = record.status;
+            renters[at] = record.renterId.empty() ? InternedString() : InternedString(record.renterId);
+            dueDates[at] = record.dueDate;
+        }
+
+        void append(const CarRecord &record) {
+            appendId(record.id);
+            models.emplace_back();
+            conditions.emplace_back();
+            prices.emplace_back();
+            statuses.emplace_back();
+            renters.emplace_back();
+            dueDates.emplace_back();
+            live.push_back(1);
+            write(size() - 1, record);
+        }
+
+        void append(const Columns &from, size_t at) {
+            appendId(from.id(at));
+            models.push_back(from.models[at]);
+            conditions.push_back(from.conditions[at]);
+            prices.push_back(from.prices[at]);
+            statuses.push_back(from.statuses[at]);
+            renters.push_back(from.renters[at]);
+            dueDates.push_back(from.dueDates[at]);
+            live.push_back(1);
+        }
+
+        void appendId(std::string_view text) {
+            if (arena.size() + text.size() > std::numeric_limits<std::uint32_t>::max()) {
+                throw std::length_error("Compact store id arena exceeds 4 GiB");
+            }
+            ids.push_back(Slice{static_cast<std::uint32_t>(arena.size()), static_cast<std::uint32_t>(text.size())});
+            arena.append(text);
+        }
+    };
+
+    // Walks the columns and the pending map together in id order.
+    class MergeCursor final : public Cursor {
+    public:
+        MergeCursor(const CompactCarStore &store, bool availableOnly)
+            : columns_(store.columns_), pending_(store.inserts_), insert_(pending_.begin()),
+              availableOnly_(availableOnly) {
+            settle();
+        }
+
+        bool valid() const override { return valid_; }
+        const CarRecord &record() const override { return current_; }
+        CarRecordRef share() const override { return std::make_shared<const CarRecord>(current_); }
+
+        void next() override {
+            if (fromColumns_) {
+                ++row_;
+            } else {
+                ++insert_;
+            }
+            settle();
+        }
+
+    private:
+        // Skips to the next wanted entry of either source and builds it into current_.
+        void settle() {
+            while (row_ < columns_.size() && (columns_.live[row_] == 0 ||
+                                              (availableOnly_ && columns_.statuses[row_] != CarStatus::Available))) {
+                ++row_;
+            }
+            while (insert_ != pending_.end() && availableOnly_ && insert_->second.status != CarStatus::Available) {
+                ++insert_;
+            }
+            const bool haveRow = row_ < columns_.size();
+            const bool haveInsert = insert_ != pending_.end();
+            valid_ = haveRow || haveInsert;
+            if (!valid_) {
+                return;
+            }
+            fromColumns_ = haveRow && (!haveInsert || columns_.id(row_) < insert_->first);
+            if (fromColumns_) {
+                columns_.materialize(row_, current_);
+            } else {
+                current_ = insert_->second;
+            }
+        }
+
+        const Columns &columns_;
+        const Pending &pending_;
+        size_t row_{0};
+        Pending::const_iterator insert_;
+        bool availableOnly_;
+        bool valid_{false};
+        bool fromColumns_{false};
+        CarRecord current_;
+    };
+
+    class RenterCursor final : public Cursor {
+    public:
+        RenterCursor(const CompactCarStore &store, const std::set<std::string> &ids)
+            : store_(store), at_(ids.begin()), end_(ids.end()) {
+            settle();
+        }
+
+        bool valid() const override { return at_ != end_; }
+        const CarRecord &record() const override { return current_; }
+        CarRecordRef share() const override { return std::make_shared<const CarRecord>(current_); }
+
+        void next() override {
+            ++at_;
+            settle();
+        }
+
+    private:
+        void settle() {
+            if (at_ != end_) {
+                current_ = *store_.find(*at_);
+            }
+        }
+
+        const CompactCarStore &store_;
+        std::set<std::string>::const_iterator at_;
+        std::set<std::string>::const_iterator end_;
+        CarRecord current_;
+    };
+
+    // The column row holding `id`, tombstoned rows included.
+    std::optional<size_t> row(std::string_view id) const {
+        size_t low = 0;
+        size_t high = columns_.size();
+        while (low < high) {
+            const size_t middle = low + (high - low) / 2;
+            if (columns_.id(middle) < id) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low == columns_.size() || columns_.id(low) != id) {
+            return std::nullopt;
+        }
+        return low;
+    }
+
+    std::optional<size_t> liveRow(std::string_view id) const {
+        const auto at = row(id);
+        return at && columns_.live[*at] != 0 ? at : std::nullopt;
+    }
+
+    // Updates the row if the id already has one, reviving a tombstone.
+    bool overwrite(const CarRecord &record) {
+        const auto at = row(record.id);
+        if (!at) {
+            return false;
+        }
+        if (columns_.live[*at] != 0) {
+            unindexRow(*at);
+        } else {
+            columns_.live[*at] = 1;
+            ++liveRows_;
+        }
+        columns_.write(*at, record);
+        indexRow(*at);
+        return true;
+    }
+
+    void putPending(CarRecord record) {
+        const auto it = inserts_.lower_bound(record.id);
+        if (it != inserts_.end() && it->first == record.id) {
+            replacePending(it->second, std::move(record));
+        } else {
+            index(inserts_.emplace_hint(it, record.id, std::move(record))->second);
+        }
+    }
+
+    void replacePending(CarRecord &pending, CarRecord record) {
+        unindex(pending);
+        pending = std::move(record);
+        index(pending);
+    }
+
+    void index(std::string_view id, CarStatus status, std::string_view renter, std::int32_t dueDate) {
+        if (status == CarStatus::Available) {
+            ++available_;
+            return;
+        }
+        if (!renter.empty()) {
+            rentedBy_[std::string(renter)].emplace(id);
+        }
+        if (dueDate != noDueDate) {
+            due_.emplace(dueDate, std::string(id));
+        }
+    }
+
+    void unindex(std::string_view id, CarStatus status, std::string_view renter, std::int32_t dueDate) {
+        if (status == CarStatus::Available) {
+            --available_;
+            return;
+        }
+        if (!renter.empty()) {
+            const auto it = rentedBy_.find(std::string(renter));
+            if (it != rentedBy_.end()) {
+                it->second.erase(std::string(id));
+                if (it->second.empty()) {
+                    rentedBy_.erase(it);
+                }
+            }
+        }
+        if (dueDate != noDueDate) {
+            due_.erase(std::pair(dueDate, std::string(id)));
+        }
+    }
+
+    void index(const CarRecord &record) { index(record.id, record.status, record.renterId, record.dueDate); }
+    void unindex(const CarRecord &record) { unindex(record.id, record.status, record.renterId, record.dueDate); }
+    void indexRow(size_t at) {
+        index(columns_.id(at), columns_.statuses[at], columns_.renters[at].str(), columns_.dueDates[at]);
+    }
+    void unindexRow(size_t at) {
+        unindex(columns_.id(at), columns_.statuses[at], columns_.renters[at].str(), columns_.dueDates[at]);
+    }
+
+    bool mergeDue(size_t pending) const {
+        return pending > std::max<size_t>(1024, liveRows_ / 16);
+    }
+
+    void mergeIfDue() {
+        if (mergeDue(inserts_.size())) {
+            merge({});
+        }
+    }
+
+    // Three-way merge of the live rows, the pending map and `run` (id-sorted, ids not stored
+    // yet) into fresh columns. The indexes only gain the run's records; everything else was
+    // already indexed.
+    void merge(const std::vector<const CarRecord *> &run) {
+        Columns old = std::move(columns_);
+        columns_ = Columns{};
+        Pending pending = std::move(inserts_);
+        inserts_.clear();
+        columns_.reserve(liveRows_ + pending.size() + run.size());
+        columns_.arena.reserve(old.arena.size());
+
+        size_t at = 0;
+        auto insert = pending.begin();
+        size_t next = 0;
+        while (true) {
+            while (at < old.size() && old.live[at] == 0) {
+                ++at;
+            }
+            const std::string_view *smallest = nullptr;
+            std::string_view rowId;
+            if (at < old.size()) {
+                rowId = old.id(at);
+                smallest = &rowId;
+            }
+            std::string_view insertId;
+            if (insert != pending.end() && (!smallest || insert->first < *smallest)) {
+                insertId = insert->first;
+                smallest = &insertId;
+            }
+            if (next < run.size() && (!smallest || run[next]->id < *smallest)) {
+                columns_.append(*run[next]);
+                index(*run[next]);
+                ++next;
+            } else if (smallest == &insertId) {
+                columns_.append(insert->second);
+                ++insert;
+            } else if (smallest == &rowId) {
+                columns_.append(old, at);
+                ++at;
+            } else {
+                break;
+            }
+        }
+        liveRows_ = columns_.size();
+    }
+
+    Columns columns_;
+    size_t liveRows_{0};
+    Pending inserts_;
+    size_t available_{0};
+    std::unordered_map<std::string, std::set<std::string>> rentedBy_;
+    // Rented cars with a due date, by (due date, id).
+    std::set<std::pair<std::int32_t, std::string>> due_;
+};
+
+inline std::unique_ptr<CarStore> makeCarStore(StoreLayout layout) {
+    if (layout == StoreLayout::Compact) {
+        return std::make_unique<CompactCarStore>();
+    }
+    return std::make_unique<HashedCarStore>();
+}
+
+// Background persistence as `stats` reports it. lastCommit runs from a flush request to
+// its write being durable; lastWrite is the write alone, on whichever thread ran it.
+struct PersistStats {
+    bool background{false};
+    bool inFlight{false};
+    bool queued{false};
+    std::chrono::microseconds inFlightFor{0};
+    std::chrono::microseconds lastCommit{0};
+    std::chrono::microseconds lastWrite{0};
+    size_t commits{0};
+    size_t failures{0};
+};
+
+// Records are spread over shards by id hash, each behind its own reader/writer lock, so
+// lookups and single-car updates from different threads only contend when they land on
+// the same shard. Whole-fleet views lock every shard in index order; writers never hold
+// more than one shard lock unless they hold all of them, so the two cannot deadlock.
+// Each shard keeps its records in a CarStore of the layout chosen at construction.
+class CarRepository {
+public:
+    static constexpr size_t defaultShardCount = 16;
+    using Condition = CarStore::Condition;
+    using Mutator = CarStore::Mutator;
+
+    // Changes staged against the repository and applied together by commit(). Conditions
+    // are checked at commit time under the write locks of every shard the transaction
+    // touches, so either every step applies or none does; later steps see earlier ones.
+    // Nothing is written to the backend until the next flush().
+    class Transaction {
+    public:
+        explicit Transaction(CarRepository &repository)
+            : repository_(&repository) {}
+
+        void upsert(CarRecord record) {
+            steps_.push_back(Step{Kind::Upsert, record.id, std::move(record), {}, {}});
+        }
+
+        // Fails the commit if the id is already tracked.
+        void insert(CarRecord record) {
+            steps_.push_back(Step{Kind::Insert, record.id, std::move(record), {}, {}});
+        }
+
+        // Fails the commit if the car is missing or `condition` rejects it. The mutator
+        // must not change the id.
+        void updateIf(std::string id, Condition condition, Mutator mutator) {
+            steps_.push_back(Step{Kind::Update, std::move(id), std::nullopt, std::move(condition), std::move(mutator)});
+        }
+
+        void update(std::string id, Mutator mutator) {
+            updateIf(std::move(id), [](const CarRecord &) { return true; }, std::move(mutator));
+        }
+
+        void removeIf(std::string id, Condition condition) {
+            steps_.push_back(Step{Kind::Remove, std::move(id), std::nullopt, std::move(condition), {}});
+        }
+
+        void remove(std::string id) {
+            removeIf(std::move(id), [](const CarRecord &) { return true; });
+        }
+
+        // Every car `condition` accepts at commit time; never fails, but locks the whole fleet.
+        void updateWhere(Condition condition, Mutator mutator) {
+            steps_.push_back(Step{Kind::UpdateWhere, {}, std::nullopt, std::move(condition), std::move(mutator)});
+        }
+
+        size_t size() const { return steps_.size(); }
+        bool commit() { return repository_->commit(*this); }
+        void abort() { repository_->abort(*this); }
+
+    private:
+        friend class CarRepository;
+
+        enum class Kind { Upsert, Insert, Update, Remove, UpdateWhere };
+
+        struct Step {
+            Kind kind;
+            std::string id;
+            std::optional<CarRecord> record;
+            Condition condition;
+            Mutator mutator;
+        };
+
+        CarRepository *repository_;
+        std::vector<Step> steps_;
+    };
+
+    explicit CarRepository(std::shared_ptr<StorageBackend> backend, size_t shards = defaultShardCount,
+                           StoreLayout layout = StoreLayout::Hashed)
+        : backend_(std::move(backend)), layout_(layout), shards_(std::max<size_t>(shards, 1)) {
+        for (auto &shard : shards_) {
+            shard.store = makeCarStore(layout_);
+        }
+        reload();
+    }
+
+    ~CarRepository() {
+        stopBackgroundPersistence();
+    }
+
+    CarRepository(const CarRepository &) = delete;
+    CarRepository &operator=(const CarRepository &) = delete;
+
+    void reload() {
+        awaitPersisted();
+        std::lock_guard<std::mutex> commit(commitMutex_);
+        auto locks = lockAll<std::unique_lock<std::shared_mutex>>();
+        auto loaded = [&] {
+            std::lock_guard<std::mutex> backend(backendMutex_);
+            return backend_->loadCars();
+        }();
+        loadLocked(std::move(loaded));
+    }
+
+    // Upserts an id-sorted file through StorageBackend::mergeSorted and reloads the merged
+    // fleet. Pending changes are written first and every shard stays locked until the
+    // reload, so nothing changed in memory is lost to it. Unset, with nothing changed,
+    // when the backend cannot merge.
+    std::optional<MergeStats> mergeSorted(const std::string &input, const RejectionHandler &onReject = {}) {
+        awaitPersisted();
+        std::lock_guard<std::mutex> commit(commitMutex_);
+        auto locks = lockAll<std::unique_lock<std::shared_mutex>>();
+        std::unique_lock<std::mutex> backend(backendMutex_);
+        if (pending_.load() > 0 || snapshotDue_.load()) {
+            auto job = collectLocked(snapshotDue_.load());
+            try {
+                backend_->awaitDurable(writeLocked(job));
+            } catch (...) {
+                backend.unlock();
+                locks.clear();
+                restore(job);
+                throw;
+            }
+        }
+        auto stats = backend_->mergeSorted(input, onReject);
+        if (stats) {
+            loadLocked(backend_->loadCars());
+        }
+        return stats;
+    }
+
+private:
+    // Callers hold commitMutex_ and every shard lock.
+    void loadLocked(std::vector<CarRecord> loaded) {
+        std::vector<std::vector<CarRecord>> buckets(shards_.size());
+        for (auto &bucket : buckets) {
+            bucket.reserve(loaded.size() / shards_.size() + 1);
+        }
+        for (auto &record : loaded) {
+            buckets[shardIndex(record.id)].push_back(std::move(record));
+        }
+        loaded = {};
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i].store->load(std::move(buckets[i]));
+            shards_[i].changed.clear();
+            shards_[i].removed.clear();
+        }
+        pending_ = 0;
+    }
+
+public:
+
+    StoreLayout layout() const {
+        return layout_;
+    }
+
+    // Shard locks are held only while the records are gathered; sorting happens after.
+    std::shared_ptr<const FleetSnapshot> snapshot() const {
+        std::vector<FleetSnapshot::Entry> records;
+        {
+            auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+            records.reserve(countLocked());
+            for (const auto &shard : shards_) {
+                shard.store->scan(CarQuery{}, [&](const CarRecord &record, const CarRecordRef &shared) {
+                    records.push_back(shared ? shared : std::make_shared<const CarRecord>(record));
+                });
+            }
+        }
+        return std::make_shared<const FleetSnapshot>(std::move(records));
+    }
+
+    std::vector<CarRecord> all() const {
+        const auto fleet = snapshot();
+        std::vector<CarRecord> records;
+        records.reserve(fleet->size());
+        for (const auto &record : fleet->records()) {
+            records.push_back(*record);
+        }
+        return records;
+    }
+
+    Transaction begin() {
+        return Transaction(*this);
+    }
+
+    // Applies every staged step or, if any condition fails, none of them.
+    bool commit(Transaction &transaction) {
+        static LatencyHistogram &commitLatency = MetricsRegistry::instance().histogram("repository.transaction");
+        const ScopedTimer timer(commitLatency);
+        auto steps = std::move(transaction.steps_);
+        transaction.steps_.clear();
+        if (steps.empty()) {
+            return true;
+        }
+
+        // Shard locks are always taken in index order, as lockAll() does.
+        std::vector<bool> involved(shards_.size(), false);
+        for (const auto &step : steps) {
+            if (step.kind == Transaction::Kind::UpdateWhere) {
+                involved.assign(shards_.size(), true);
+                break;
+            }
+            involved[shardIndex(step.id)] = true;
+        }
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (involved[i]) {
+                locks.emplace_back(shards_[i].mutex);
+            }
+        }
+
+        // The transaction's view of every car it has changed; null once removed.
+        std::unordered_map<std::string, CarRecordRef> staged;
+        const auto current = [&](const std::string &id) -> CarRecordRef & {
+            auto it = staged.find(id);
+            if (it == staged.end()) {
+                it = staged.emplace(id, shardFor(id).store->find(id)).first;
+            }
+            return it->second;
+        };
+        const auto mutated = [](const CarRecord &record, const Mutator &mutator) {
+            auto next = std::make_shared<CarRecord>(record);
+            mutator(*next);
+            return next;
+        };
+
+        for (auto &step : steps) {
+            switch (step.kind) {
+            case Transaction::Kind::Upsert:
+                current(step.id) = std::make_shared<const CarRecord>(std::move(*step.record));
+                break;
+            case Transaction::Kind::Insert: {
+                auto &slot = current(step.id);
+                if (slot) {
+                    return false;
+                }
+                slot = std::make_shared<const CarRecord>(std::move(*step.record));
+                break;
+            }
+            case Transaction::Kind::Update: {
+                auto &slot = current(step.id);
+                if (!slot || !step.condition(*slot)) {
+                    return false;
+                }
+                slot = mutated(*slot, step.mutator);
+                break;
+            }
+            case Transaction::Kind::Remove: {
+                auto &slot = current(step.id);
+                if (!slot || !step.condition(*slot)) {
+                    return false;
+                }
+                slot = nullptr;
+                break;
+            }
+            case Transaction::Kind::UpdateWhere:
+                for (const auto &shard : shards_) {
+                    shard.store->scan(CarQuery{}, [&](const CarRecord &stored, const CarRecordRef &) {
+                        const auto it = staged.find(stored.id);
+                        if (it == staged.end()) {
+                            if (step.condition(stored)) {
+                                staged.emplace(stored.id, mutated(stored, step.mutator));
+                            }
+                        } else if (it->second && step.condition(*it->second)) {
+                            it->second = mutated(*it->second, step.mutator);
+                        }
+                    });
+                }
+                // Cars inserted earlier in this transaction are not in the shards yet.
+                for (auto &[id, record] : staged) {
+                    if (record && !shardFor(id).store->contains(id) && step.condition(*record)) {
+                        record = mutated(*record, step.mutator);
+                    }
+                }
+                break;
+            }
+        }
+
+        size_t applied = 0;
+        for (auto &[id, record] : staged) {
+            Shard &shard = shardFor(id);
+            if (record) {
+                shard.store->put(std::move(record));
+                shard.track(id);
+                ++applied;
+            } else if (shard.store->eraseIf(id, [](const CarRecord &) { return true; })) {
+                shard.trackRemoval(id);
+                ++applied;
+            }
+        }
+        pending_ += applied;
+        return true;
+    }
+
+    void abort(Transaction &transaction) {
+        transaction.steps_.clear();
+    }
+
+    // Id-ordered queries on available cars or one renter's cars walk the shards' indexes and
+    // stop at `limit`; everything else scans the fleet once and keeps the best `limit`
+    // matches. Results share the stored records when the layout keeps shared records.
+    std::vector<CarRecordRef> query(const CarQuery &query) const {
+        static LatencyHistogram &queryLatency = MetricsRegistry::instance().histogram("repository.query");
+        const ScopedTimer timer(queryLatency);
+        std::vector<CarRecordRef> matches;
+        if (query.limit == 0) {
+            return matches;
+        }
+        const bool byAvailability = query.status == CarStatus::Available && !query.renter;
+        if (query.order == CarQuery::Order::Id && (byAvailability || query.renter)) {
+            auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+            const auto scope = byAvailability ? CarStore::Scope::Available : CarStore::Scope::RentedBy;
+            merge(scope, query.renter.value_or(std::string()), [&](const CarStore::Cursor &cursor) {
+                if (query.matches(cursor.record())) {
+                    matches.push_back(cursor.share());
+                }
+                return matches.size() < query.limit;
+            });
+            return matches;
+        }
+
+        const auto before = [order = query.order](const CarRecord &lhs, const CarRecord &rhs) {
+            if (order != CarQuery::Order::Id && lhs.pricePerDay != rhs.pricePerDay) {
+                return order == CarQuery::Order::Price ? lhs.pricePerDay < rhs.pricePerDay
+                                                       : lhs.pricePerDay > rhs.pricePerDay;
+            }
+            return lhs.id < rhs.id;
+        };
+        const auto refBefore = [&before](const CarRecordRef &lhs, const CarRecordRef &rhs) {
+            return before(*lhs, *rhs);
+        };
+        {
+            auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+            const bool bounded = query.limit < countLocked();
+            // A bounded query keeps the best `limit` matches in a max-heap, so it costs
+            // O(fleet x log limit) and copies out only the rows it returns.
+            for (const auto &shard : shards_) {
+                shard.store->scan(query, [&](const CarRecord &record, const CarRecordRef &shared) {
+                    if (bounded && matches.size() == query.limit) {
+                        if (!before(record, *matches.front())) {
+                            return;
+                        }
+                        std::pop_heap(matches.begin(), matches.end(), refBefore);
+                        matches.pop_back();
+                    }
+                    matches.push_back(shared ? shared : std::make_shared<const CarRecord>(record));
+                    if (bounded) {
+                        std::push_heap(matches.begin(), matches.end(), refBefore);
+                    }
+                });
+            }
+        }
+        std::sort(matches.begin(), matches.end(), refBefore);
+        return matches;
+    }
+
+    // Merges the shards' ordered availability indexes: O(limit x shards), not a fleet scan.
+    std::vector<CarRecord> available(size_t limit = std::numeric_limits<size_t>::max()) const {
+        auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+        return collect(CarStore::Scope::Available, {}, limit);
+    }
+
+    std::vector<CarRecord> rentedBy(const std::string &userId) const {
+        auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+        return collect(CarStore::Scope::RentedBy, userId, std::numeric_limits<size_t>::max());
+    }
+
+    // Rented cars due before `day`, earliest due date first and by id within a day. The
+    // shards walk their due-date indexes, so the cost follows the overdue cars, not the fleet.
+    std::vector<CarRecord> dueBefore(std::int32_t day) const {
+        auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+        std::vector<CarRecord> due;
+        for (const auto &shard : shards_) {
+            shard.store->scanDue(day, [&](const CarRecord &record, const CarRecordRef &) { due.push_back(record); });
+        }
+        std::sort(due.begin(), due.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
+            return lhs.dueDate != rhs.dueDate ? lhs.dueDate < rhs.dueDate : lhs.id < rhs.id;
+        });
+        return due;
+    }
+
+    size_t availableCount() const {
+        size_t count = 0;
+        for (const auto &shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            count += shard.store->availableCount();
+        }
+        return count;
+    }
+
+    // Both counts from the same instant; no transaction is ever half-counted.
+    FleetCounts counts() const {
+        auto locks = lockAll<std::shared_lock<std::shared_mutex>>();
+        FleetCounts counts;
+        for (const auto &shard : shards_) {
+            counts.total += shard.store->size();
+            counts.available += shard.store->availableCount();
+        }
+        return counts;
+    }
+
+    std::optional<CarRecord> find(const std::string &id) const {
+        const Shard &shard = shardFor(id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto record = shard.store->find(id);
+        if (!record) {
+            return std::nullopt;
+        }
+        return *record;
+    }
+
+    bool upsert(const CarRecord &record) {
+        Shard &shard = shardFor(record.id);
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.store->put(std::make_shared<const CarRecord>(record));
+            shard.track(record.id);
+        }
+        ++pending_;
+        return true;
+    }
+
+    // Adds the car only if its id is not tracked yet; the check and the insert are atomic.
+    bool insert(const CarRecord &record) {
+        Shard &shard = shardFor(record.id);
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (shard.store->contains(record.id)) {
+                return false;
+            }
+            shard.store->put(std::make_shared<const CarRecord>(record));
+            shard.track(record.id);
+        }
+        ++pending_;
+        return true;
+    }
+
+    // The mutator must not change the id.
+    bool update(const std::string &id, const Mutator &mutator) {
+        return updateIf(id, [](const CarRecord &) { return true; }, mutator);
+    }
+
+    // Runs `mutator` only when `condition` accepts the current record. Both run under the
+    // shard's write lock, so no other writer can change the car between check and update.
+    bool updateIf(const std::string &id, const Condition &condition, const Mutator &mutator) {
+        static LatencyHistogram &updateLatency = MetricsRegistry::instance().histogram("repository.update");
+        const ScopedTimer timer(updateLatency);
+        Shard &shard = shardFor(id);
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (!shard.store->updateIf(id, condition, mutator)) {
+                return false;
+            }
+            shard.track(id);
+        }
+        ++pending_;
+        return true;
+    }
+
+    bool remove(const std::string &id) {
+        return removeIf(id, [](const CarRecord &) { return true; });
+    }
+
+    // Drops the car only when `condition` accepts it, under the shard's write lock.
+    bool removeIf(const std::string &id, const Condition &condition) {
+        Shard &shard = shardFor(id);
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (!shard.store->eraseIf(id, condition)) {
+                return false;
+            }
+            shard.trackRemoval(id);
+        }
+        ++pending_;
+        return true;
+    }
+
+    void bulkUpsert(const std::vector<CarRecord> &records) {
+        bulkUpsert(std::vector<CarRecord>(records));
+    }
+
+    // Takes each shard's lock once for all of the records that hash to it. The records are
+    // moved into the stores; the vector keeps its capacity for the caller to refill.
+    void bulkUpsert(std::vector<CarRecord> &&records) {
+        if (records.empty()) {
+            return;
+        }
+        static LatencyHistogram &upsertLatency = MetricsRegistry::instance().histogram("repository.upsert");
+        static Counter &upserted = MetricsRegistry::instance().counter("records.upserted");
+        const ScopedTimer timer(upsertLatency);
+        upserted.add(records.size());
+
+        // One counting pass groups the batch by shard, keeping file order within a shard so
+        // the last duplicate still wins.
+        std::vector<size_t> shardOf(records.size());
+        std::vector<size_t> starts(shards_.size() + 1, 0);
+        for (size_t i = 0; i < records.size(); ++i) {
+            shardOf[i] = shardIndex(records[i].id);
+            ++starts[shardOf[i] + 1];
+        }
+        std::partial_sum(starts.begin(), starts.end(), starts.begin());
+        std::vector<CarRecord> grouped(records.size());
+        auto next = starts;
+        for (size_t i = 0; i < records.size(); ++i) {
+            grouped[next[shardOf[i]]++] = std::move(records[i]);
+        }
+
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            const std::span<CarRecord> bucket(grouped.data() + starts[i], starts[i + 1] - starts[i]);
+            if (bucket.empty()) {
+                continue;
+            }
+            std::unique_lock<std::shared_mutex> lock(shards_[i].mutex);
+            for (const auto &record : bucket) {
+                shards_[i].track(record.id);
+            }
+            shards_[i].store->putAll(bucket);
+        }
+        pending_ += records.size();
+    }
+
+    // Small change sets go to the backend's journal when it has one; once half the
+    // fleet has changed a full snapshot is cheaper than journaling every record.
+    // Without background persistence the write happens on the caller's thread and the
+    // returned future is already satisfied; with it, flush() only asks the writer thread
+    // for a write and returns. The future is satisfied once everything changed before the
+    // call is durable, and carries the error if that write failed.
+    std::shared_future<void> flush() {
+        if (persister_.joinable()) {
+            return requestPersist(false);
+        }
+        persistNow(false);
+        std::promise<void> done;
+        done.set_value();
+        return done.get_future().share();
+    }
+
+    // Writes a fresh snapshot so the backend can drop its journal; always waits for it.
+    void compact() {
+        if (persister_.joinable()) {
+            requestPersist(true).get();
+            return;
+        }
+        persistNow(true);
+    }
+
+    // Moves writes to a background thread from now on; see flush().
+    void startBackgroundPersistence() {
+        std::lock_guard<std::mutex> lock(persistMutex_);
+        if (!persister_.joinable()) {
+            persistStopping_ = false;
+            persister_ = std::thread([this] { persistLoop(); });
+        }
+    }
+
+    // Finishes any requested write, then persists on the caller's thread again.
+    void stopBackgroundPersistence() {
+        {
+            std::lock_guard<std::mutex> lock(persistMutex_);
+            if (!persister_.joinable()) {
+                return;
+            }
+            persistStopping_ = true;
+        }
+        persistWake_.notify_all();
+        persister_.join();
+    }
+
+    // Blocks until no background write is requested or running.
+    void awaitPersisted() const {
+        std::unique_lock<std::mutex> lock(persistMutex_);
+        persistDone_.wait(lock, [&] { return !request_ && !persistStats_.inFlight; });
+    }
+
+    PersistStats persistStats() const {
+        std::lock_guard<std::mutex> lock(persistMutex_);
+        PersistStats stats = persistStats_;
+        stats.background = persister_.joinable();
+        stats.queued = request_.has_value();
+        if (stats.inFlight) {
+            stats.inFlightFor = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - inFlightSince_);
+        }
+        return stats;
+    }
+
+    size_t totalRecords() const {
+        size_t count = 0;
+        for (const auto &shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            count += shard.store->size();
+        }
+        return count;
+    }
+
+    bool pendingChanges() const {
+        return pending_.load() > 0;
+    }
+
+    size_t shardCount() const {
+        return shards_.size();
+    }
+
+    size_t journalEntries() const {
+        std::lock_guard<std::mutex> backend(backendMutex_);
+        return backend_->journalEntries();
+    }
+
+    CommitMetrics commitMetrics() const {
+        std::lock_guard<std::mutex> backend(backendMutex_);
+        return backend_->commitMetrics();
+    }
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unique_ptr<CarStore> store;
+        // Ids upserted / removed since the last flush; an id is never in both.
+        std::unordered_set<std::string> changed;
+        std::unordered_set<std::string> removed;
+
+        void track(const std::string &id) {
+            changed.insert(id);
+            removed.erase(id);
+        }
+
+        void trackRemoval(const std::string &id) {
+            changed.erase(id);
+            removed.insert(id);
+        }
+    };
+
+    size_t shardIndex(const std::string &id) const {
+        return std::hash<std::string>{}(id) % shards_.size();
+    }
+
+    Shard &shardFor(const std::string &id) { return shards_[shardIndex(id)]; }
+    const Shard &shardFor(const std::string &id) const { return shards_[shardIndex(id)]; }
+
+    template <typename Lock>
+    std::vector<Lock> lockAll() const {
+        std::vector<Lock> locks;
+        locks.reserve(shards_.size());
+        for (const auto &shard : shards_) {
+            locks.emplace_back(shard.mutex);
+        }
+        return locks;
+    }
+
+    // Callers hold every shard lock.
+    size_t countLocked() const {
+        size_t count = 0;
+        for (const auto &shard : shards_) {
+            count += shard.store->size();
+        }
+        return count;
+    }
+
+    size_t changedCount() const {
+        size_t count = 0;
+        for (const auto &shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            count += shard.changed.size() + shard.removed.size();
+        }
+        return count;
+    }
+
+    // Puts ids back into the change sets after a failed write so the next flush retries;
+    // ids touched again since then already carry their newer state.
+    void requeue(const std::vector<CarRecord> &records, const std::vector<std::string> &removed) {
+        for (const auto &record : records) {
+            Shard &shard = shardFor(record.id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (shard.store->contains(record.id)) {
+                shard.changed.insert(record.id);
+            }
+        }
+        for (const auto &id : removed) {
+            Shard &shard = shardFor(id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (!shard.store->contains(id)) {
+                shard.removed.insert(id);
+            }
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    // One write's worth of changes, taken from every shard at the same instant.
+    struct PersistJob {
+        size_t seen{0};
+        bool full{false};
+        // The whole fleet for a snapshot; shared with the store in the hashed layout.
+        std::vector<CarRecordRef> records;
+        std::vector<CarRecord> changed;
+        std::vector<std::string> removed;
+    };
+
+    struct PersistRequest {
+        bool full{false};
+        Clock::time_point since;
+        std::promise<void> done;
+        std::shared_future<void> future;
+    };
+
+    // Takes the change set, or for a snapshot the fleet's records, and clears the shards'
+    // change sets. Shard locks are held only while gathering; the write happens after.
+    // Callers hold commitMutex_.
+    std::optional<PersistJob> takeChanges(bool compact) {
+        const size_t seen = pending_.load();
+        const bool retrySnapshot = snapshotDue_.load();
+        if (compact) {
+            std::lock_guard<std::mutex> backend(backendMutex_);
+            if (seen == 0 && !retrySnapshot && backend_->journalEntries() == 0) {
+                return std::nullopt;
+            }
+        } else if (seen == 0 && !retrySnapshot) {
+            return std::nullopt;
+        }
+        const bool full = compact || retrySnapshot || !backend_->supportsIncrementalWrites() ||
+                          changedCount() * 2 >= totalRecords();
+
+        auto locks = lockAll<std::unique_lock<std::shared_mutex>>();
+        return collectLocked(full);
+    }
+
+    // Callers hold every shard lock.
+    PersistJob collectLocked(bool full) {
+        PersistJob job;
+        job.seen = pending_.load();
+        job.full = full;
+        if (job.full) {
+            job.records.reserve(countLocked());
+            for (const auto &shard : shards_) {
+                shard.store->scan(CarQuery{}, [&](const CarRecord &record, const CarRecordRef &shared) {
+                    job.records.push_back(shared ? shared : std::make_shared<const CarRecord>(record));
+                });
+            }
+        } else {
+            for (const auto &shard : shards_) {
+                for (const auto &id : shard.changed) {
+                    job.changed.push_back(*shard.store->find(id));
+                }
+                job.removed.insert(job.removed.end(), shard.removed.begin(), shard.removed.end());
+            }
+        }
+        for (auto &shard : shards_) {
+            shard.changed.clear();
+            shard.removed.clear();
+        }
+        pending_ -= job.seen;
+        snapshotDue_ = false;
+        return job;
+    }
+
+    // Puts a failed job's changes back so the next flush writes them again.
+    void restore(const PersistJob &job) {
+        if (job.full) {
+            snapshotDue_ = true;
+        } else {
+            requeue(job.changed, job.removed);
+        }
+        pending_ += job.seen;
+    }
+
+    // Jobs reach the backend in the order they were taken since commitMutex_ is held until
+    // the backend has the job; a delta's durability is awaited outside it, so a
+    // group-committing backend can batch concurrent flushes.
+    void persistNow(bool compact) {
+        static LatencyHistogram &flushLatency = MetricsRegistry::instance().histogram("repository.flush");
+        const ScopedTimer timer(flushLatency);
+        const auto started = Clock::now();
+        std::unique_lock<std::mutex> commit(commitMutex_);
+        auto job = takeChanges(compact);
+        if (!job) {
+            return;
+        }
+        std::uint64_t ticket = 0;
+        try {
+            std::lock_guard<std::mutex> backend(backendMutex_);
+            ticket = writeLocked(*job);
+        } catch (...) {
+            restore(*job);
+            throw;
+        }
+        commit.unlock();
+
+        if (!job->full) {
+            try {
+                backend_->awaitDurable(ticket);
+            } catch (...) {
+                restore(*job);
+                throw;
+            }
+        }
+        std::lock_guard<std::mutex> lock(persistMutex_);
+        persistStats_.lastWrite = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started);
+    }
+
+    // Hands a job to the backend in id order, returning the ticket a delta's durability is
+    // awaited with. Callers hold backendMutex_.
+    std::uint64_t writeLocked(PersistJob &job) {
+        if (job.full) {
+            std::sort(job.records.begin(), job.records.end(), [](const CarRecordRef &lhs, const CarRecordRef &rhs) {
+                return lhs->id < rhs->id;
+            });
+            backend_->persistCars([&records = job.records](const RecordVisitor &visit) {
+                for (const auto &record : records) {
+                    visit(*record);
+                }
+            });
+            return 0;
+        }
+        std::sort(job.changed.begin(), job.changed.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
+            return lhs.id < rhs.id;
+        });
+        std::sort(job.removed.begin(), job.removed.end());
+        return backend_->submitDelta(job.changed, job.removed);
+    }
+
+    // A request made while another is queued joins it; one made during a write is queued
+    // behind it and picks up everything changed in the meantime.
+    std::shared_future<void> requestPersist(bool compact) {
+        std::lock_guard<std::mutex> lock(persistMutex_);
+        if (!request_) {
+            request_.emplace();
+            request_->since = Clock::now();
+            request_->future = request_->done.get_future().share();
+        }
+        request_->full = request_->full || compact;
+        persistWake_.notify_all();
+        return request_->future;
+    }
+
+    void persistLoop() {
+        std::unique_lock<std::mutex> lock(persistMutex_);
+        while (true) {
+            persistWake_.wait(lock, [&] { return persistStopping_ || request_; });
+            if (!request_) {
+                return;
+            }
+            PersistRequest request = std::move(*request_);
+            request_.reset();
+            persistStats_.inFlight = true;
+            inFlightSince_ = request.since;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                persistNow(request.full);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            persistStats_.inFlight = false;
+            persistStats_.lastCommit =
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - request.since);
+            if (error) {
+                ++persistStats_.failures;
+                request.done.set_exception(error);
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception &failure) {
+                    std::cerr << "[WARN] Background flush failed, changes stay pending: " << failure.what() << '\n';
+                }
+            } else {
+                ++persistStats_.commits;
+                request.done.set_value();
+            }
+            persistDone_.notify_all();
+        }
+    }
+
+    // k-way merge of the shards' cursors over `scope`, handing them to `visit` in id order
+    // until it returns false; callers hold the shard locks.
+    template <typename Visit>
+    void merge(CarStore::Scope scope, const std::string &renter, Visit &&visit) const {
+        std::vector<std::unique_ptr<CarStore::Cursor>> cursors;
+        for (const auto &shard : shards_) {
+            auto cursor = shard.store->cursor(scope, renter);
+            if (cursor->valid()) {
+                cursors.push_back(std::move(cursor));
+            }
+        }
+        while (!cursors.empty()) {
+            size_t next = 0;
+            for (size_t i = 1; i < cursors.size(); ++i) {
+                if (cursors[i]->record().id < cursors[next]->record().id) {
+                    next = i;
+                }
+            }
+            if (!visit(*cursors[next])) {
+                return;
+            }
+            cursors[next]->next();
+            if (!cursors[next]->valid()) {
+                cursors.erase(cursors.begin() + static_cast<std::ptrdiff_t>(next));
+            }
+        }
+    }
+
+    std::vector<CarRecord> collect(CarStore::Scope scope, const std::string &renter, size_t limit) const {
+        std::vector<CarRecord> output;
+        if (limit == 0) {
+            return output;
+        }
+        merge(scope, renter, [&](const CarStore::Cursor &cursor) {
+            output.push_back(cursor.record());
+            return output.size() < limit;
+        });
+        return output;
+    }
+
+    std::shared_ptr<StorageBackend> backend_;
+    StoreLayout layout_;
+    std::vector<Shard> shards_;
+    // Mutations not yet handed to the backend; only ever read as "is anything pending".
+    std::atomic<size_t> pending_{0};
+    // Set when a snapshot write failed, so the next flush writes the whole fleet again.
+    std::atomic<bool> snapshotDue_{false};
+    // Orders flushes; held while changes are taken and handed to the backend.
+    mutable std::mutex commitMutex_;
+    // Serializes calls into the backend, which is not thread-safe itself.
+    mutable std::mutex backendMutex_;
+
+    mutable std::mutex persistMutex_;
+    mutable std::condition_variable persistWake_;
+    mutable std::condition_variable persistDone_;
+    std::optional<PersistRequest> request_;
+    PersistStats persistStats_;
+    Clock::time_point inFlightSince_;
+    bool persistStopping_{false};
+    std::thread persister_;
+};
+
+class RentalService {
+public:
+    explicit RentalService(CarRepository &repository)
+        : repository_(repository) {}
+
+    void addCar(const CarRecord &record) {
+        if (!repository_.insert(record)) {
+            throw std::runtime_error("Car with id " + record.id + " already exists");
+        }
+        flush();
+    }
+
+    std::vector<CarRecord> listAvailable(size_t limit) const {
+        return repository_.available(limit);
+    }
+
+    // Exactly one of several concurrent callers renting the same car succeeds.
+    bool rentCar(const std::string &carId, const std::string &userId, double &amountDue) {
+        double price = 0;
+        const bool rented = repository_.updateIf(
+            carId,
+            [&](const CarRecord &record) {
+                price = record.pricePerDay;
+                return record.status == CarStatus::Available;
+            },
+            [&](CarRecord &record) {
+                record.status = CarStatus::Rented;
+                record.renterId = userId;
+                record.dueDate = today() + rentalPeriodDays;
+            });
+        if (!rented) {
+            return false;
+        }
+        amountDue = price;
+        return flush();
+    }
+
+    bool returnCar(const std::string &carId) {
+        bool updated = repository_.update(carId, [](CarRecord &record) {
+            record.status = CarStatus::Available;
+            record.renterId.clear();
+            record.dueDate = noDueDate;
+        });
+        if (!updated) {
+            return false;
+        }
+        return flush();
+    }
+
+    // Returns the car only if `userId` has it, recording the condition it came back in.
+    bool returnCar(const std::string &carId, const std::string &userId, CarCondition condition) {
+        const bool returned = repository_.updateIf(
+            carId,
+            [&](const CarRecord &record) {
+                return record.status == CarStatus::Rented && record.renterId == userId;
+            },
+            [&](CarRecord &record) {
+                record.condition = condition;
+                record.status = CarStatus::Available;
+                record.renterId.clear();
+                record.dueDate = noDueDate;
+            });
+        return returned && flush();
+    }
+
+    // All or nothing: every car goes to `userId`, or none does if any is missing or taken.
+    // `amountDue` is the sum of their daily prices.
+    bool rentCars(const std::vector<std::string> &carIds, const std::string &userId, double &amountDue) {
+        auto transaction = repository_.begin();
+        double total = 0;
+        for (const auto &carId : carIds) {
+            transaction.updateIf(
+                carId, [](const CarRecord &record) { return record.status == CarStatus::Available; },
+                [&](CarRecord &record) {
+                    total += record.pricePerDay;
+                    record.status = CarStatus::Rented;
+                    record.renterId = userId;
+                    record.dueDate = today() + rentalPeriodDays;
+                });
+        }
+        if (!transaction.commit()) {
+            return false;
+        }
+        amountDue = total;
+        return flush();
+    }
+
+    // Returns every car in one commit; nothing changes if any id is unknown.
+    bool returnCars(const std::vector<std::string> &carIds) {
+        auto transaction = repository_.begin();
+        for (const auto &carId : carIds) {
+            transaction.update(carId, [](CarRecord &record) {
+                record.status = CarStatus::Available;
+                record.renterId.clear();
+                record.dueDate = noDueDate;
+            });
+        }
+        return transaction.commit() && flush();
+    }
+
+    // Scales every daily price by `factor` (rounded to whole rupees, at least 1) in a single
+    // transaction; returns the number of cars repriced.
+    size_t reprice(double factor) {
+        if (!std::isfinite(factor) || factor <= 0) {
+            throw std::invalid_argument("Price factor must be positive");
+        }
+        size_t repriced = 0;
+        auto transaction = repository_.begin();
+        transaction.updateWhere([](const CarRecord &) { return true; },
+                                [&](CarRecord &record) {
+                                    record.pricePerDay = std::max(1.0, std::round(record.pricePerDay * factor));
+                                    ++repriced;
+                                });
+        transaction.commit();
+        flush();
+        return repriced;
+    }
+
+    // Rented cars stay until they are returned.
+    bool removeCar(const std::string &carId) {
+        const bool removed = repository_.removeIf(carId, [](const CarRecord &record) {
+            return record.status == CarStatus::Available;
+        });
+        return removed && flush();
+    }
+
+    void ingest(const std::vector<CarRecord> &records) {
+        repository_.bulkUpsert(records);
+        flush();
+    }
+
+    void ingest(std::vector<CarRecord> &&records) {
+        repository_.bulkUpsert(std::move(records));
+        flush();
+    }
+
+    size_t totalRecords() const {
+        return repository_.totalRecords();
+    }
+
+    void save() {
+        repository_.compact();
+    }
+
+    // While deferred, mutations stay pending in the repository instead of being flushed one
+    // by one; commit() writes everything pending in a single flush and waits for it, even
+    // when the repository persists in the background.
+    void deferCommits(bool deferred) {
+        deferred_.store(deferred, std::memory_order_relaxed);
+    }
+
+    void commit() {
+        repository_.flush().get();
+    }
+
+private:
+    bool flush() {
+        if (!deferred_.load(std::memory_order_relaxed)) {
+            repository_.flush();
+        }
+        return true;
+    }
+
+    CarRepository &repository_;
+    std::atomic<bool> deferred_{false};
+};
+
+enum class UserRole { Manager, Customer, Employee };
+
+struct UserRecord {
+    std::string name;
+    std::string id;
+    std::string password;
+    // Customer/employee rating (A+ to D); empty for managers.
+    std::string rating;
+};
+
+// The legacy menu's managers.txt / customers.txt / employees.txt, loaded once and indexed
+// by ID. Lines are `name,id,password[,rating]`; when an ID appears twice the first line
+// wins, as it did for the old linear scans. Each mutation rewrites only the affected
+// role's file through TransactionalFileWriter.
+class UserStore {
+public:
+    explicit UserStore(std::string directory = ".") {
+        namespace fs = std::filesystem;
+        for (const auto role : {UserRole::Manager, UserRole::Customer, UserRole::Employee}) {
+            auto &table = tables_[static_cast<size_t>(role)];
+            table.path = (fs::path(directory) / fileName(role)).string();
+            load(table);
+        }
+    }
+
+    static std::string_view fileName(UserRole role) {
+        switch (role) {
+        case UserRole::Manager:
+            return "managers.txt";
+        case UserRole::Customer:
+            return "customers.txt";
+        case UserRole::Employee:
+            return "employees.txt";
+        }
+        return "users.txt";
+    }
+
+    std::optional<UserRecord> find(UserRole role, const std::string &id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto &table = tables_[static_cast<size_t>(role)];
+        const auto it = table.index.find(id);
+        if (it == table.index.end()) {
+            return std::nullopt;
+        }
+        return table.rows[it->second];
+    }
+
+    // False if the ID is already taken for this role.
+    bool add(UserRole role, UserRecord user) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &table = tables_[static_cast<size_t>(role)];
+        if (table.index.count(user.id) > 0) {
+            return false;
+        }
+        table.index.emplace(user.id, table.rows.size());
+        table.rows.push_back(std::move(user));
+        save(table);
+        return true;
+    }
+
+    bool update(UserRole role, const std::string &id, const std::function<void(UserRecord &)> &mutator) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &table = tables_[static_cast<size_t>(role)];
+        const auto it = table.index.find(id);
+        if (it == table.index.end()) {
+            return false;
+        }
+        auto &user = table.rows[it->second];
+        mutator(user);
+        user.id = id;
+        save(table);
+        return true;
+    }
+
+    // Drops every line with this ID.
+    bool remove(UserRole role, const std::string &id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &table = tables_[static_cast<size_t>(role)];
+        if (table.index.count(id) == 0) {
+            return false;
+        }
+        table.rows.erase(std::remove_if(table.rows.begin(), table.rows.end(),
+                                        [&](const UserRecord &user) { return user.id == id; }),
+                         table.rows.end());
+        reindex(table);
+        save(table);
+        return true;
+    }
+
+    size_t size(UserRole role) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tables_[static_cast<size_t>(role)].index.size();
+    }
+
+private:
+    struct Table {
+        std::string path;
+        // File order, duplicates included, so a rewrite keeps every line it read.
+        std::vector<UserRecord> rows;
+        std::unordered_map<std::string, size_t> index;
+    };
+
+    static void load(Table &table) {
+        std::ifstream input(table.path);
+        std::string line;
+        while (std::getline(input, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            std::string_view rest(line);
+            std::array<std::string_view, 4> fields;
+            for (size_t i = 0; i < fields.size() && !rest.empty(); ++i) {
+                const size_t comma = i + 1 < fields.size() ? rest.find(',') : std::string_view::npos;
+                fields[i] = rest.substr(0, comma);
+                rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+            }
+            table.rows.push_back(UserRecord{std::string(fields[0]), std::string(fields[1]), std::string(fields[2]),
+                                            std::string(fields[3])});
+        }
+        reindex(table);
+    }
+
+    static void reindex(Table &table) {
+        table.index.clear();
+        for (size_t i = 0; i < table.rows.size(); ++i) {
+            table.index.emplace(table.rows[i].id, i);
+        }
+    }
+
+    static void save(const Table &table) {
+        TransactionalFileWriter(table.path).writeWith([&](OutputBuffer &out) {
+            for (const auto &user : table.rows) {
+                auto &line = out.line();
+                line += user.name;
+                line += ',';
+                line += user.id;
+                line += ',';
+                line += user.password;
+                if (!user.rating.empty()) {
+                    line += ',';
+                    line += user.rating;
+                }
+                out.endLine();
+            }
+        });
+    }
+
+    mutable std::mutex mutex_;
+    std::array<Table, 3> tables_;
+};
+
+// When BatchProcessor::ingest makes its buffered batches durable. Batches are always
+// merged into the repository as they fill; only the flush to storage is deferred.
+struct CommitPolicy {
+    enum class Mode { EveryBatch, EveryNBatches, Interval, AtEnd };
+
+    Mode mode{Mode::AtEnd};
+    size_t batches{1};
+    std::chrono::milliseconds interval{0};
+
+    static CommitPolicy everyBatch() { return {Mode::EveryBatch, 1, std::chrono::milliseconds(0)}; }
+    static CommitPolicy everyNBatches(size_t count) {
+        if (count == 0) {
+            throw std::invalid_argument("commit batch count must be greater than zero");
+        }
+        return {Mode::EveryNBatches, count, std::chrono::milliseconds(0)};
+    }
+    static CommitPolicy every(std::chrono::milliseconds interval) { return {Mode::Interval, 1, interval}; }
+    static CommitPolicy atEnd() { return {Mode::AtEnd, 1, std::chrono::milliseconds(0)}; }
+
+    // Accepts "batch", "end", a batch count ("8") or an interval ("250ms").
+    static CommitPolicy parse(const std::string &text) {
+        if (text == "batch") {
+            return everyBatch();
+        }
+        if (text == "end") {
+            return atEnd();
+        }
+        if (text.size() > 2 && text.compare(text.size() - 2, 2, "ms") == 0) {
+            return every(std::chrono::milliseconds(std::stoll(text.substr(0, text.size() - 2))));
+        }
+        return everyNBatches(static_cast<size_t>(std::stoul(text)));
+    }
+};
+
+struct IngestOptions {
+    size_t chunkSize{4096};
+    size_t threads{1};
+    CommitPolicy commit{};
+    // Continue after the last commit recorded in the input's checkpoint file.
+    bool resume{false};
+    // Where rejected lines go; unset uses QuarantineFile::pathFor(input) and an empty path
+    // reports them on stderr instead.
+    std::optional<std::string> quarantinePath;
+    // Abort once more than this share of the lines read so far has been rejected. The
+    // check starts after budgetMinLines lines so a bad first line cannot trip it.
+    std::optional<double> maxRejectRate;
+    size_t budgetMinLines{1000};
+    // Sorted merges an id-sorted input straight into the backend's snapshot in one pass
+    // instead of batching it through the repository; Detect reads the input once to check
+    // its order first. Both fall back to batching when the backend cannot merge.
+    enum class Order { Unsorted, Sorted, Detect };
+    Order order{Order::Unsorted};
+};
+
+// Buffered sink for the lines an ingest rejected, one tab-separated row per line:
+//   <line number>\t<byte offset>\t<reason>\t<original line>
+// The file is only created once something is rejected.
+class QuarantineFile {
+public:
+    // The file is only created by the first rejection, so a fresh (not appending) run
+    // removes the previous run's file up front rather than leave its rejects looking current.
+    QuarantineFile(std::string path, bool append) : path_(std::move(path)), append_(append) {
+        if (!append_) {
+            std::error_code ignored;
+            std::filesystem::remove(path_, ignored);
+        }
+    }
+
+    ~QuarantineFile() {
+        try {
+            close();
+        } catch (const std::exception &ex) {
+            std::cerr << "[WARN] Unable to write quarantine file " << path_ << ": " << ex.what() << std::endl;
+        }
+    }
+
+    QuarantineFile(const QuarantineFile &) = delete;
+    QuarantineFile &operator=(const QuarantineFile &) = delete;
+
+    static std::string pathFor(const std::string &input) {
+        return (input == "-" ? std::string("stdin") : input) + ".quarantine";
+    }
+
+    void add(size_t line, size_t offset, std::string_view reason, std::string_view text) {
+        if (!buffer_) {
+            file_.emplace(path_, O_WRONLY | O_CREAT | (append_ ? O_APPEND : O_TRUNC));
+            buffer_.emplace(*file_, 1 << 16);
+        }
+        auto &out = buffer_->line();
+        out += std::to_string(line);
+        out += '\t';
+        out += std::to_string(offset);
+        out += '\t';
+        out += reason;
+        out += '\t';
+        out += text;
+        buffer_->endLine();
+        ++count_;
+    }
+
+    void close() {
+        if (buffer_) {
+            buffer_->drain();
+            buffer_.reset();
+            file_->close();
+            file_.reset();
+        }
+    }
+
+    const std::string &path() const { return path_; }
+    size_t count() const { return count_; }
+
+private:
+    std::string path_;
+    bool append_;
+    std::optional<FileDescriptor> file_;
+    std::optional<OutputBuffer> buffer_;
+    size_t count_{0};
+};
+
+// Records how far into an ingest input the repository is known to be durable. It is
+// rewritten after every intermediate commit and removed once the ingest completes, so a
+// crashed run can be resumed without re-reading (or losing) anything.
+struct IngestCheckpoint {
+    std::uintmax_t inputSize{0};
+    long long inputModified{0};
+    size_t offset{0};
+
+    static std::string pathFor(const std::string &input) { return input + ".checkpoint"; }
+
+    static IngestCheckpoint forInput(const std::string &input) {
+        namespace fs = std::filesystem;
+        IngestCheckpoint checkpoint;
+        checkpoint.inputSize = fs::file_size(input);
+        checkpoint.inputModified = static_cast<long long>(fs::last_write_time(input).time_since_epoch().count());
+        return checkpoint;
+    }
+
+    // Returns the saved checkpoint only if it was written for the input as it is now.
+    static std::optional<IngestCheckpoint> load(const std::string &input) {
+        std::ifstream file(pathFor(input));
+        std::string tag;
+        IngestCheckpoint saved;
+        if (!(file >> tag >> saved.inputSize >> saved.inputModified >> saved.offset) || tag != "car-ingest-checkpoint") {
+            return std::nullopt;
+        }
+        const auto current = forInput(input);
+        if (saved.inputSize != current.inputSize || saved.inputModified != current.inputModified ||
+            saved.offset > saved.inputSize) {
+            return std::nullopt;
+        }
+        return saved;
+    }
+
+    void save(const std::string &input) const {
+        std::ostringstream oss;
+        oss << "car-ingest-checkpoint " << inputSize << ' ' << inputModified << ' ' << offset;
+        TransactionalFileWriter(pathFor(input)).write({oss.str()});
+    }
+};
+
+struct BatchMetrics {
+    size_t processedRecords{0};
+    size_t batches{0};
+    std::chrono::milliseconds duration{0};
+    size_t threads{1};
+    size_t commits{0};
+    // Bytes of input skipped because a checkpoint showed them already committed.
+    size_t resumedOffset{0};
+    size_t rejectedRecords{0};
+    // Set when rejected lines were written to a quarantine file.
+    std::string quarantinePath;
+    // Per-stage breakdown. parseTime is summed across workers, so in parallel mode
+    // parseTime / threads approximates its wall-clock share; waitTime is how long the
+    // merging thread sat idle waiting for the next range to be parsed.
+    std::chrono::milliseconds parseTime{0};
+    std::chrono::milliseconds mergeTime{0};
+    std::chrono::milliseconds flushTime{0};
+    std::chrono::milliseconds waitTime{0};
+    // Set when the input was merged into the snapshot rather than batched.
+    std::optional<MergeStats> merge;
+};
+
+class BatchProcessor {
+public:
+    BatchProcessor(CarRepository &repository, std::shared_ptr<CarRecordValidator> validator)
+        : repository_(repository), validator_(std::move(validator)) {}
+
+    BatchMetrics ingest(const std::string &path, size_t chunkSize, size_t threads = 1) {
+        IngestOptions options;
+        options.chunkSize = chunkSize;
+        options.threads = threads;
+        return ingest(path, options);
+    }
+
+    // With threads > 1 a mappable input is split into newline-aligned ranges that are
+    // parsed on a worker pool; ranges are merged in file order, so duplicate ids keep
+    // last-writer-wins semantics. Pipes and stdin always ingest sequentially and are
+    // never checkpointed since they cannot be re-read. Exceeding the error budget throws;
+    // batches committed before that stay committed.
+    BatchMetrics ingest(const std::string &path, const IngestOptions &options) {
+        if (options.chunkSize == 0) {
+            throw std::invalid_argument("chunkSize must be greater than zero");
+        }
+        if (options.threads == 0) {
+            throw std::invalid_argument("threads must be greater than zero");
+        }
+        if (options.order != IngestOptions::Order::Unsorted) {
+            if (options.threads > 1 || options.resume || options.commit.mode != CommitPolicy::Mode::AtEnd) {
+                throw std::invalid_argument(
+                    "a sorted ingest merges in one pass and commits once; threads, commit policies and resume do not apply");
+            }
+            if (options.order == IngestOptions::Order::Sorted || sortedById(path)) {
+                if (auto merged = ingestSorted(path, options)) {
+                    return *merged;
+                }
+            }
+        }
+
+        const std::string quarantinePath = options.quarantinePath.value_or(QuarantineFile::pathFor(path));
+        Run run(options);
+        if (!quarantinePath.empty()) {
+            // Only a run that actually picks up a checkpoint adds to the earlier rejects.
+            run.quarantine.emplace(quarantinePath, options.resume && IngestCheckpoint::load(path).has_value());
+        }
+        const auto start = Clock::now();
+        run.lastCommit = start;
+        CarFilePipeline pipeline(path, validator_);
+
+        std::optional<MappedFile> mapped;
+        if (path != "-" && std::filesystem::exists(path)) {
+            mapped.emplace(path);
+        }
+
+        if (mapped && mapped->mapped()) {
+            run.checkpointPath = path;
+            run.checkpoint = IngestCheckpoint::forInput(path);
+            if (options.resume) {
+                if (const auto saved = IngestCheckpoint::load(path)) {
+                    run.checkpoint->offset = saved->offset;
+                    run.metrics.resumedOffset = saved->offset;
+                }
+            }
+
+            const size_t base = run.metrics.resumedOffset;
+            const auto view = mapped->view();
+            const auto data = view.substr(base);
+            if (base > 0) {
+                run.lineBase = static_cast<size_t>(std::count(view.begin(), view.begin() + base, '\n'));
+            }
+            if (options.threads > 1) {
+                run.metrics.threads = options.threads;
+                ingestParallel(pipeline, data, base, run);
+            } else {
+                pipeline.scanWithOffsets(data, [&](CarRecord &&record, size_t lineEnd) {
+                    add(run, std::move(record), base + lineEnd);
+                }, [&](const LineRejection &rejection) {
+                    reject(run, rejection, base);
+                    checkBudget(run, 0);
+                });
+            }
+        } else {
+            pipeline.stream([&](CarRecord &&record) {
+                add(run, std::move(record), 0);
+            }, nullptr, [&](const LineRejection &rejection) {
+                reject(run, rejection, 0);
+                checkBudget(run, 0);
+            });
         }
-        return it->second;
+        finish(run);
+
+        auto &metrics = run.metrics;
+        if (metrics.threads == 1) {
+            run.times.parse = Clock::now() - start - run.times.merge - run.times.flush;
+        }
+        metrics.duration = toMillis(Clock::now() - start);
+        metrics.parseTime = toMillis(run.times.parse);
+        metrics.mergeTime = toMillis(run.times.merge);
+        metrics.flushTime = toMillis(run.times.flush);
+        metrics.waitTime = toMillis(run.times.wait);
+        return metrics;
     }
 
-    bool upsert(const CarRecord &record) {
-        records_[record.id] = record;
-        dirty_ = true;
-        return true;
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct StageTimes {
+        Clock::duration parse{};
+        Clock::duration merge{};
+        Clock::duration flush{};
+        Clock::duration wait{};
+    };
+
+    struct Run {
+        explicit Run(const IngestOptions &opts) : options(opts) { buffer.reserve(opts.chunkSize); }
+
+        const IngestOptions &options;
+        BatchMetrics metrics;
+        StageTimes times;
+        std::vector<CarRecord> buffer;
+        Clock::time_point lastCommit;
+        size_t uncommittedBatches{0};
+        size_t lastOffset{0};
+        std::string checkpointPath;
+        std::optional<IngestCheckpoint> checkpoint;
+        std::optional<QuarantineFile> quarantine;
+        // Lines before the data being scanned (skipped by a resume or earlier ranges).
+        size_t lineBase{0};
+    };
+
+    struct ParsedRange {
+        std::vector<CarRecord> records;
+        std::vector<size_t> lineEnds;
+        // Line numbers and offsets are relative to the range; `text` points into the mapping.
+        std::vector<LineRejection> rejections;
+        size_t lines{0};
+        Clock::duration parseTime{};
+        std::exception_ptr error;
+        bool ready{false};
+    };
+
+    static std::chrono::milliseconds toMillis(Clock::duration value) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(value);
     }
 
-    bool update(const std::string &id, const std::function<void(CarRecord &)> &mutator) {
-        auto it = records_.find(id);
-        if (it == records_.end()) {
-            return false;
+    void add(Run &run, CarRecord &&record, size_t lineEnd) {
+        run.buffer.emplace_back(std::move(record));
+        run.lastOffset = lineEnd;
+        ++run.metrics.processedRecords;
+        if (run.buffer.size() >= run.options.chunkSize) {
+            completeBatch(run);
         }
-        mutator(it->second);
-        dirty_ = true;
-        return true;
     }
 
-    void bulkUpsert(const std::vector<CarRecord> &records) {
-        for (const auto &record : records) {
-            records_[record.id] = record;
+    // `base` is the byte offset of the scanned data within the input.
+    static void reject(Run &run, const LineRejection &rejection, size_t base) {
+        ++run.metrics.rejectedRecords;
+        const size_t line = run.lineBase + rejection.line;
+        if (run.quarantine) {
+            run.quarantine->add(line, base + rejection.offset, toString(rejection.error), rejection.text);
+        } else {
+            std::cerr << "[WARN] Skipping line " << line << ": " << toString(rejection.error) << ": " << rejection.text
+                      << '\n';
         }
-        dirty_ = dirty_ || !records.empty();
     }
 
-    void flush() {
-        if (!dirty_) {
+    // `unmerged` counts parsed records not yet passed to add(), so a parallel range can be
+    // checked before any of its records reach the repository.
+    static void checkBudget(const Run &run, size_t unmerged) {
+        const auto &options = run.options;
+        const size_t rejected = run.metrics.rejectedRecords;
+        const size_t lines = run.metrics.processedRecords + unmerged + rejected;
+        if (!options.maxRejectRate || lines < options.budgetMinLines ||
+            static_cast<double>(rejected) <= *options.maxRejectRate * static_cast<double>(lines)) {
             return;
         }
-        backend_->persistCars(all());
-        dirty_ = false;
+        std::ostringstream oss;
+        oss << "Ingest aborted: " << rejected << " of " << lines << " lines rejected, over the "
+            << *options.maxRejectRate * 100 << "% error budget";
+        if (run.quarantine) {
+            oss << " (see " << run.quarantine->path() << ")";
+        }
+        throw std::runtime_error(oss.str());
     }
 
-    size_t totalRecords() const {
-        return records_.size();
+    void completeBatch(Run &run) {
+        const auto mergeStart = Clock::now();
+        repository_.bulkUpsert(std::move(run.buffer));
+        run.times.merge += Clock::now() - mergeStart;
+        run.buffer.clear();
+        ++run.metrics.batches;
+        ++run.uncommittedBatches;
+
+        const auto &policy = run.options.commit;
+        bool due = false;
+        switch (policy.mode) {
+        case CommitPolicy::Mode::EveryBatch:
+            due = true;
+            break;
+        case CommitPolicy::Mode::EveryNBatches:
+            due = run.uncommittedBatches >= policy.batches;
+            break;
+        case CommitPolicy::Mode::Interval:
+            due = Clock::now() - run.lastCommit >= policy.interval;
+            break;
+        case CommitPolicy::Mode::AtEnd:
+            break;
+        }
+        if (due) {
+            commit(run);
+            if (run.checkpoint) {
+                run.checkpoint->offset = run.lastOffset;
+                run.checkpoint->save(run.checkpointPath);
+            }
+        }
     }
 
-    bool pendingChanges() const {
-        return dirty_;
+    // Waits for durability even with background persistence: the checkpoint saved after a
+    // commit must never point past records that could still be lost.
+    void commit(Run &run) {
+        const auto flushStart = Clock::now();
+        repository_.flush().get();
+        run.times.flush += Clock::now() - flushStart;
+        run.lastCommit = Clock::now();
+        run.uncommittedBatches = 0;
+        ++run.metrics.commits;
     }
 
-private:
-    std::shared_ptr<StorageBackend> backend_;
-    std::unordered_map<std::string, CarRecord> records_;
-    bool dirty_{false};
-};
-
-class RentalService {
-public:
-    explicit RentalService(CarRepository &repository)
-        : repository_(repository) {}
-
-    void addCar(const CarRecord &record) {
-        if (repository_.find(record.id).has_value()) {
-            throw std::runtime_error("Car with id " + record.id + " already exists");
+    void finish(Run &run) {
+        if (!run.buffer.empty()) {
+            completeBatch(run);
         }
-        repository_.upsert(record);
-        repository_.flush();
-    }
-
-    std::vector<CarRecord> listAvailable(size_t limit) const {
-        auto cars = repository_.available();
-        if (cars.size() > limit) {
-            cars.resize(limit);
+        if (run.uncommittedBatches > 0) {
+            commit(run);
+        }
+        if (run.checkpoint) {
+            std::error_code ignored;
+            std::filesystem::remove(IngestCheckpoint::pathFor(run.checkpointPath), ignored);
+        }
+        if (run.quarantine) {
+            run.quarantine->close();
+            if (run.quarantine->count() > 0) {
+                run.metrics.quarantinePath = run.quarantine->path();
+            }
         }
-        return cars;
     }
 
-    bool rentCar(const std::string &carId, const std::string &userId, double &amountDue) {
-        auto existing = repository_.find(carId);
-        if (!existing.has_value()) {
+    // Stdin cannot be read twice, so it never counts as sorted. Lines that do not parse are
+    // left for the ingest itself to report.
+    bool sortedById(const std::string &path) const {
+        if (path == "-") {
             return false;
         }
-        if (existing->status != "Available") {
-            return false;
+        CarRecordReader reader(path, validator_, [](const LineRejection &) {});
+        CarRecord record;
+        std::string last;
+        while (reader.next(record)) {
+            if (reader.records() > 1 && record.id < last) {
+                return false;
+            }
+            last = std::move(record.id);
         }
-
-        amountDue = existing->pricePerDay;
-        return repository_.update(carId, [&](CarRecord &record) {
-            record.status = "Rented by the user ID: " + userId;
-        }) && flush();
+        return true;
     }
 
-    bool returnCar(const std::string &carId) {
-        bool updated = repository_.update(carId, [](CarRecord &record) {
-            record.status = "Available";
+    // Unset when the backend cannot merge, leaving the input to the batched path.
+    std::optional<BatchMetrics> ingestSorted(const std::string &path, const IngestOptions &options) {
+        const std::string quarantinePath = options.quarantinePath.value_or(QuarantineFile::pathFor(path));
+        Run run(options);
+        if (!quarantinePath.empty()) {
+            run.quarantine.emplace(quarantinePath, false);
+        }
+        const auto start = Clock::now();
+        auto merged = repository_.mergeSorted(path, [&](const LineRejection &rejection) {
+            reject(run, rejection, 0);
+            run.metrics.processedRecords = rejection.line - run.metrics.rejectedRecords;
+            checkBudget(run, 0);
         });
-        if (!updated) {
-            return false;
+        if (!merged) {
+            return std::nullopt;
         }
-        return flush();
-    }
-
-    void ingest(const std::vector<CarRecord> &records) {
-        repository_.bulkUpsert(records);
-        repository_.flush();
-    }
-
-    size_t totalRecords() const {
-        return repository_.totalRecords();
-    }
-
-    void save() {
-        repository_.flush();
+        if (run.quarantine) {
+            run.quarantine->close();
+            if (run.quarantine->count() > 0) {
+                run.metrics.quarantinePath = run.quarantine->path();
+            }
+        }
+        auto &metrics = run.metrics;
+        metrics.processedRecords = merged->inputRecords;
+        metrics.commits = 1;
+        metrics.duration = toMillis(Clock::now() - start);
+        metrics.mergeTime = metrics.duration;
+        metrics.merge = std::move(merged);
+        return metrics;
     }
 
-private:
-    bool flush() {
-        repository_.flush();
-        return true;
+    // Cuts `data` into roughly `count` ranges, each ending just after a newline.
+    static std::vector<std::string_view> splitLines(std::string_view data, size_t count) {
+        std::vector<std::string_view> ranges;
+        size_t begin = 0;
+        for (size_t i = 1; i <= count && begin < data.size(); ++i) {
+            size_t end = data.size();
+            if (i < count) {
+                const size_t target = std::max(begin, data.size() / count * i);
+                const size_t newline = data.find('\n', target);
+                end = newline == std::string_view::npos ? data.size() : newline + 1;
+            }
+            ranges.push_back(data.substr(begin, end - begin));
+            begin = end;
+        }
+        return ranges;
     }
 
-    CarRepository &repository_;
-};
-
-struct BatchMetrics {
-    size_t processedRecords{0};
-    size_t batches{0};
-    std::chrono::milliseconds duration{0};
-};
-
-class BatchProcessor {
-public:
-    BatchProcessor(CarRepository &repository, std::shared_ptr<CarRecordValidator> validator)
-        : repository_(repository), validator_(std::move(validator)) {}
+    void ingestParallel(const CarFilePipeline &pipeline, std::string_view data, size_t base, Run &run) {
+        const size_t threads = run.options.threads;
+        const auto ranges = splitLines(data, threads * 8);
+        std::vector<ParsedRange> parsed(ranges.size());
+        std::mutex mutex;
+        std::condition_variable rangeReady;
+        std::atomic<size_t> next{0};
+
+        auto worker = [&] {
+            for (size_t index = next.fetch_add(1); index < ranges.size(); index = next.fetch_add(1)) {
+                ParsedRange result;
+                const size_t rangeBase = base + static_cast<size_t>(ranges[index].data() - data.data());
+                const auto parseStart = Clock::now();
+                try {
+                    result.lines = pipeline.scanWithOffsets(ranges[index], [&](CarRecord &&record, size_t lineEnd) {
+                        result.records.emplace_back(std::move(record));
+                        result.lineEnds.push_back(rangeBase + lineEnd);
+                    }, [&](const LineRejection &rejection) {
+                        result.rejections.push_back(rejection);
+                        result.rejections.back().offset += rangeBase;
+                    });
+                } catch (...) {
+                    result.error = std::current_exception();
+                }
+                result.parseTime = Clock::now() - parseStart;
+                result.ready = true;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    parsed[index] = std::move(result);
+                }
+                rangeReady.notify_all();
+            }
+        };
 
-    BatchMetrics ingest(const std::string &path, size_t chunkSize) {
-        if (chunkSize == 0) {
-            throw std::invalid_argument("chunkSize must be greater than zero");
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker);
         }
 
-        BatchMetrics metrics;
-        const auto start = std::chrono::steady_clock::now();
-        CarFilePipeline pipeline(path, validator_);
-        std::vector<CarRecord> buffer;
-        buffer.reserve(chunkSize);
+        std::exception_ptr failure;
+        try {
+            for (size_t index = 0; index < parsed.size(); ++index) {
+                ParsedRange range;
+                {
+                    const auto waitStart = Clock::now();
+                    std::unique_lock<std::mutex> lock(mutex);
+                    rangeReady.wait(lock, [&] { return parsed[index].ready; });
+                    run.times.wait += Clock::now() - waitStart;
+                    range = std::move(parsed[index]);
+                }
+                if (range.error) {
+                    std::rethrow_exception(range.error);
+                }
+                run.times.parse += range.parseTime;
 
-        pipeline.stream([&](CarRecord &&record) {
-            buffer.emplace_back(std::move(record));
-            ++metrics.processedRecords;
-            if (buffer.size() >= chunkSize) {
-                repository_.bulkUpsert(buffer);
-                repository_.flush();
-                buffer.clear();
-                ++metrics.batches;
+                for (const auto &rejection : range.rejections) {
+                    reject(run, rejection, 0);
+                }
+                checkBudget(run, range.records.size());
+                run.lineBase += range.lines;
+                for (size_t i = 0; i < range.records.size(); ++i) {
+                    add(run, std::move(range.records[i]), range.lineEnds[i]);
+                }
             }
-        });
-
-        if (!buffer.empty()) {
-            repository_.bulkUpsert(buffer);
-            repository_.flush();
-            buffer.clear();
-            ++metrics.batches;
+        } catch (...) {
+            failure = std::current_exception();
+            next = ranges.size();
         }
 
-        const auto end = std::chrono::steady_clock::now();
-        metrics.duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-        return metrics;
+        for (auto &thread : workers) {
+            thread.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
     }
 
-private:
     CarRepository &repository_;
     std::shared_ptr<CarRecordValidator> validator_;
 };
 
+// Shape of a synthetic fleet. With a fixed seed the output is identical for any thread
+// count, so capacity runs can be reproduced exactly.
+struct GeneratorOptions {
+    // Unset draws a fresh seed from std::random_device.
+    std::optional<std::uint64_t> seed;
+    size_t threads{1};
+    // Share of records written as rented, each to one of `renters` users.
+    double rentedFraction{0.0};
+    size_t renters{1000};
+    // Share of records that reuse an earlier record's id, exercising last-writer-wins.
+    double duplicateFraction{0.0};
+};
+
 class SyntheticDatasetGenerator {
 public:
     explicit SyntheticDatasetGenerator(std::shared_ptr<CarRecordValidator> validator)
-        : validator_(std::move(validator)) {}
+        : validator_(std::move(validator)), models_{ "Atlas", "Falcon", "Nimbus", "Aurora", "Vertex" } {}
 
-    std::vector<CarRecord> generate(size_t count) const {
+    std::vector<CarRecord> generate(size_t count, const GeneratorOptions &options = {}) const {
         std::vector<CarRecord> records;
         records.reserve(count);
-        std::mt19937 rng(std::random_device{}());
-        std::uniform_real_distribution<double> priceDist(1800.0, 7500.0);
-        std::vector<std::string> conditions{ "excellent", "good", "fair", "minordamages", "majordamages" };
-        std::vector<std::string> models{ "Atlas", "Falcon", "Nimbus", "Aurora", "Vertex" };
-
-        for (size_t i = 0; i < count; ++i) {
-            CarRecord record;
-            record.id = "car-" + std::to_string(i + 1);
-            record.model = models[i % models.size()];
-            record.condition = conditions[i % conditions.size()];
-            record.pricePerDay = std::round(priceDist(rng));
-            records.emplace_back(std::move(record));
+        const std::uint64_t seed = resolveSeed(options);
+        for (size_t block = 0; block * blockSize < count; ++block) {
+            generateBlock(seed, options, block, count, [&records](CarRecord &&record) {
+                records.emplace_back(std::move(record));
+            });
         }
         return records;
     }
 
-    void toFile(const std::string &path, size_t count) const {
-        auto records = generate(count);
-        CarFilePipeline pipeline(path, validator_);
-        pipeline.writeAll(records);
+    // Streams the records into `path` block by block: up to `threads` blocks are formatted
+    // in parallel and appended in order, so memory stays at threads * blockSize records
+    // whatever the count. Returns the seed used.
+    std::uint64_t toFile(const std::string &path, size_t count, const GeneratorOptions &options = {}) const {
+        const std::uint64_t seed = resolveSeed(options);
+        const size_t threads = std::max<size_t>(1, options.threads);
+        const size_t blocks = (count + blockSize - 1) / blockSize;
+        const CarRecordParser parser(validator_);
+
+        TransactionalFileWriter(path).writeWith([&](OutputBuffer &out) {
+            std::vector<std::string> texts(std::min(threads, std::max<size_t>(blocks, 1)));
+            std::vector<std::exception_ptr> errors(texts.size());
+            const auto format = [&](size_t block, size_t slot) {
+                try {
+                    auto &text = texts[slot];
+                    text.clear();
+                    generateBlock(seed, options, block, count, [&](CarRecord &&record) {
+                        parser.appendTo(record, text);
+                        text += '\n';
+                    });
+                } catch (...) {
+                    errors[slot] = std::current_exception();
+                }
+            };
+
+            for (size_t first = 0; first < blocks; first += texts.size()) {
+                const size_t round = std::min(texts.size(), blocks - first);
+                std::vector<std::thread> workers;
+                for (size_t slot = 1; slot < round; ++slot) {
+                    workers.emplace_back(format, first + slot, slot);
+                }
+                format(first, 0);
+                for (auto &worker : workers) {
+                    worker.join();
+                }
+                for (size_t slot = 0; slot < round; ++slot) {
+                    if (errors[slot]) {
+                        std::rethrow_exception(errors[slot]);
+                    }
+                    out.append(texts[slot]);
+                }
+            }
+        });
+        return seed;
     }
 
 private:
+    static constexpr size_t blockSize = 16384;
+    // Ids are zero-padded so a generated file is already in id order for `ingest --sorted`;
+    // eight digits keep car n's id the same across fleets of up to 10^8 cars.
+    static constexpr size_t minIdDigits = 8;
+
+    static std::string idOf(size_t number, size_t width) {
+        const std::string digits = std::to_string(number);
+        return "car-" + std::string(width - std::min(width, digits.size()), '0') + digits;
+    }
+
+    // splitmix64: tiny, fast and identical on every platform, unlike the std distributions.
+    struct SplitMix64 {
+        std::uint64_t state;
+
+        std::uint64_t next() {
+            std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+        // Uniform in [0, 1).
+        double unit() { return static_cast<double>(next() >> 11) * 0x1.0p-53; }
+        // Uniform in [0, bound).
+        std::uint64_t below(std::uint64_t bound) { return static_cast<std::uint64_t>(unit() * static_cast<double>(bound)); }
+    };
+
+    static std::uint64_t resolveSeed(const GeneratorOptions &options) {
+        if (options.seed) {
+            return *options.seed;
+        }
+        std::random_device device;
+        return (static_cast<std::uint64_t>(device()) << 32) ^ device();
+    }
+
+    // Each block draws from its own stream derived from (seed, block), which is what makes
+    // the output independent of how blocks are spread over threads.
+    template <typename Visit>
+    void generateBlock(std::uint64_t seed, const GeneratorOptions &options, size_t block, size_t count,
+                       Visit &&visit) const {
+        SplitMix64 blockSeed{seed ^ (0xD1B54A32D192ED03ULL * (block + 1))};
+        SplitMix64 rng{blockSeed.next()};
+        const size_t begin = block * blockSize;
+        const size_t end = std::min(count, begin + blockSize);
+        const size_t width = std::max(minIdDigits, std::to_string(count).size());
+        for (size_t i = begin; i < end; ++i) {
+            CarRecord record;
+            size_t number = i + 1;
+            if (options.duplicateFraction > 0 && i > 0 && rng.unit() < options.duplicateFraction) {
+                number = 1 + rng.below(i);
+            }
+            record.id = idOf(number, width);
+            record.model = models_[i % models_.size()];
+            record.condition = static_cast<CarCondition>(i % conditionNames.size());
+            record.pricePerDay = std::round(1800.0 + rng.unit() * 5700.0);
+            if (options.rentedFraction > 0 && rng.unit() < options.rentedFraction) {
+                record.status = CarStatus::Rented;
+                record.renterId = "user-" + std::to_string(1 + rng.below(std::max<size_t>(1, options.renters)));
+            }
+            visit(std::move(record));
+        }
+    }
+
     std::shared_ptr<CarRecordValidator> validator_;
+    std::vector<InternedString> models_;
 };
 
 struct CommandContext {
@@ -524,6 +5671,7 @@ struct CommandContext {
     BatchProcessor &batchProcessor;
     CarRepository &repository;
     std::string backendName;
+    std::shared_ptr<CarRecordValidator> validator;
 };
 
 class CLICommand {
@@ -532,7 +5680,9 @@ public:
         : description_(std::move(description)) {}
     virtual ~CLICommand() = default;
     const std::string &description() const { return description_; }
-    virtual void execute(const std::vector<std::string> &args) = 0;
+    // Output goes to `out` so the same commands serve the terminal and network sessions;
+    // failures are reported by throwing.
+    virtual void execute(const std::vector<std::string> &args, std::ostream &out) = 0;
 
 protected:
     std::string description_;
@@ -560,35 +5710,178 @@ public:
         return list;
     }
 
+    enum class Dispatch { Done, Empty, Exit, UnknownCommand };
+
+    // Runs one command line (including the built-in help/exit) against `out`. Exceptions
+    // thrown by the command propagate to the caller.
+    Dispatch dispatch(const std::string &line, std::ostream &out) const {
+        auto tokens = tokenize(line);
+        if (tokens.empty()) {
+            return Dispatch::Empty;
+        }
+        if (tokens.front() == "exit") {
+            return Dispatch::Exit;
+        }
+        if (tokens.front() == "help") {
+            printHelp(out);
+            return Dispatch::Done;
+        }
+
+        CLICommand *command = find(tokens.front());
+        if (!command) {
+            return Dispatch::UnknownCommand;
+        }
+        const ScopedTimer timer(MetricsRegistry::instance().histogram("command." + tokens.front()));
+        tokens.erase(tokens.begin());
+        command->execute(tokens, out);
+        return Dispatch::Done;
+    }
+
+    void printHelp(std::ostream &out) const {
+        out << "Available commands:" << std::endl;
+        for (const auto &[name, description] : descriptions()) {
+            out << "  " << name << " - " << description << std::endl;
+        }
+        out << "  help - Show this list" << std::endl;
+        out << "  exit - Quit the CLI" << std::endl;
+    }
+
+    static std::vector<std::string> tokenize(const std::string &line) {
+        std::istringstream iss(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (iss >> token) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
 private:
     std::map<std::string, std::unique_ptr<CLICommand>> commands_;
 };
 
+inline void writeCarLine(std::ostream &out, const CarRecord &car) {
+    out << car.id << " (" << car.model << ") - condition " << toString(car.condition) << ", price "
+        << car.pricePerDay << ", status: " << statusText(car) << '\n';
+}
+
 class ListCarsCommand : public CLICommand {
 public:
     explicit ListCarsCommand(CommandContext &ctx)
         : CLICommand("List the top N available cars"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
-        size_t limit = 10;
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        CarQuery query;
+        query.status = CarStatus::Available;
+        query.limit = 10;
         if (!args.empty()) {
-            limit = static_cast<size_t>(std::stoul(args[0]));
+            query.limit = static_cast<size_t>(std::stoul(args[0]));
         }
 
-        const auto cars = ctx_.service.listAvailable(limit);
+        const auto cars = ctx_.repository.query(query);
         if (cars.empty()) {
-            std::cout << "No cars available." << std::endl;
+            out << "No cars available." << std::endl;
             return;
         }
 
         for (const auto &car : cars) {
-            std::cout << car.id << " (" << car.model << ") - condition "
-                      << car.condition << ", price " << car.pricePerDay
-                      << ", status: " << car.status << std::endl;
+            writeCarLine(out, *car);
+        }
+        out.flush();
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+// overdue [YYYY-MM-DD]: every car still rented past its due date as of that day (default
+// today) and the fine it has run up, earliest due first.
+class OverdueCommand : public CLICommand {
+public:
+    explicit OverdueCommand(CommandContext &ctx)
+        : CLICommand("List overdue rentals and their fines"), ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        std::int32_t asOf = today();
+        if (args.size() > 1 || (args.size() == 1 && !parseDate(args[0]))) {
+            throw std::runtime_error("Usage: overdue [YYYY-MM-DD]");
+        }
+        if (!args.empty()) {
+            asOf = *parseDate(args[0]);
+        }
+
+        long long total = 0;
+        const auto late = ctx_.repository.dueBefore(asOf);
+        for (const auto &car : late) {
+            const int fine = fineAsOf(car, asOf);
+            total += fine;
+            out << car.id << " (" << car.model.str() << ") rented by " << car.renterId << ", due "
+                << formatDate(car.dueDate) << ": " << asOf - car.dueDate << " days late, fine " << fine << '\n';
+        }
+        out << late.size() << " overdue cars, " << total << " in fines as of " << formatDate(asOf) << "."
+            << std::endl;
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+// query [status=available|rented] [condition=<c>] [model=<m>] [renter=<id>] [min=<price>]
+//       [max=<price>] [order=id|price|-price] [limit=N]
+class QueryCommand : public CLICommand {
+public:
+    explicit QueryCommand(CommandContext &ctx)
+        : CLICommand("Filter and order cars: status= condition= model= renter= min= max= order= limit="),
+          ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        CarQuery query;
+        query.limit = 10;
+        for (const auto &arg : args) {
+            const size_t equals = arg.find('=');
+            if (equals == std::string::npos) {
+                throw std::runtime_error(usage);
+            }
+            const std::string key = arg.substr(0, equals);
+            const std::string value = arg.substr(equals + 1);
+            if (key == "status" && (value == "available" || value == "rented")) {
+                query.status = value == "available" ? CarStatus::Available : CarStatus::Rented;
+            } else if (key == "condition") {
+                query.condition = parseCondition(value);
+                if (!query.condition) {
+                    throw std::runtime_error("Unknown condition: " + value);
+                }
+            } else if (key == "model") {
+                query.model = value;
+            } else if (key == "renter") {
+                query.renter = value;
+            } else if (key == "min") {
+                query.minPrice = std::stod(value);
+            } else if (key == "max") {
+                query.maxPrice = std::stod(value);
+            } else if (key == "order" && (value == "id" || value == "price" || value == "-price")) {
+                query.order = value == "id"      ? CarQuery::Order::Id
+                              : value == "price" ? CarQuery::Order::Price
+                                                 : CarQuery::Order::PriceDescending;
+            } else if (key == "limit") {
+                query.limit = static_cast<size_t>(std::stoul(value));
+            } else {
+                throw std::runtime_error(usage);
+            }
+        }
+
+        const auto cars = ctx_.repository.query(query);
+        for (const auto &car : cars) {
+            writeCarLine(out, *car);
         }
+        out << "Listed " << cars.size() << (cars.size() == 1 ? " car." : " cars.") << std::endl;
     }
 
 private:
+    static constexpr const char *usage =
+        "Usage: query [status=available|rented] [condition=<c>] [model=<m>] [renter=<id>] [min=<price>] "
+        "[max=<price>] [order=id|price|-price] [limit=N]";
+
     CommandContext &ctx_;
 };
 
@@ -597,117 +5890,308 @@ public:
     explicit RentCommand(CommandContext &ctx)
         : CLICommand("Rent a car using Strategy pricing"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
         if (args.size() < 2) {
-            throw std::runtime_error("Usage: rent <carId> <userId>");
+            throw std::runtime_error("Usage: rent <carId> [<carId>...] <userId>");
         }
 
         double amount = 0;
+        if (args.size() > 2) {
+            const std::vector<std::string> carIds(args.begin(), args.end() - 1);
+            if (ctx_.service.rentCars(carIds, args.back(), amount)) {
+                out << carIds.size() << " cars reserved. Amount due today: " << amount << " Rs." << std::endl;
+            } else {
+                out << "Unable to rent cars; none were reserved." << std::endl;
+            }
+            return;
+        }
         if (ctx_.service.rentCar(args[0], args[1], amount)) {
-            std::cout << "Car " << args[0] << " reserved. Amount due today: " << amount << " Rs." << std::endl;
+            out << "Car " << args[0] << " reserved. Amount due today: " << amount << " Rs." << std::endl;
+        } else {
+            out << "Unable to rent car " << args[0] << std::endl;
+        }
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+class ReturnCommand : public CLICommand {
+public:
+    explicit ReturnCommand(CommandContext &ctx)
+        : CLICommand("Return a car and close the transaction"), ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.empty()) {
+            throw std::runtime_error("Usage: return <carId> [<carId>...]");
+        }
+
+        if (args.size() > 1) {
+            if (ctx_.service.returnCars(args)) {
+                out << args.size() << " cars returned successfully." << std::endl;
+            } else {
+                out << "Unable to return cars; none were returned." << std::endl;
+            }
+            return;
+        }
+        if (ctx_.service.returnCar(args[0])) {
+            out << "Car " << args[0] << " returned successfully." << std::endl;
+        } else {
+            out << "Unable to return car " << args[0] << std::endl;
+        }
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+class AddCarCommand : public CLICommand {
+public:
+    explicit AddCarCommand(CommandContext &ctx)
+        : CLICommand("Add a new car to the repository"), ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.size() < 4) {
+            throw std::runtime_error("Usage: add <carId> <model> <condition> <price>");
+        }
+
+        CarRecord record;
+        record.id = args[0];
+        const auto condition = parseCondition(args[2]);
+        if (!condition) {
+            throw std::runtime_error("Unknown condition " + args[2]);
+        }
+        record.model = args[1];
+        record.condition = *condition;
+        record.pricePerDay = std::stod(args[3]);
+
+        ctx_.service.addCar(record);
+        out << "Car " << record.id << " added." << std::endl;
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+class RemoveCarCommand : public CLICommand {
+public:
+    explicit RemoveCarCommand(CommandContext &ctx)
+        : CLICommand("Remove an available car from the repository"), ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.size() != 1) {
+            throw std::runtime_error("Usage: remove <carId>");
+        }
+
+        if (ctx_.service.removeCar(args[0])) {
+            out << "Car " << args[0] << " removed." << std::endl;
         } else {
-            std::cout << "Unable to rent car " << args[0] << std::endl;
+            out << "Unable to remove car " << args[0] << std::endl;
+        }
+    }
+
+private:
+    CommandContext &ctx_;
+};
+
+class GenerateCommand : public CLICommand {
+public:
+    explicit GenerateCommand(CommandContext &ctx)
+        : CLICommand("Generate synthetic fleet data"), ctx_(ctx) {}
+
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        std::vector<std::string> positional;
+        GeneratorOptions options;
+        for (const auto &arg : args) {
+            if (arg.rfind("--seed=", 0) == 0) {
+                options.seed = std::stoull(arg.substr(7));
+            } else if (arg.rfind("--threads=", 0) == 0) {
+                options.threads = static_cast<size_t>(std::stoul(arg.substr(10)));
+            } else if (arg.rfind("--rented=", 0) == 0) {
+                options.rentedFraction = fraction(arg.substr(9));
+            } else if (arg.rfind("--renters=", 0) == 0) {
+                options.renters = static_cast<size_t>(std::stoul(arg.substr(10)));
+            } else if (arg.rfind("--duplicates=", 0) == 0) {
+                options.duplicateFraction = fraction(arg.substr(13));
+            } else {
+                positional.push_back(arg);
+            }
         }
+        if (positional.empty() || positional.size() > 2) {
+            throw std::runtime_error("Usage: generate <count> [outputFile] [--seed=S] [--threads=N] "
+                                     "[--rented=F] [--renters=N] [--duplicates=F]");
+        }
+        const size_t count = static_cast<size_t>(std::stoul(positional[0]));
+        const std::string output = positional.size() > 1 ? positional[1] : "synthetic_cars.txt";
+
+        const auto seed = ctx_.generator.toFile(output, count, options);
+        out << "Generated " << count << " synthetic records in " << output << " (seed " << seed << ")" << std::endl;
     }
 
 private:
+    static double fraction(const std::string &text) {
+        const double value = std::stod(text);
+        if (value < 0 || value > 1) {
+            throw std::runtime_error("Expected a fraction between 0 and 1, got " + text);
+        }
+        return value;
+    }
+
     CommandContext &ctx_;
 };
 
-class ReturnCommand : public CLICommand {
+class IngestCommand : public CLICommand {
 public:
-    explicit ReturnCommand(CommandContext &ctx)
-        : CLICommand("Return a car and close the transaction"), ctx_(ctx) {}
+    explicit IngestCommand(CommandContext &ctx)
+        : CLICommand("Ingest large car batches via buffered pipeline"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
-        if (args.size() != 1) {
-            throw std::runtime_error("Usage: return <carId>");
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        std::vector<std::string> positional;
+        IngestOptions options;
+        for (const auto &arg : args) {
+            if (arg.rfind("--threads=", 0) == 0) {
+                options.threads = static_cast<size_t>(std::stoul(arg.substr(10)));
+            } else if (arg.rfind("--commit=", 0) == 0) {
+                options.commit = CommitPolicy::parse(arg.substr(9));
+            } else if (arg == "--resume") {
+                options.resume = true;
+            } else if (arg.rfind("--quarantine=", 0) == 0) {
+                options.quarantinePath = arg.substr(13);
+            } else if (arg.rfind("--max-reject-rate=", 0) == 0) {
+                options.maxRejectRate = std::stod(arg.substr(18));
+            } else if (arg == "--sorted") {
+                options.order = IngestOptions::Order::Sorted;
+            } else if (arg == "--sorted=auto") {
+                options.order = IngestOptions::Order::Detect;
+            } else {
+                positional.push_back(arg);
+            }
+        }
+        if (positional.empty()) {
+            throw std::runtime_error(
+                "Usage: ingest <file> [chunkSize] [--threads=N] [--commit=batch|end|<batches>|<ms>ms] [--resume] "
+                "[--quarantine=<file>] [--max-reject-rate=F] [--sorted[=auto]]");
+        }
+        const std::string file = positional[0];
+        if (positional.size() > 1) {
+            options.chunkSize = static_cast<size_t>(std::stoul(positional[1]));
         }
 
-        if (ctx_.service.returnCar(args[0])) {
-            std::cout << "Car " << args[0] << " returned successfully." << std::endl;
+        auto metrics = ctx_.batchProcessor.ingest(file, options);
+        if (metrics.merge) {
+            out << metrics.merge->summary() << " (" << metrics.duration.count() << " ms), 1 commit." << std::endl;
         } else {
-            std::cout << "Unable to return car " << args[0] << std::endl;
+            printBatched(metrics, out);
+        }
+        if (metrics.rejectedRecords > 0) {
+            out << "Rejected " << metrics.rejectedRecords << " lines";
+            if (!metrics.quarantinePath.empty()) {
+                out << "; quarantined in " << metrics.quarantinePath;
+            }
+            out << "." << std::endl;
         }
     }
 
 private:
+    static void printBatched(const BatchMetrics &metrics, std::ostream &out) {
+        if (metrics.resumedOffset > 0) {
+            out << "Resumed after byte " << metrics.resumedOffset << " from checkpoint." << std::endl;
+        }
+        out << "Processed " << metrics.processedRecords << " records in "
+                  << metrics.batches << " batches (" << metrics.duration.count() << " ms), "
+                  << metrics.commits << " commits." << std::endl;
+        out << "  threads " << metrics.threads << ": parse " << metrics.parseTime.count()
+                  << " ms, merge " << metrics.mergeTime.count() << " ms, flush " << metrics.flushTime.count()
+                  << " ms, waiting on parsers " << metrics.waitTime.count() << " ms" << std::endl;
+    }
+
     CommandContext &ctx_;
 };
 
-class AddCarCommand : public CLICommand {
+class ExportCommand : public CLICommand {
 public:
-    explicit AddCarCommand(CommandContext &ctx)
-        : CLICommand("Add a new car to the repository"), ctx_(ctx) {}
+    explicit ExportCommand(CommandContext &ctx)
+        : CLICommand("Write the fleet to a CSV or binary snapshot file"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
-        if (args.size() < 4) {
-            throw std::runtime_error("Usage: add <carId> <model> <condition> <price>");
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.empty() || args.size() > 2 || (args.size() == 2 && args[1] != "--format=csv" &&
+                                                 args[1] != "--format=binary")) {
+            throw std::runtime_error("Usage: export <file> [--format=csv|binary]");
         }
-
-        CarRecord record;
-        record.id = args[0];
-        record.model = args[1];
-        record.condition = args[2];
-        record.pricePerDay = std::stod(args[3]);
-
-        ctx_.service.addCar(record);
-        std::cout << "Car " << record.id << " added." << std::endl;
+        const bool binary = args.size() == 2 && args[1] == "--format=binary";
+        // Written from a snapshot, so rentals carry on while the file is produced.
+        const auto fleet = ctx_.repository.snapshot();
+        const RecordSource source = [&fleet](const RecordVisitor &visit) {
+            for (const auto &record : fleet->records()) {
+                visit(*record);
+            }
+        };
+        if (binary) {
+            BinarySnapshotFormat(args[0], ctx_.validator).write(source);
+        } else {
+            TextSnapshotFormat(args[0], ctx_.validator).write(source);
+        }
+        out << "Exported " << fleet->size() << " records to " << args[0] << " (" << (binary ? "binary" : "csv")
+            << ")." << std::endl;
     }
 
 private:
     CommandContext &ctx_;
 };
 
-class GenerateCommand : public CLICommand {
+class ImportCommand : public CLICommand {
 public:
-    explicit GenerateCommand(CommandContext &ctx)
-        : CLICommand("Generate synthetic fleet data"), ctx_(ctx) {}
+    explicit ImportCommand(CommandContext &ctx)
+        : CLICommand("Load a CSV or binary snapshot file and rewrite the store's snapshot"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
-        if (args.empty()) {
-            throw std::runtime_error("Usage: generate <count> [outputFile]");
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.size() != 1) {
+            throw std::runtime_error("Usage: import <file>");
         }
-        const size_t count = static_cast<size_t>(std::stoul(args[0]));
-        const std::string output = args.size() > 1 ? args[1] : "synthetic_cars.txt";
-
-        ctx_.generator.toFile(output, count);
-        std::cout << "Generated " << count << " synthetic records in " << output << std::endl;
+        if (!std::filesystem::exists(args[0])) {
+            throw std::runtime_error("No such file " + args[0]);
+        }
+        const bool binary = BinarySnapshotFormat::isBinarySnapshot(args[0]);
+        auto cars = binary ? BinarySnapshotFormat(args[0], ctx_.validator).read(nullptr)
+                           : TextSnapshotFormat(args[0], ctx_.validator).read(nullptr);
+        const size_t imported = cars.size();
+        ctx_.repository.bulkUpsert(std::move(cars));
+        ctx_.repository.compact();
+        out << "Imported " << imported << " records from " << args[0] << " (" << (binary ? "binary" : "csv")
+            << ")." << std::endl;
     }
 
 private:
     CommandContext &ctx_;
 };
 
-class IngestCommand : public CLICommand {
+class SaveCommand : public CLICommand {
 public:
-    explicit IngestCommand(CommandContext &ctx)
-        : CLICommand("Ingest large car batches via buffered pipeline"), ctx_(ctx) {}
-
-    void execute(const std::vector<std::string> &args) override {
-        if (args.empty()) {
-            throw std::runtime_error("Usage: ingest <file> [chunkSize]");
-        }
-        const std::string file = args[0];
-        const size_t chunk = args.size() > 1 ? static_cast<size_t>(std::stoul(args[1])) : 4096;
+    explicit SaveCommand(CommandContext &ctx)
+        : CLICommand("Flush pending changes and compact the journal into the snapshot"), ctx_(ctx) {}
 
-        auto metrics = ctx_.batchProcessor.ingest(file, chunk);
-        std::cout << "Processed " << metrics.processedRecords << " records in "
-                  << metrics.batches << " batches (" << metrics.duration.count() << " ms)." << std::endl;
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        (void)args;
+        (void)out;
+        ctx_.service.save();
     }
 
 private:
     CommandContext &ctx_;
 };
 
-class SaveCommand : public CLICommand {
+class RepriceCommand : public CLICommand {
 public:
-    explicit SaveCommand(CommandContext &ctx)
-        : CLICommand("Flush pending changes through transactional writer"), ctx_(ctx) {}
+    explicit RepriceCommand(CommandContext &ctx)
+        : CLICommand("Change every daily price by a percentage in one commit"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
-        (void)args;
-        ctx_.service.save();
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
+        if (args.size() != 1) {
+            throw std::runtime_error("Usage: reprice <percent>");
+        }
+        const double percent = std::stod(args[0]);
+        const size_t repriced = ctx_.service.reprice(1.0 + percent / 100.0);
+        out << "Repriced " << repriced << " cars by " << percent << "%." << std::endl;
     }
 
 private:
@@ -719,21 +6203,72 @@ public:
     explicit StatsCommand(CommandContext &ctx)
         : CLICommand("Show repository metrics"), ctx_(ctx) {}
 
-    void execute(const std::vector<std::string> &args) override {
+    void execute(const std::vector<std::string> &args, std::ostream &out) override {
         (void)args;
-        std::cout << "Tracked cars: " << ctx_.repository.totalRecords()
-                  << ", pending writes: " << std::boolalpha << ctx_.repository.pendingChanges() << std::endl;
+        const auto counts = ctx_.repository.counts();
+        out << "Tracked cars: " << counts.total << ", available: " << counts.available
+                  << ", pending writes: " << std::boolalpha << ctx_.repository.pendingChanges()
+                  << ", journal entries: " << ctx_.repository.journalEntries()
+                  << ", store: " << toString(ctx_.repository.layout()) << std::endl;
+
+        const auto commits = ctx_.repository.commitMetrics();
+        if (commits.snapshots + commits.appends > 0) {
+            out << "Durability " << toString(commits.durability) << ": " << commits.snapshots
+                      << " snapshots (last: write " << commits.lastSnapshot.writeTime.count() << " us, sync "
+                      << commits.lastSnapshot.syncTime.count() << " us, rename "
+                      << commits.lastSnapshot.renameTime.count() << " us), " << commits.appends
+                      << " journal appends (last: write " << commits.lastAppend.writeTime.count() << " us, sync "
+                      << commits.lastAppend.syncTime.count() << " us), total sync "
+                      << commits.totalSyncTime.count() << " us" << std::endl;
+        }
+        if (commits.groupCommits > 0) {
+            out << "Group commit: " << commits.groupedMutations << " mutations in "
+                      << commits.groupCommits << " batches" << std::endl;
+        }
+        if (commits.shards > 0) {
+            out << "Sharded: " << commits.shards << " shard files, " << commits.skippedShardWrites
+                << " unchanged shard rewrites skipped" << std::endl;
+        }
+        const auto persist = ctx_.repository.persistStats();
+        if (persist.background) {
+            out << "Background persistence: " << (persist.inFlight ? "write in flight for " : "idle")
+                << (persist.inFlight ? std::to_string(persist.inFlightFor.count()) + " us" : "")
+                << (persist.queued ? ", next write queued" : "") << ", " << persist.commits << " commits, "
+                << persist.failures << " failed, last commit " << persist.lastCommit.count() << " us (write "
+                << persist.lastWrite.count() << " us)" << std::endl;
+        } else if (persist.lastWrite.count() > 0) {
+            out << "Last flush: " << persist.lastWrite.count() << " us" << std::endl;
+        }
+        out << "Metrics (parse/validate timings sample 1 in 64 records):" << std::endl;
+        MetricsRegistry::instance().writeText(out);
     }
 
 private:
     CommandContext &ctx_;
 };
 
+inline void registerDefaultCommands(CommandRegistry &registry, CommandContext &ctx) {
+    registry.add("list", std::make_unique<ListCarsCommand>(ctx));
+    registry.add("query", std::make_unique<QueryCommand>(ctx));
+    registry.add("overdue", std::make_unique<OverdueCommand>(ctx));
+    registry.add("rent", std::make_unique<RentCommand>(ctx));
+    registry.add("return", std::make_unique<ReturnCommand>(ctx));
+    registry.add("add", std::make_unique<AddCarCommand>(ctx));
+    registry.add("remove", std::make_unique<RemoveCarCommand>(ctx));
+    registry.add("generate", std::make_unique<GenerateCommand>(ctx));
+    registry.add("ingest", std::make_unique<IngestCommand>(ctx));
+    registry.add("reprice", std::make_unique<RepriceCommand>(ctx));
+    registry.add("save", std::make_unique<SaveCommand>(ctx));
+    registry.add("export", std::make_unique<ExportCommand>(ctx));
+    registry.add("import", std::make_unique<ImportCommand>(ctx));
+    registry.add("stats", std::make_unique<StatsCommand>(ctx));
+}
+
 class CarRentalCLI {
 public:
     explicit CarRentalCLI(CommandContext ctx)
         : ctx_(ctx) {
-        registerCommands();
+        registerDefaultCommands(registry_, ctx_);
     }
 
     void run() {
@@ -746,92 +6281,705 @@ public:
             if (!std::getline(std::cin, line)) {
                 break;
             }
-            if (line == "exit") {
-                break;
+
+            try {
+                const auto result = registry_.dispatch(line, std::cout);
+                if (result == CommandRegistry::Dispatch::Exit) {
+                    break;
+                }
+                if (result == CommandRegistry::Dispatch::UnknownCommand) {
+                    std::cout << "Unknown command. Type 'help' for options." << std::endl;
+                }
+            } catch (const std::exception &ex) {
+                std::cerr << "Error: " << ex.what() << std::endl;
             }
-            if (line == "help") {
-                printHelp();
-                continue;
+        }
+    }
+
+    // Non-interactive replay of a command script: no banner or prompts, output collected and
+    // written in large blocks, and rental changes committed once every `commitEvery`
+    // commands (0: once, when the script ends). Returns false when the final commit fails;
+    // a failed periodic commit is reported and its changes ride along with the next one.
+    bool runBatch(std::istream &input, size_t commitEvery = 0) {
+        static constexpr std::streamoff outputBlock = 64 * 1024;
+        std::ostringstream output;
+        const auto drain = [&output] {
+            std::cout << output.view();
+            output.str({});
+        };
+
+        ctx_.service.deferCommits(true);
+        size_t sinceCommit = 0;
+        std::string line;
+        while (std::getline(input, line)) {
+            try {
+                const auto result = registry_.dispatch(line, output);
+                if (result == CommandRegistry::Dispatch::Exit) {
+                    break;
+                }
+                if (result == CommandRegistry::Dispatch::UnknownCommand) {
+                    output << "Unknown command. Type 'help' for options.\n";
+                }
+            } catch (const std::exception &ex) {
+                // Keep errors in place relative to the output that preceded them.
+                drain();
+                std::cout.flush();
+                std::cerr << "Error: " << ex.what() << std::endl;
             }
-            if (line.empty()) {
+            if (commitEvery != 0 && ++sinceCommit == commitEvery) {
+                sinceCommit = 0;
+                try {
+                    ctx_.service.commit();
+                } catch (const std::exception &ex) {
+                    drain();
+                    std::cout.flush();
+                    std::cerr << "Error: " << ex.what() << std::endl;
+                }
+            }
+            if (output.tellp() >= outputBlock) {
+                drain();
+            }
+        }
+        ctx_.service.deferCommits(false);
+        drain();
+        std::cout.flush();
+        try {
+            ctx_.service.commit();
+        } catch (const std::exception &ex) {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    CommandContext ctx_;
+    CommandRegistry registry_;
+};
+
+// Readiness notification for the server loop: epoll on Linux, poll(2) elsewhere.
+class EventPoller {
+public:
+    static constexpr std::uint32_t Readable = 1;
+    static constexpr std::uint32_t Writable = 2;
+
+    struct Event {
+        int fd;
+        bool readable;
+        bool writable;
+        bool hangup;
+    };
+
+    EventPoller() {
+#if defined(__linux__)
+        epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ < 0) {
+            throw std::runtime_error(std::string("Unable to create epoll instance: ") + std::strerror(errno));
+        }
+#endif
+    }
+
+    ~EventPoller() {
+#if defined(__linux__)
+        ::close(epoll_);
+#endif
+    }
+
+    EventPoller(const EventPoller &) = delete;
+    EventPoller &operator=(const EventPoller &) = delete;
+
+    // Registers `fd` or changes its interest set; hangups are always reported.
+    void watch(int fd, std::uint32_t interest) {
+#if defined(__linux__)
+        epoll_event event{};
+        event.events = (interest & Readable ? EPOLLIN : 0u) | (interest & Writable ? EPOLLOUT : 0u);
+        event.data.fd = fd;
+        const int op = watched_.count(fd) != 0 ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (::epoll_ctl(epoll_, op, fd, &event) != 0) {
+            throw std::runtime_error(std::string("epoll_ctl failed: ") + std::strerror(errno));
+        }
+#endif
+        watched_[fd] = interest;
+    }
+
+    void unwatch(int fd) {
+        if (watched_.erase(fd) == 0) {
+            return;
+        }
+#if defined(__linux__)
+        ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    }
+
+    std::vector<Event> wait(int timeoutMs) {
+        std::vector<Event> ready;
+#if defined(__linux__)
+        std::array<epoll_event, 128> events;
+        const int count = ::epoll_wait(epoll_, events.data(), static_cast<int>(events.size()), timeoutMs);
+        for (int i = 0; i < count; ++i) {
+            const auto flags = events[static_cast<size_t>(i)].events;
+            ready.push_back({events[static_cast<size_t>(i)].data.fd, (flags & EPOLLIN) != 0, (flags & EPOLLOUT) != 0,
+                             (flags & (EPOLLHUP | EPOLLERR)) != 0});
+        }
+#else
+        std::vector<pollfd> fds;
+        fds.reserve(watched_.size());
+        for (const auto &[fd, interest] : watched_) {
+            fds.push_back({fd, static_cast<short>((interest & Readable ? POLLIN : 0) | (interest & Writable ? POLLOUT : 0)), 0});
+        }
+        const int count = ::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeoutMs);
+        for (size_t i = 0; count > 0 && i < fds.size(); ++i) {
+            if (fds[i].revents != 0) {
+                ready.push_back({fds[i].fd, (fds[i].revents & POLLIN) != 0, (fds[i].revents & POLLOUT) != 0,
+                                 (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) != 0});
+            }
+        }
+#endif
+        return ready;
+    }
+
+private:
+#if defined(__linux__)
+    int epoll_{-1};
+#endif
+    std::unordered_map<int, std::uint32_t> watched_;
+};
+
+struct ServerOptions {
+    std::string host{"127.0.0.1"};
+    // Zero binds an ephemeral port; CommandServer::port() reports the one chosen.
+    std::uint16_t port{0};
+    size_t workers{4};
+};
+
+// Serves CommandRegistry commands over TCP with a line protocol: each request line runs
+// one command, and its output is followed by "OK" or "ERR <message>". One event-loop
+// thread owns the sockets; commands run on a worker pool against the shared repository,
+// one at a time per connection so replies keep request order.
+class CommandServer {
+public:
+    CommandServer(const CommandRegistry &registry, ServerOptions options)
+        : registry_(registry), options_(std::move(options)) {
+        listener_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (listener_ < 0) {
+            throw std::runtime_error(std::string("Unable to create socket: ") + std::strerror(errno));
+        }
+        const int reuse = 1;
+        ::setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options_.port);
+        if (::inet_pton(AF_INET, options_.host.c_str(), &address.sin_addr) != 1) {
+            ::close(listener_);
+            throw std::invalid_argument("Invalid listen address " + options_.host);
+        }
+        if (::bind(listener_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listener_, SOMAXCONN) != 0) {
+            const std::string reason = std::strerror(errno);
+            ::close(listener_);
+            throw std::runtime_error("Unable to listen on " + options_.host + ":" +
+                                     std::to_string(options_.port) + ": " + reason);
+        }
+        socklen_t length = sizeof(address);
+        ::getsockname(listener_, reinterpret_cast<sockaddr *>(&address), &length);
+        port_ = ntohs(address.sin_port);
+        setNonBlocking(listener_);
+
+        int wake[2];
+        if (::pipe(wake) != 0) {
+            ::close(listener_);
+            throw std::runtime_error(std::string("Unable to create wake pipe: ") + std::strerror(errno));
+        }
+        wakeRead_ = wake[0];
+        wakeWrite_ = wake[1];
+        setNonBlocking(wakeRead_);
+        setNonBlocking(wakeWrite_);
+
+        for (size_t i = 0; i < std::max<size_t>(options_.workers, 1); ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ~CommandServer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopWorkers_ = true;
+        }
+        jobsReady_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+        for (const auto &entry : connections_) {
+            ::close(entry.second.fd);
+        }
+        ::close(listener_);
+        ::close(wakeRead_);
+        ::close(wakeWrite_);
+        if (signalTarget_ == this) {
+            signalTarget_ = nullptr;
+        }
+    }
+
+    CommandServer(const CommandServer &) = delete;
+    CommandServer &operator=(const CommandServer &) = delete;
+
+    std::uint16_t port() const { return port_; }
+
+    // Runs the event loop until stop() is called.
+    void run() {
+        std::signal(SIGPIPE, SIG_IGN);
+        poller_.watch(listener_, EventPoller::Readable);
+        poller_.watch(wakeRead_, EventPoller::Readable);
+        while (!stopping_) {
+            for (const auto &event : poller_.wait(-1)) {
+                if (event.fd == listener_) {
+                    acceptConnections();
+                } else if (event.fd == wakeRead_) {
+                    collectReplies();
+                } else {
+                    serviceConnection(event);
+                }
+            }
+        }
+    }
+
+    // Safe to call from any thread and from a signal handler.
+    void stop() {
+        stopping_ = true;
+        wake();
+    }
+
+    // Routes SIGINT/SIGTERM to stop() on this server.
+    void stopOnSignals() {
+        signalTarget_ = this;
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+    }
+
+private:
+    static constexpr size_t maxLineLength = 1 << 20;
+    // Past this many lines waiting for a worker, a connection is not read until some run.
+    static constexpr size_t maxQueuedLines = 1024;
+
+    struct Connection {
+        int fd{-1};
+        std::string input;
+        std::string output;
+        std::deque<std::string> queued;
+        bool busy{false};
+        bool peerClosed{false};
+        bool closeWhenFlushed{false};
+        // Reset or hung up: nothing more can be read from or delivered to the peer.
+        bool hungUp{false};
+    };
+
+    struct Job {
+        std::uint64_t connection;
+        std::string line;
+    };
+
+    struct Reply {
+        std::uint64_t connection;
+        std::string text;
+        bool close;
+    };
+
+    static void setNonBlocking(int fd) {
+        const int flags = ::fcntl(fd, F_GETFL, 0);
+        ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    static void handleSignal(int) {
+        if (CommandServer *server = signalTarget_) {
+            server->stop();
+        }
+    }
+
+    void wake() {
+        const char byte = 1;
+        [[maybe_unused]] const ssize_t written = ::write(wakeWrite_, &byte, 1);
+    }
+
+    void acceptConnections() {
+        while (true) {
+            const int fd = ::accept(listener_, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            setNonBlocking(fd);
+            const std::uint64_t id = nextConnection_++;
+            connections_[id].fd = fd;
+            byFd_[fd] = id;
+            poller_.watch(fd, EventPoller::Readable);
+        }
+    }
+
+    void serviceConnection(const EventPoller::Event &event) {
+        const auto found = byFd_.find(event.fd);
+        if (found == byFd_.end()) {
+            return;
+        }
+        const std::uint64_t id = found->second;
+        Connection &connection = connections_.at(id);
+        connection.hungUp = connection.hungUp || event.hangup;
+        if (event.readable || event.hangup) {
+            receive(connection);
+        }
+        if (event.writable) {
+            send(connection);
+        }
+        settle(id, connection);
+    }
+
+    // Reads until the socket is drained or the connection has a full queue of lines. Each
+    // read is checked against maxLineLength before it is buffered, so a client streaming
+    // without newlines costs at most one line's worth of memory.
+    void receive(Connection &connection) {
+        char buffer[64 * 1024];
+        while (!connection.peerClosed && !connection.closeWhenFlushed && connection.queued.size() < maxQueuedLines) {
+            const ssize_t received = ::read(connection.fd, buffer, sizeof(buffer));
+            if (received > 0) {
+                const std::string_view chunk(buffer, static_cast<size_t>(received));
+                if (connection.input.size() + std::min(chunk.find('\n'), chunk.size()) > maxLineLength) {
+                    connection.input.clear();
+                    connection.queued.clear();
+                    connection.output += "ERR Request line too long\n";
+                    connection.closeWhenFlushed = true;
+                    return;
+                }
+                connection.input += chunk;
+                splitLines(connection);
                 continue;
             }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                break;
+            }
+            connection.peerClosed = true;
+        }
+    }
+
+    // Moves the complete lines of `connection.input` to its queue.
+    static void splitLines(Connection &connection) {
+        size_t start = 0;
+        for (size_t end; (end = connection.input.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string line = connection.input.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                connection.queued.push_back(std::move(line));
+            }
+        }
+        connection.input.erase(0, start);
+    }
+
+    void send(Connection &connection) {
+        while (!connection.output.empty()) {
+            const ssize_t sent = ::write(connection.fd, connection.output.data(), connection.output.size());
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    // The peer is gone; nothing left to deliver.
+                    connection.output.clear();
+                    connection.closeWhenFlushed = true;
+                    connection.hungUp = true;
+                }
+                return;
+            }
+            connection.output.erase(0, static_cast<size_t>(sent));
+        }
+    }
+
+    // Hands the next queued line to the workers, updates the poll interest and closes
+    // the connection once there is nothing further to run or deliver.
+    void settle(std::uint64_t id, Connection &connection) {
+        if (connection.hungUp) {
+            connection.queued.clear();
+            connection.output.clear();
+            connection.closeWhenFlushed = true;
+        }
+        if (!connection.busy && !connection.closeWhenFlushed && !connection.queued.empty()) {
+            connection.busy = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back({id, std::move(connection.queued.front())});
+            }
+            connection.queued.pop_front();
+            jobsReady_.notify_one();
+        }
 
-            auto tokens = tokenize(line);
-            const std::string commandName = tokens.front();
-            tokens.erase(tokens.begin());
+        const bool finished = connection.closeWhenFlushed ||
+                              (connection.peerClosed && !connection.busy && connection.queued.empty());
+        if (finished && connection.output.empty() && !connection.busy) {
+            poller_.unwatch(connection.fd);
+            ::close(connection.fd);
+            byFd_.erase(connection.fd);
+            connections_.erase(id);
+            return;
+        }
+        if (connection.hungUp) {
+            // Hangups are reported whatever the interest, so a hung-up fd stays unwatched
+            // until its running command replies and the connection can be closed.
+            poller_.unwatch(connection.fd);
+            return;
+        }
+        std::uint32_t interest =
+            connection.peerClosed || connection.queued.size() >= maxQueuedLines ? 0 : EventPoller::Readable;
+        if (!connection.output.empty()) {
+            interest |= EventPoller::Writable;
+        }
+        poller_.watch(connection.fd, interest);
+    }
 
-            CLICommand *command = registry_.find(commandName);
-            if (!command) {
-                std::cout << "Unknown command. Type 'help' for options." << std::endl;
+    void collectReplies() {
+        char drain[256];
+        while (::read(wakeRead_, drain, sizeof(drain)) > 0) {
+        }
+        std::vector<Reply> replies;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            replies.swap(replies_);
+        }
+        for (auto &reply : replies) {
+            const auto found = connections_.find(reply.connection);
+            if (found == connections_.end()) {
                 continue;
             }
+            Connection &connection = found->second;
+            connection.busy = false;
+            connection.output += reply.text;
+            if (reply.close) {
+                connection.queued.clear();
+                connection.closeWhenFlushed = true;
+            }
+            send(connection);
+            settle(reply.connection, connection);
+        }
+    }
 
-            try {
-                command->execute(tokens);
-            } catch (const std::exception &ex) {
-                std::cerr << "Error: " << ex.what() << std::endl;
+    void work() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                jobsReady_.wait(lock, [&] { return stopWorkers_ || !jobs_.empty(); });
+                if (stopWorkers_) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            bool close = false;
+            std::string text = execute(job.line, close);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                replies_.push_back({job.connection, std::move(text), close});
             }
+            wake();
         }
     }
 
-private:
-    static std::vector<std::string> tokenize(const std::string &line) {
-        std::istringstream iss(line);
-        std::vector<std::string> tokens;
-        std::string token;
-        while (iss >> token) {
-            tokens.push_back(token);
+    std::string execute(const std::string &line, bool &close) const {
+        std::ostringstream out;
+        try {
+            switch (registry_.dispatch(line, out)) {
+            case CommandRegistry::Dispatch::Exit:
+                close = true;
+                [[fallthrough]];
+            case CommandRegistry::Dispatch::Done:
+            case CommandRegistry::Dispatch::Empty:
+                out << "OK\n";
+                break;
+            case CommandRegistry::Dispatch::UnknownCommand:
+                out << "ERR Unknown command. Type 'help' for options.\n";
+                break;
+            }
+        } catch (const std::exception &ex) {
+            out << "ERR " << ex.what() << '\n';
         }
-        return tokens;
+        return out.str();
+    }
+
+    static inline std::atomic<CommandServer *> signalTarget_{nullptr};
+
+    const CommandRegistry &registry_;
+    ServerOptions options_;
+    int listener_{-1};
+    int wakeRead_{-1};
+    int wakeWrite_{-1};
+    std::uint16_t port_{0};
+    std::atomic<bool> stopping_{false};
+
+    // Owned by the event-loop thread.
+    EventPoller poller_;
+    std::unordered_map<std::uint64_t, Connection> connections_;
+    std::unordered_map<int, std::uint64_t> byFd_;
+    std::uint64_t nextConnection_{1};
+
+    std::mutex mutex_;
+    std::condition_variable jobsReady_;
+    std::deque<Job> jobs_;
+    std::vector<Reply> replies_;
+    bool stopWorkers_{false};
+    std::vector<std::thread> workers_;
+};
+
+// Rewrites `path` with a JSON dump of the registry every `interval`, and once more on
+// destruction, so external tooling can follow a long-running process.
+class MetricsFileWriter {
+public:
+    MetricsFileWriter(std::string path, std::chrono::milliseconds interval)
+        : path_(std::move(path)), interval_(interval), thread_([this] { run(); }) {}
+
+    ~MetricsFileWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
     }
 
-    void registerCommands() {
-        registry_.add("list", std::make_unique<ListCarsCommand>(ctx_));
-        registry_.add("rent", std::make_unique<RentCommand>(ctx_));
-        registry_.add("return", std::make_unique<ReturnCommand>(ctx_));
-        registry_.add("add", std::make_unique<AddCarCommand>(ctx_));
-        registry_.add("generate", std::make_unique<GenerateCommand>(ctx_));
-        registry_.add("ingest", std::make_unique<IngestCommand>(ctx_));
-        registry_.add("save", std::make_unique<SaveCommand>(ctx_));
-        registry_.add("stats", std::make_unique<StatsCommand>(ctx_));
+    MetricsFileWriter(const MetricsFileWriter &) = delete;
+    MetricsFileWriter &operator=(const MetricsFileWriter &) = delete;
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            const bool stopping = wake_.wait_for(lock, interval_, [this] { return stopping_; });
+            dump();
+            if (stopping) {
+                return;
+            }
+        }
     }
 
-    void printHelp() const {
-        std::cout << "Available commands:" << std::endl;
-        for (const auto &[name, description] : registry_.descriptions()) {
-            std::cout << "  " << name << " - " << description << std::endl;
+    void dump() const {
+        try {
+            std::ostringstream json;
+            MetricsRegistry::instance().writeJson(json);
+            TransactionalFileWriter(path_).writeWith([&](OutputBuffer &out) { out.append(json.str()); });
+        } catch (const std::exception &ex) {
+            std::cerr << "[WARN] Unable to write metrics to " << path_ << ": " << ex.what() << std::endl;
         }
-        std::cout << "  help - Show this list" << std::endl;
-        std::cout << "  exit - Quit the CLI" << std::endl;
     }
 
-    CommandContext ctx_;
-    CommandRegistry registry_;
+    std::string path_;
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    std::thread thread_;
 };
 
 struct CliArguments {
     BackendType backend{BackendType::File};
+    BackendOptions backendOptions{DurabilityMode::Full, std::nullopt};
     std::string carsFile{"cars.txt"};
     bool legacyMode{false};
+    // Set by --serve; the process then serves commands over TCP instead of stdin.
+    std::optional<ServerOptions> serve;
+    std::string metricsFile;
+    std::chrono::milliseconds metricsInterval{5000};
+    // Batch mode replays --script, or stdin when it is not a terminal; --batch and
+    // --interactive override the terminal check.
+    std::string scriptFile;
+    std::optional<bool> batch;
+    size_t batchCommitEvery{0};
+    StoreLayout storeLayout{StoreLayout::Hashed};
+    bool asyncFlush{false};
+    // Set by --ingest-sorted; the file is merged into the backend and the process exits.
+    std::string sortedIngestFile;
 };
 
 [[maybe_unused]] static CliArguments parseArguments(int argc, char **argv) {
     CliArguments args;
+    bool carsFileGiven = false;
     for (int i = 1; i < argc; ++i) {
         const std::string value = argv[i];
         if (value == "--backend=memory") {
             args.backend = BackendType::Memory;
         } else if (value == "--backend=file") {
             args.backend = BackendType::File;
+        } else if (value == "--backend=binary") {
+            args.backend = BackendType::Binary;
+        } else if (value == "--backend=sharded") {
+            args.backend = BackendType::Sharded;
+        } else if (value.rfind("--shards=", 0) == 0) {
+            args.backendOptions.shards = static_cast<size_t>(std::stoul(value.substr(9)));
+        } else if (value == "--store=hashed") {
+            args.storeLayout = StoreLayout::Hashed;
+        } else if (value == "--store=compact") {
+            args.storeLayout = StoreLayout::Compact;
+        } else if (value == "--durability=none") {
+            args.backendOptions.durability = DurabilityMode::None;
+        } else if (value == "--durability=data") {
+            args.backendOptions.durability = DurabilityMode::DataSync;
+        } else if (value == "--durability=full") {
+            args.backendOptions.durability = DurabilityMode::Full;
+        } else if (value == "--async-flush") {
+            args.asyncFlush = true;
+        } else if (value.rfind("--ingest-sorted=", 0) == 0) {
+            args.sortedIngestFile = value.substr(16);
+        } else if (value == "--group-commit") {
+            args.backendOptions.groupCommit = GroupCommitOptions{};
+        } else if (value.rfind("--group-commit=", 0) == 0) {
+            // --group-commit=<window ms>[,<max ops>]
+            GroupCommitOptions group;
+            const std::string spec = value.substr(15);
+            const size_t comma = spec.find(',');
+            group.window = std::chrono::milliseconds(std::stoll(spec.substr(0, comma)));
+            if (comma != std::string::npos) {
+                group.maxOps = static_cast<size_t>(std::stoul(spec.substr(comma + 1)));
+            }
+            args.backendOptions.groupCommit = group;
+        } else if (value.rfind("--serve=", 0) == 0) {
+            // --serve=<port> or --serve=<address>:<port>
+            ServerOptions server = args.serve.value_or(ServerOptions{});
+            const std::string spec = value.substr(8);
+            const size_t colon = spec.rfind(':');
+            if (colon != std::string::npos) {
+                server.host = spec.substr(0, colon);
+            }
+            server.port = static_cast<std::uint16_t>(std::stoul(spec.substr(colon == std::string::npos ? 0 : colon + 1)));
+            args.serve = server;
+        } else if (value.rfind("--serve-workers=", 0) == 0) {
+            ServerOptions server = args.serve.value_or(ServerOptions{});
+            server.workers = static_cast<size_t>(std::stoul(value.substr(16)));
+            args.serve = server;
+        } else if (value.rfind("--metrics-file=", 0) == 0) {
+            // --metrics-file=<path>[,<interval ms>]
+            const std::string spec = value.substr(15);
+            const size_t comma = spec.find(',');
+            args.metricsFile = spec.substr(0, comma);
+            if (comma != std::string::npos) {
+                args.metricsInterval = std::chrono::milliseconds(std::stoll(spec.substr(comma + 1)));
+            }
+        } else if (value.rfind("--script=", 0) == 0) {
+            args.scriptFile = value.substr(9);
+        } else if (value == "--batch") {
+            args.batch = true;
+        } else if (value == "--interactive") {
+            args.batch = false;
+        } else if (value.rfind("--batch-commit=", 0) == 0) {
+            args.batchCommitEvery = static_cast<size_t>(std::stoul(value.substr(15)));
         } else if (value.rfind("--cars=", 0) == 0) {
             args.carsFile = value.substr(7);
+            carsFileGiven = true;
         } else if (value == "--legacy" || value == "--mode=legacy") {
             args.legacyMode = true;
         } else if (value == "--mode=modular") {
             args.legacyMode = false;
         }
     }
+    if (args.backend == BackendType::Binary && !carsFileGiven) {
+        args.carsFile = "cars.bin";
+    }
     return args;
 }
 
@@ -843,7 +6991,10 @@ struct CliArguments {
 #undef main
 
 namespace legacy_car_rental {
-inline int run() {
+// Runs the legacy menu against the same repository and journal the modular CLI uses.
+inline int run(car_rental::CarRepository &repository, car_rental::RentalService &service,
+               car_rental::UserStore &users, std::shared_ptr<car_rental::CarRecordValidator> validator) {
+    legacy_file::stores() = legacy_file::Stores{&repository, &service, &users, std::move(validator)};
     return LEGACY_ENTRY_POINT();
 }
 } // namespace legacy_car_rental
@@ -854,20 +7005,65 @@ int main(int argc, char **argv) {
 
     auto validator = std::make_shared<CarRecordValidator>();
     const auto cliArgs = parseArguments(argc, argv);
-    if (cliArgs.legacyMode) {
-        std::cout << "Launching legacy interactive car rental system..." << std::endl;
-        return legacy_car_rental::run();
+
+    std::optional<MetricsFileWriter> metricsWriter;
+    if (!cliArgs.metricsFile.empty()) {
+        metricsWriter.emplace(cliArgs.metricsFile, cliArgs.metricsInterval);
     }
 
-    auto backend = StorageBackendFactory::create(cliArgs.backend, cliArgs.carsFile, validator);
-    CarRepository repository(backend);
+    auto backend = StorageBackendFactory::create(cliArgs.backend, cliArgs.carsFile, validator, cliArgs.backendOptions);
+    if (!cliArgs.sortedIngestFile.empty()) {
+        // The merge streams the backend's files directly, so the fleet is never loaded.
+        try {
+            const auto merged = backend->mergeSorted(cliArgs.sortedIngestFile, {});
+            if (!merged) {
+                std::cerr << "The " << backend->name() << " backend cannot merge a sorted ingest" << std::endl;
+                return 1;
+            }
+            std::cout << merged->summary() << "." << std::endl;
+        } catch (const std::exception &ex) {
+            std::cerr << "Sorted ingest failed: " << ex.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    CarRepository repository(backend, CarRepository::defaultShardCount, cliArgs.storeLayout);
+    if (cliArgs.asyncFlush) {
+        repository.startBackgroundPersistence();
+    }
     RentalService service(repository);
+    if (cliArgs.legacyMode) {
+        std::cout << "Launching legacy interactive car rental system..." << std::endl;
+        UserStore users;
+        return legacy_car_rental::run(repository, service, users, validator);
+    }
     SyntheticDatasetGenerator generator(validator);
     BatchProcessor processor(repository, validator);
 
-    CommandContext ctx{service, generator, processor, repository, backend->name()};
+    CommandContext ctx{service, generator, processor, repository, backend->name(), validator};
+    if (cliArgs.serve) {
+        CommandRegistry registry;
+        registerDefaultCommands(registry, ctx);
+        CommandServer server(registry, *cliArgs.serve);
+        server.stopOnSignals();
+        std::cout << "Serving " << ctx.backendName << " backend on " << cliArgs.serve->host << ":" << server.port()
+                  << std::endl;
+        server.run();
+        return 0;
+    }
     CarRentalCLI cli(std::move(ctx));
-    cli.run();
+    if (!cliArgs.scriptFile.empty()) {
+        std::ifstream script(cliArgs.scriptFile);
+        if (!script) {
+            std::cerr << "Unable to open script " << cliArgs.scriptFile << std::endl;
+            return 1;
+        }
+        return cli.runBatch(script, cliArgs.batchCommitEvery) ? 0 : 1;
+    } else if (cliArgs.batch.value_or(::isatty(STDIN_FILENO) == 0)) {
+        return cli.runBatch(std::cin, cliArgs.batchCommitEvery) ? 0 : 1;
+    } else {
+        cli.run();
+    }
     return 0;
 }
 #endif
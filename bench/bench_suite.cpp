@@ -0,0 +1,496 @@
+#include "../as.cpp"
+
+#include <filesystem>
+#include <iostream>
+#include <malloc.h>
+
+using namespace car_rental;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The stringstream/getline tokenizer CarRecordParser::parse used before the
+// string_view rewrite, kept here as the parse baseline.
+std::optional<CarRecord> parseWithStringstream(const CarRecordValidator &validator, const std::string &line) {
+    if (line.empty()) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> tokens;
+    std::string token;
+    std::stringstream ss(line);
+    while (std::getline(ss, token, ',')) {
+        tokens.push_back(token);
+    }
+
+    if (tokens.size() < 4) {
+        throw std::runtime_error("Malformed car record: " + line);
+    }
+
+    // The string fields of the original CarRecord, converted to today's typed record.
+    const std::string model = tokens.size() > 4 ? tokens[1] : tokens[0];
+    const std::string condition = tokens.size() > 4 ? tokens[2] : tokens[1];
+    const std::string status = tokens.size() > 4 ? tokens[4] : tokens[3];
+    const auto parsedCondition = parseCondition(condition);
+    if (!parsedCondition) {
+        throw std::runtime_error("Validation failed for line: " + line);
+    }
+
+    CarRecord record;
+    record.id = tokens[0];
+    record.model = model;
+    record.condition = *parsedCondition;
+    record.pricePerDay = std::stod(tokens.size() > 4 ? tokens[3] : tokens[2]);
+    if (status != availableStatusText) {
+        record.status = CarStatus::Rented;
+        record.renterId = status.substr(rentedStatusPrefix.size());
+    }
+
+    if (!validator.validate(record)) {
+        throw std::runtime_error("Validation failed for line: " + line);
+    }
+    return record;
+}
+
+// Counts lines and fields the way CarFilePipeline did before DelimiterScanner: memchr for
+// each newline and string_view::find for each comma.
+size_t splitWithMemchr(std::string_view data) {
+    size_t fields = 0;
+    while (!data.empty()) {
+        const char *newline = static_cast<const char *>(std::memchr(data.data(), '\n', data.size()));
+        const size_t length = newline ? static_cast<size_t>(newline - data.data()) : data.size();
+        const std::string_view line = data.substr(0, length);
+        for (size_t begin = 0; begin < line.size();) {
+            const size_t comma = line.find(',', begin);
+            ++fields;
+            begin = comma == std::string_view::npos ? line.size() : comma + 1;
+        }
+        data.remove_prefix(newline ? length + 1 : length);
+    }
+    return fields;
+}
+
+size_t splitWithScanner(std::string_view data, DelimiterScanner::Level level) {
+    size_t fields = 0;
+    DelimiterScanner scanner(data, level);
+    DelimiterScanner::Line line;
+    while (scanner.next(line)) {
+        fields += line.count;
+    }
+    return fields;
+}
+
+// Collects results and prints them as one JSON document:
+// {"suite": ..., "results": [{"name", "fleet", "unit", "value" | percentiles}, ...]}
+class JsonReport {
+public:
+    void rate(const std::string &name, size_t fleet, const std::string &unit, double value) {
+        std::ostringstream entry;
+        entry << std::fixed << std::setprecision(2) << "{\"name\": \"" << name << "\", \"fleet\": " << fleet
+              << ", \"unit\": \"" << unit << "\", \"value\": " << value << "}";
+        entries_.push_back(entry.str());
+    }
+
+    void latency(const std::string &name, size_t fleet, std::vector<double> samples) {
+        std::sort(samples.begin(), samples.end());
+        const auto at = [&](double quantile) {
+            return samples[std::min(samples.size() - 1, static_cast<size_t>(quantile * samples.size()))];
+        };
+        std::ostringstream entry;
+        entry << std::fixed << std::setprecision(2) << "{\"name\": \"" << name << "\", \"fleet\": " << fleet
+              << ", \"unit\": \"us\", \"samples\": " << samples.size() << ", \"p50\": " << at(0.50)
+              << ", \"p90\": " << at(0.90) << ", \"p99\": " << at(0.99) << ", \"max\": " << samples.back() << "}";
+        entries_.push_back(entry.str());
+    }
+
+    void print(std::ostream &out) const {
+        out << "{\n  \"suite\": \"car_rental\",\n  \"results\": [\n";
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            out << "    " << entries_[i] << (i + 1 < entries_.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}" << std::endl;
+    }
+
+private:
+    std::vector<std::string> entries_;
+};
+
+template <typename Parse>
+double parseRate(const std::vector<std::string> &lines, Parse &&parse) {
+    size_t parsed = 0;
+    const auto start = Clock::now();
+    for (const auto &line : lines) {
+        if (parse(line).has_value()) {
+            ++parsed;
+        }
+    }
+    return static_cast<double>(parsed) / secondsSince(start);
+}
+
+template <typename Parse>
+double lineRate(const std::vector<std::string> &lines, Parse &&parse) {
+    const auto start = Clock::now();
+    for (const auto &line : lines) {
+        parse(line);
+    }
+    return static_cast<double>(lines.size()) / secondsSince(start);
+}
+
+// Rents `operations` cars and returns them again, timing each call.
+void rentReturnLatency(JsonReport &report, const std::string &backend, size_t fleet, CarRepository &repository) {
+    RentalService service(repository);
+    const auto cars = repository.available(std::min<size_t>(fleet, 2000));
+    std::vector<double> rents;
+    std::vector<double> returns;
+    rents.reserve(cars.size());
+    returns.reserve(cars.size());
+    double amount = 0;
+    for (const auto &car : cars) {
+        const auto start = Clock::now();
+        service.rentCar(car.id, "bench-user", amount);
+        rents.push_back(secondsSince(start) * 1e6);
+    }
+    for (const auto &car : cars) {
+        const auto start = Clock::now();
+        service.returnCar(car.id);
+        returns.push_back(secondsSince(start) * 1e6);
+    }
+    report.latency("rent." + backend, fleet, std::move(rents));
+    report.latency("return." + backend, fleet, std::move(returns));
+}
+
+size_t heapInUse() {
+    return mallinfo2().uordblks;
+}
+
+// Heap held per record by each store layout, and point-lookup latency against it.
+void storeLayouts(JsonReport &report, size_t fleet, const std::vector<CarRecord> &records) {
+    std::vector<std::string> probes;
+    for (size_t i = 0; i < std::min<size_t>(fleet, 20000); ++i) {
+        probes.push_back(records[(i * 7919) % records.size()].id);
+    }
+    for (const auto layout : {StoreLayout::Hashed, StoreLayout::Compact}) {
+        const std::string label(toString(layout));
+        auto backend = std::make_shared<MemoryStorageBackend>(records);
+        malloc_trim(0);
+        const size_t before = heapInUse();
+        CarRepository repository(backend, CarRepository::defaultShardCount, layout);
+        malloc_trim(0);
+        report.rate("store." + label + ".bytes_per_record", fleet, "bytes",
+                    static_cast<double>(heapInUse() - before) / static_cast<double>(fleet));
+
+        std::vector<double> lookups;
+        lookups.reserve(probes.size());
+        for (const auto &id : probes) {
+            const auto start = Clock::now();
+            const auto found = repository.find(id);
+            lookups.push_back(secondsSince(start) * 1e6);
+            (void)found;
+        }
+        report.latency("store." + label + ".find", fleet, std::move(lookups));
+    }
+}
+
+// One rent issued while `save` rewrites the whole snapshot on another thread.
+void rentDuringSnapshot(JsonReport &report, const std::string &backend, size_t fleet, CarRepository &repository) {
+    RentalService service(repository);
+    const auto cars = repository.available(2);
+    double amount = 0;
+    service.rentCar(cars[0].id, "bench-user", amount);
+    std::thread save([&] { service.save(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto start = Clock::now();
+    service.rentCar(cars[1].id, "bench-user", amount);
+    report.rate("rent_during_save." + backend, fleet, "us", secondsSince(start) * 1e6);
+    save.join();
+}
+
+// Highest heap use seen while `work` runs, above what was in use before it, sampled every
+// millisecond.
+template <typename Work>
+size_t peakHeapDuring(Work &&work) {
+    malloc_trim(0);
+    const size_t before = heapInUse();
+    std::atomic<size_t> peak{before};
+    std::atomic<bool> done{false};
+    std::thread sampler([&] {
+        while (!done) {
+            peak = std::max(peak.load(), heapInUse());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    work();
+    done = true;
+    sampler.join();
+    return peak.load() - before;
+}
+
+// Upserting an id-sorted file into an id-sorted snapshot: batched through a loaded
+// repository versus streamed straight into the snapshot files without loading them. The
+// generator's output is already in id order, so it is used as is.
+void sortedIngest(JsonReport &report, const std::shared_ptr<CarRecordValidator> &validator, size_t fleet,
+                  const std::vector<CarRecord> &records) {
+    namespace fs = std::filesystem;
+    const fs::path input = fs::temp_directory_path() / "car_rental_bench_sorted.csv";
+    const fs::path snapshot = fs::temp_directory_path() / "car_rental_bench_snapshot.csv";
+    CarFilePipeline(input.string(), validator).writeAll(records);
+
+    for (const bool merged : {false, true}) {
+        CarFilePipeline(snapshot.string(), validator).writeAll(records);
+        const std::string label = merged ? "ingest.sorted_merge" : "ingest.sorted_batched";
+        size_t processed = 0;
+        const auto start = Clock::now();
+        const size_t heap = peakHeapDuring([&] {
+            if (merged) {
+                processed = FileStorageBackend(snapshot.string(), validator).mergeSorted(input.string(), {})->inputRecords;
+            } else {
+                CarRepository repository(std::make_shared<FileStorageBackend>(snapshot.string(), validator));
+                processed = BatchProcessor(repository, validator).ingest(input.string(), 4096).processedRecords;
+            }
+        });
+        report.rate(label, fleet, "records/s", static_cast<double>(processed) / secondsSince(start));
+        report.rate(label + ".peak_heap", fleet, "MB", static_cast<double>(heap) / 1e6);
+    }
+    fs::remove(input);
+    fs::remove(snapshot);
+    fs::remove(snapshot.string() + ".journal");
+}
+
+void runFleet(JsonReport &report, const std::shared_ptr<CarRecordValidator> &validator, size_t fleet) {
+    namespace fs = std::filesystem;
+    const fs::path dataset = fs::temp_directory_path() / ("car_rental_bench_" + std::to_string(fleet) + ".csv");
+    const auto records = SyntheticDatasetGenerator(validator).generate(fleet);
+    CarFilePipeline(dataset.string(), validator).writeAll(records);
+
+    std::vector<std::string> lines;
+    {
+        const CarRecordParser parser(validator);
+        lines.reserve(records.size());
+        for (const auto &record : records) {
+            lines.push_back(parser.serialize(record));
+        }
+    }
+
+    const CarRecordParser parser(validator);
+    report.rate("parse.stringstream", fleet, "records/s", parseRate(lines, [&](const std::string &line) {
+        return parseWithStringstream(*validator, line);
+    }));
+    report.rate("parse.string_view", fleet, "records/s", parseRate(lines, [&](const std::string &line) {
+        return parser.tryParse(line);
+    }));
+
+    // Every fifth line broken, as in a dirty export: the cost of rejecting by exception
+    // versus by error code.
+    std::vector<std::string> dirty = lines;
+    for (size_t i = 4; i < dirty.size(); i += 5) {
+        dirty[i] = dirty[i].substr(0, dirty[i].find(',') + 1) + "unknown,1000,Available";
+    }
+    report.rate("parse.dirty_throwing", fleet, "lines/s", lineRate(dirty, [&](const std::string &line) {
+        try {
+            parser.parse(line);
+        } catch (const std::exception &) {
+        }
+    }));
+    report.rate("parse.dirty_expected", fleet, "lines/s", lineRate(dirty, [&](const std::string &line) {
+        (void)parser.tryParse(line);
+    }));
+
+    // Line and field splitting alone, then splitting plus parsing, over the whole file.
+    {
+        std::string text;
+        for (const auto &line : lines) {
+            text += line;
+            text += '\n';
+        }
+        const double megabytes = static_cast<double>(text.size()) / 1e6;
+        auto start = Clock::now();
+        const size_t expected = splitWithMemchr(text);
+        report.rate("split.memchr_find", fleet, "MB/s", megabytes / secondsSince(start));
+        for (const auto level : {DelimiterScanner::Level::Scalar, DelimiterScanner::Level::Sse2,
+                                 DelimiterScanner::Level::Avx2}) {
+            if (level > DelimiterScanner::best()) {
+                continue;
+            }
+            const std::string label(toString(level));
+            start = Clock::now();
+            if (splitWithScanner(text, level) != expected) {
+                throw std::runtime_error("DelimiterScanner disagrees with the memchr split");
+            }
+            report.rate("split." + label, fleet, "MB/s", megabytes / secondsSince(start));
+
+            size_t parsed = 0;
+            start = Clock::now();
+            DelimiterScanner scanner(text, level);
+            DelimiterScanner::Line line;
+            while (scanner.next(line)) {
+                parsed += parser.tryParse(line).has_value() ? 1 : 0;
+            }
+            report.rate("parse.scanned_" + label, fleet, "records/s", static_cast<double>(parsed) / secondsSince(start));
+        }
+    }
+
+    for (const auto &[mode, label] : {std::pair{ReadMode::Mapped, "pipeline.stream.mapped"},
+                                      std::pair{ReadMode::Stream, "pipeline.stream.buffered"}}) {
+        size_t streamed = 0;
+        const auto start = Clock::now();
+        CarFilePipeline(dataset.string(), validator, mode).stream([&](CarRecord &&) { ++streamed; });
+        report.rate(label, fleet, "records/s", static_cast<double>(streamed) / secondsSince(start));
+    }
+
+    storeLayouts(report, fleet, records);
+
+    for (const size_t chunk : {256, 4096, 65536}) {
+        CarRepository repository(std::make_shared<MemoryStorageBackend>());
+        BatchProcessor processor(repository, validator);
+        const auto start = Clock::now();
+        const auto metrics = processor.ingest(dataset.string(), chunk);
+        report.rate("ingest.chunk_" + std::to_string(chunk), fleet, "records/s",
+                    static_cast<double>(metrics.processedRecords) / secondsSince(start));
+    }
+
+    sortedIngest(report, validator, fleet, records);
+
+    {
+        const fs::path target = fs::temp_directory_path() / "car_rental_bench_writer.csv";
+        const auto start = Clock::now();
+        const auto stats = TransactionalFileWriter(target.string()).write(lines);
+        report.rate("writer.write", fleet, "MB/s", static_cast<double>(stats.bytes) / 1e6 / secondsSince(start));
+        fs::remove(target);
+    }
+
+    {
+        CarRepository repository(std::make_shared<MemoryStorageBackend>(records));
+        const int rounds = 1000;
+        auto start = Clock::now();
+        for (int i = 0; i < rounds; ++i) {
+            repository.available(10);
+        }
+        report.rate("repository.available_10", fleet, "us/op", secondsSince(start) * 1e6 / rounds);
+        start = Clock::now();
+        const auto everything = repository.available();
+        report.rate("repository.available_all", fleet, "ms", secondsSince(start) * 1e3);
+        (void)everything;
+
+        // The ten cheapest cars: partial_sort over shared records versus copy-everything-and-sort.
+        CarQuery cheapest;
+        cheapest.order = CarQuery::Order::Price;
+        cheapest.limit = 10;
+        start = Clock::now();
+        const auto top = repository.query(cheapest);
+        report.rate("repository.query_cheapest_10", fleet, "ms", secondsSince(start) * 1e3);
+        start = Clock::now();
+        auto copied = repository.all();
+        std::sort(copied.begin(), copied.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
+            return lhs.pricePerDay < rhs.pricePerDay;
+        });
+        report.rate("repository.copy_sort_cheapest_10", fleet, "ms", secondsSince(start) * 1e3);
+        (void)top;
+
+        // Fines for the late rentals (one car in a thousand): the due-date index versus
+        // checking every rented car's due date.
+        {
+            std::vector<CarRecord> late;
+            for (size_t i = 0; i < records.size(); i += 1000) {
+                late.push_back(records[i]);
+                late.back().status = CarStatus::Rented;
+                late.back().renterId = "bench-late";
+                late.back().dueDate = today() - 1 - static_cast<std::int32_t>(i % 30);
+            }
+            repository.bulkUpsert(std::move(late));
+            long long fines = 0;
+            start = Clock::now();
+            for (const auto &car : repository.dueBefore(today())) {
+                fines += fineAsOf(car, today());
+            }
+            report.rate("repository.overdue_index", fleet, "ms", secondsSince(start) * 1e3);
+            CarQuery rentedCars;
+            rentedCars.status = CarStatus::Rented;
+            long long scanned = 0;
+            start = Clock::now();
+            for (const auto &car : repository.query(rentedCars)) {
+                scanned += fineAsOf(*car, today());
+            }
+            report.rate("repository.overdue_scan", fleet, "ms", secondsSince(start) * 1e3);
+            if (fines != scanned) {
+                throw std::runtime_error("Overdue index and scan disagree");
+            }
+        }
+
+        rentReturnLatency(report, "memory", fleet, repository);
+    }
+
+    {
+        CarRepository repository(std::make_shared<FileStorageBackend>(dataset.string(), validator));
+        rentReturnLatency(report, "file", fleet, repository);
+        rentDuringSnapshot(report, "file", fleet, repository);
+    }
+
+    // Reopening the fleet, then one rental and `save`: the single file is rewritten whole,
+    // the sharded backend (16 files, loaded in parallel) rewrites only the rented car's shard.
+    for (const auto type : {BackendType::File, BackendType::Sharded}) {
+        const std::string label = type == BackendType::File ? "file" : "sharded";
+        const fs::path base = fs::temp_directory_path() / ("car_rental_bench_" + label + ".csv");
+        {
+            CarRepository seeded(StorageBackendFactory::create(type, base.string(), validator));
+            seeded.bulkUpsert(records);
+            seeded.compact();
+        }
+        auto start = Clock::now();
+        CarRepository repository(StorageBackendFactory::create(type, base.string(), validator));
+        report.rate("load." + label, fleet, "ms", secondsSince(start) * 1e3);
+        RentalService service(repository);
+        double amount = 0;
+        service.rentCar(repository.available(1).front().id, "bench-user", amount);
+        start = Clock::now();
+        service.save();
+        report.rate("save_after_rent." + label, fleet, "ms", secondsSince(start) * 1e3);
+        fs::remove(base);
+        fs::remove(base.string() + ".journal");
+        for (size_t i = 0; i < ShardedStorageBackend::defaultShards; ++i) {
+            fs::remove(ShardedStorageBackend::shardPath(base.string(), i));
+            fs::remove(ShardedStorageBackend::shardPath(base.string(), i) + ".journal");
+        }
+    }
+
+    // The same with flushes written by the background thread; the final wait is in the
+    // rate so the writes are not left out of the cost.
+    {
+        CarRepository repository(std::make_shared<FileStorageBackend>(dataset.string(), validator));
+        repository.startBackgroundPersistence();
+        const auto start = Clock::now();
+        rentReturnLatency(report, "file_async", fleet, repository);
+        repository.flush().get();
+        report.rate("rent_return.file_async_total", fleet, "ms", secondsSince(start) * 1e3);
+        rentDuringSnapshot(report, "file_async", fleet, repository);
+    }
+
+    fs::remove(dataset);
+    fs::remove(dataset.string() + ".journal");
+}
+
+} // namespace
+
+// Usage: bench_suite [fleet sizes...]   (default: 1000 100000 1000000)
+int main(int argc, char **argv) {
+    std::vector<size_t> fleets;
+    for (int i = 1; i < argc; ++i) {
+        fleets.push_back(static_cast<size_t>(std::stoul(argv[i])));
+    }
+    if (fleets.empty()) {
+        fleets = {1000, 100000, 1000000};
+    }
+
+    auto validator = std::make_shared<CarRecordValidator>();
+    JsonReport report;
+    for (const size_t fleet : fleets) {
+        std::cerr << "[bench] fleet " << fleet << std::endl;
+        runFleet(report, validator, fleet);
+    }
+    report.print(std::cout);
+    return 0;
+}
@@ -1,199 +1,84 @@
 #include <algorithm>
-#include <fstream>
-#include <functional>
 #include <iostream>
 #include <limits>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <ctime>
 #include <cstdlib>
-#include <filesystem>
 
+// The legacy menu used to re-read cars.txt and the user files for every action. It now
+// runs on the modular CarRepository (and its journal) plus an indexed UserStore, so every
+// lookup below is a hash probe instead of a file scan.
 namespace legacy_file {
 
-struct CarRecord {
-    std::string model;
-    std::string condition;
-    double price{0.0};
-    std::string availability{"Available"};
-    std::string dueDate{"None"};
+// Bound by legacy_car_rental::run() before the menu starts.
+struct Stores {
+    car_rental::CarRepository *cars{nullptr};
+    car_rental::RentalService *rentals{nullptr};
+    car_rental::UserStore *users{nullptr};
+    std::shared_ptr<car_rental::CarRecordValidator> validator;
 };
 
-class BufferedInputStream {
-public:
-    explicit BufferedInputStream(const std::string &path, std::size_t size = 1 << 16)
-        : buffer_(size), stream_(path) {
-        if (stream_.is_open()) {
-            stream_.rdbuf()->pubsetbuf(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
-        }
-    }
-
-    std::ifstream &stream() { return stream_; }
-
-private:
-    std::vector<char> buffer_;
-    std::ifstream stream_;
-};
-
-class TransactionalFileWriter {
-public:
-    explicit TransactionalFileWriter(std::string path)
-        : path_(std::move(path)) {}
-
-    void write(const std::vector<std::string> &lines) const {
-        namespace fs = std::filesystem;
-        fs::path target(path_);
-        fs::path temp = target;
-        temp += ".tmp";
-
-        fs::create_directories(target.parent_path().empty() ? fs::current_path() : target.parent_path());
-        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
-        if (!out.is_open()) {
-            throw std::runtime_error("Unable to open temporary file for transactional write");
-        }
-
-        std::vector<char> buffer(1 << 16);
-        out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
-        for (const auto &line : lines) {
-            out << line << '\n';
-        }
-        out.flush();
-        out.close();
-
-        fs::rename(temp, target);
-    }
-
-private:
-    std::string path_;
-};
-
-inline bool isValidCondition(const std::string &condition) {
-    static const std::vector<std::string> allowed{
-        "excellent", "good", "fair", "minordamages", "majordamages"};
-    return std::find(allowed.begin(), allowed.end(), condition) != allowed.end();
+inline Stores &stores() {
+    static Stores bound;
+    return bound;
 }
 
-inline std::optional<CarRecord> parseCarLine(const std::string &line) {
-    if (line.empty()) {
-        return std::nullopt;
-    }
-
-    std::stringstream ss(line);
-    std::vector<std::string> tokens;
-    std::string token;
-    while (std::getline(ss, token, ',')) {
-        tokens.push_back(token);
-    }
-
-    if (tokens.size() < 3) {
-        std::cerr << "[WARN] Skipping malformed car record: " << line << std::endl;
-        return std::nullopt;
-    }
-
-    CarRecord record;
-    record.model = tokens[0];
-    record.condition = tokens[1];
-    try {
-        record.price = std::stod(tokens[2]);
-    } catch (const std::exception &) {
-        std::cerr << "[WARN] Invalid price in car record: " << line << std::endl;
-        return std::nullopt;
-    }
-    if (tokens.size() > 3) {
-        record.availability = tokens[3];
-    }
-    if (tokens.size() > 4) {
-        record.dueDate = tokens[4];
-    }
-    if (record.availability.empty()) {
-        record.availability = "Available";
-    }
-    if (record.dueDate.empty()) {
-        record.dueDate = "None";
-    }
-
-    if (!isValidCondition(record.condition) || record.price <= 0) {
-        std::cerr << "[WARN] Skipping invalid car record: " << line << std::endl;
-        return std::nullopt;
-    }
-
-    return record;
+inline car_rental::CarRepository &cars() {
+    return *stores().cars;
 }
 
-inline std::string serialize(const CarRecord &record) {
-    std::ostringstream oss;
-    oss << record.model << ',' << record.condition << ',' << record.price << ','
-        << record.availability << ',' << record.dueDate;
-    return oss.str();
+inline car_rental::RentalService &rentals() {
+    return *stores().rentals;
 }
 
-class CarFilePipeline {
-public:
-    explicit CarFilePipeline(std::string path)
-        : path_(std::move(path)), writer_(path_) {}
-
-    std::vector<CarRecord> readAll() const {
-        std::vector<CarRecord> records;
-        BufferedInputStream input(path_);
-        auto &stream = input.stream();
-        if (!stream.is_open()) {
-            return records;
-        }
-        std::string line;
-        while (std::getline(stream, line)) {
-            if (auto record = parseCarLine(line)) {
-                records.push_back(*record);
-            }
-        }
-        return records;
-    }
+inline car_rental::UserStore &users() {
+    return *stores().users;
+}
 
-    void writeAll(const std::vector<CarRecord> &records) const {
-        std::vector<std::string> lines;
-        lines.reserve(records.size());
-        for (const auto &record : records) {
-            lines.push_back(serialize(record));
-        }
-        writer_.write(lines);
+inline car_rental::UserRole roleOf(const std::string &role) {
+    if (role == "manager") {
+        return car_rental::UserRole::Manager;
     }
+    return role == "employee" ? car_rental::UserRole::Employee : car_rental::UserRole::Customer;
+}
 
-private:
-    std::string path_;
-    TransactionalFileWriter writer_;
-};
-
-inline CarFilePipeline &carPipeline() {
-    static CarFilePipeline pipeline("cars.txt");
-    return pipeline;
+inline bool isValidCondition(const std::string &condition) {
+    return car_rental::parseCondition(condition).has_value();
 }
 
-inline std::vector<CarRecord> loadCars() {
-    return carPipeline().readAll();
+// The menu still calls a car's key its "model"; it is the repository's car ID.
+inline car_rental::CarRecord makeRecord(const std::string &model, const std::string &condition, double price) {
+    car_rental::CarRecord record;
+    record.id = model;
+    record.model = car_rental::modelName(model, model);
+    record.condition = *car_rental::parseCondition(condition);
+    record.pricePerDay = price;
+    return record;
 }
 
-inline void saveCars(const std::vector<CarRecord> &records) {
-    carPipeline().writeAll(records);
+inline std::string dueDateText(const car_rental::CarRecord &car) {
+    return car.dueDate == car_rental::noDueDate ? std::string("None") : car_rental::formatDate(car.dueDate);
 }
 
-inline bool mutateCars(const std::function<bool(std::vector<CarRecord> &)> &fn) {
-    auto cars = loadCars();
-    const bool changed = fn(cars);
-    if (changed) {
-        saveCars(cars);
-    }
-    return changed;
+// 20 Rs. for every day past the due date, as the `overdue` command charges it.
+inline int fineFor(const car_rental::CarRecord &car) {
+    return car_rental::fineAsOf(car, car_rental::today());
 }
 
-inline CarRecord makeRecord(const std::string &model, const std::string &condition, double price) {
-    CarRecord record;
-    record.model = model;
-    record.condition = condition;
-    record.price = price;
-    record.availability = "Available";
-    record.dueDate = "None";
-    return record;
+// A+/A -> 4 cars, B+/B -> 3, C+/C -> 2, D+/D -> 1, anything else 0.
+inline int rentalLimit(const std::string &rating) {
+    if (rating == "A+" || rating == "A") {
+        return 4;
+    } else if (rating == "B+" || rating == "B") {
+        return 3;
+    } else if (rating == "C+" || rating == "C") {
+        return 2;
+    } else if (rating == "D+" || rating == "D") {
+        return 1;
+    }
+    return 0;
 }
 
 } // namespace legacy_file
@@ -220,10 +105,11 @@ public:
         cout << "Enter the Password: ";
         cin >> password;
 
-        ofstream fout("managers.txt", ios::app); // Open the file in append mode
-
-        fout << name << "," << id << "," << password << endl; // Write data to the file
-        fout.close();
+        if (!legacy_file::users().add(car_rental::UserRole::Manager, {name, id, password, ""}))
+        {
+            cout << "A manager with ID " << id << " already exists." << endl;
+            return;
+        }
 
         cout << "manager"<<" added successfully." << endl;
     }
@@ -242,10 +128,11 @@ public:
         cout << "Enter the Password: ";
         cin >> password;
 
-        ofstream fout("customers.txt", ios::app); // Open the file in append mode
-
-        fout << name << "," << id << "," << password << endl; // Write data to the file
-        fout.close();
+        if (!legacy_file::users().add(car_rental::UserRole::Customer, {name, id, password, ""}))
+        {
+            cout << "A customer with ID " << id << " already exists." << endl;
+            return;
+        }
 
         cout << "Customer added successfully." << endl;
     }
@@ -264,16 +151,17 @@ public:
         std::cout << "Enter the Password: ";
         std::getline(std::cin, password);
 
-        std::ofstream fout("employees.txt", std::ios::app); // Open the file in append mode
-
-        fout << name << "," << id << "," << password << ",B" << std::endl; // Write data to the file
-        fout.close();
+        if (!legacy_file::users().add(car_rental::UserRole::Employee, {name, id, password, "B"}))
+        {
+            std::cout << "An employee with ID " << id << " already exists." << std::endl;
+            return;
+        }
 
         std::cout << "Employee added successfully." << std::endl;
     }
     void showavailablecars(const string&role)
     {
-        auto cars = legacy_file::loadCars();
+        const auto cars = legacy_file::cars().available();
         if (cars.empty())
         {
             cout << "No cars present in the inventory." << endl;
@@ -283,16 +171,11 @@ public:
         cout << "Available Cars:" << endl;
         for (const auto &car : cars)
         {
-            if (car.availability != "Available")
-            {
-                continue;
-            }
-
-            double price = car.price;
+            double price = car.pricePerDay;
             if(role=="employee"){
                 price *= 0.85;
             }
-            cout << car.model <<","<<car.condition<<","<< price <<"Rs.\n"<< endl;
+            cout << car.id <<","<<car_rental::toString(car.condition)<<","<< price <<"Rs.\n"<< endl;
         }
     }
 
@@ -304,36 +187,14 @@ class Manager : public User
 public:
     void verifyManagers(int iD, const string &password)
     {
-        ifstream file("managers.txt");
-        if (file.is_open())
+        const auto manager = legacy_file::users().find(car_rental::UserRole::Manager, to_string(iD));
+        if (manager && manager->password == password)
         {
-            string line;
-            string id = to_string(iD);
-            while (getline(file, line))
-            {
-                istringstream iss(line);
-                string name, ID, PASSWORD;
-
-                getline(iss, name, ',');
-                getline(iss, ID, ',');
-                getline(iss, PASSWORD, ',');
-
-                if (id == ID && password == PASSWORD)
-                {
-                    cout << "Name: " << name << endl;
-                    // Store rented cars as a vector
-
-                    managerFunctionality(name);
-                    return;
-                }
-            }
-            cout << "Invalid" << endl;
-            file.close();
-        }
-        else
-        {
-            cerr << "Error: Unable to open file." << endl;
+            cout << "Name: " << manager->name << endl;
+            managerFunctionality(manager->name);
+            return;
         }
+        cout << "Invalid" << endl;
     }
     void addCar()
     {
@@ -365,20 +226,16 @@ public:
             return;
         }
 
-        bool added = legacy_file::mutateCars([&](std::vector<legacy_file::CarRecord> &cars) {
-            auto exists = std::find_if(cars.begin(), cars.end(), [&](const legacy_file::CarRecord &record) {
-                return record.model == model;
-            });
-            if (exists != cars.end())
-            {
-                return false;
-            }
-            cars.push_back(legacy_file::makeRecord(model, condition, price));
-            return true;
-        });
+        const auto record = legacy_file::makeRecord(model, condition, price);
+        if (!legacy_file::stores().validator->validate(record))
+        {
+            cout << "Invalid input for price. Please enter a valid number." << endl;
+            return;
+        }
 
-        if (added)
+        if (legacy_file::cars().insert(record))
         {
+            legacy_file::cars().flush();
             cout << "Car added successfully." << endl;
         }
         else
@@ -389,17 +246,8 @@ public:
 
 
 void deleteCar(const std::string &modelToDelete) {
-    bool deleted = false;
-    legacy_file::mutateCars([&](std::vector<legacy_file::CarRecord> &cars) {
-        auto oldSize = cars.size();
-        cars.erase(std::remove_if(cars.begin(), cars.end(), [&](const legacy_file::CarRecord &record) {
-            return record.model == modelToDelete;
-        }), cars.end());
-        deleted = cars.size() != oldSize;
-        return deleted;
-    });
-
-    if (deleted) {
+    if (legacy_file::cars().remove(modelToDelete)) {
+        legacy_file::cars().flush();
         std::cout << "Car deleted successfully." << std::endl;
     } else {
         std::cout << "Car not found." << std::endl;
@@ -407,15 +255,28 @@ void deleteCar(const std::string &modelToDelete) {
 }
 
 
+    // An exact model is a single lookup; conditions and prices still need every car.
     void searchCar(const std::string &searchCriteria)
     {
-        auto cars = legacy_file::loadCars();
-        for (const auto &car : cars)
+        const auto print = [](const car_rental::CarRecord &car) {
+            std::cout << "Model: " << car.id << ", Condition: " << car_rental::toString(car.condition)
+                      << ", Price: " << car.pricePerDay << std::endl;
+        };
+        if (!car_rental::parseCondition(searchCriteria) &&
+            searchCriteria.find_first_not_of("0123456789") != std::string::npos)
+        {
+            if (const auto car = legacy_file::cars().find(searchCriteria))
+            {
+                print(*car);
+            }
+            return;
+        }
+        for (const auto &car : legacy_file::cars().all())
         {
-            const std::string priceStr = std::to_string(static_cast<int>(car.price));
-            if (car.model == searchCriteria || car.condition == searchCriteria || priceStr == searchCriteria)
+            const std::string priceStr = std::to_string(static_cast<int>(car.pricePerDay));
+            if (car.id == searchCriteria || car_rental::toString(car.condition) == searchCriteria || priceStr == searchCriteria)
             {
-                std::cout << "Model: " << car.model << ", Condition: " << car.condition << ", Price: " << car.price << std::endl;
+                print(car);
             }
         }
     }
@@ -423,286 +284,112 @@ void deleteCar(const std::string &modelToDelete) {
 
     void updateCar(const std::string &modelToUpdate)
     {
-        bool updated = false;
-        legacy_file::mutateCars([&](std::vector<legacy_file::CarRecord> &cars) {
-            for (auto &car : cars)
-            {
-                if (car.model == modelToUpdate)
-                {
-                    std::string newModel;
-                    std::string newCondition;
-                    double newPrice;
-
-                    std::cout << "Enter new model for car " << car.model << ": ";
-                    std::cin >> newModel;
-
-                    std::cout << "Enter new condition for car " << car.model << ": ";
-                    std::cin >> newCondition;
-
-                    std::cout << "Enter new price for car " << car.model << ": ";
-                    std::cin >> newPrice;
-
-                    if (std::cin.fail())
-                    {
-                        std::cerr << "Invalid input for price. Please enter a valid number." << std::endl;
-                        std::cin.clear();
-                        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                        return false;
-                    }
-
-                    if (!legacy_file::isValidCondition(newCondition))
-                    {
-                        std::cerr << "Invalid condition." << std::endl;
-                        return false;
-                    }
-
-                    car.model = newModel;
-                    car.condition = newCondition;
-                    car.price = newPrice;
-                    updated = true;
-                    return true;
-                }
-            }
-            return false;
-        });
-
-        if (updated)
-        {
-            std::cout << "Car details updated successfully." << std::endl;
-        }
-        else
+        const auto existing = legacy_file::cars().find(modelToUpdate);
+        if (!existing)
         {
             std::cout << "Car not found." << std::endl;
+            return;
         }
-    }
-
-    //////////////////
-    void addCustomer()
-    {
-        string name;
-        string id;
-        string password;
-
-        cout << "Enter the Name: ";
-        cin >> name;
-
-        cout << "Enter the ID: ";
-        cin >> id;
 
-        cout << "Enter the Password: ";
-        cin >> password;
+        std::string newModel;
+        std::string newCondition;
+        double newPrice;
 
-        ofstream fout("customers.txt", ios::app); // Open the file in append mode
+        std::cout << "Enter new model for car " << existing->id << ": ";
+        std::cin >> newModel;
 
-        fout << name << "," << id << "," << password << endl; // Write data to the file
-        fout.close();
+        std::cout << "Enter new condition for car " << existing->id << ": ";
+        std::cin >> newCondition;
 
-        cout << "Customer added successfully." << endl;
-    }
+        std::cout << "Enter new price for car " << existing->id << ": ";
+        std::cin >> newPrice;
 
-    void deleteCustomer(const string &idToDelete)
-    {
-        ifstream inFile("customers.txt");
-        ofstream outFile("temp.txt");
-
-        if (!inFile)
+        if (std::cin.fail())
         {
-            cerr << "Unable to open file." << endl;
+            std::cerr << "Invalid input for price. Please enter a valid number." << std::endl;
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cout << "Car not found." << std::endl;
             return;
         }
 
-        string line;
-        bool found = false;
-        while (getline(inFile, line))
+        if (!legacy_file::isValidCondition(newCondition))
         {
-            if (line.substr(line.find(',') + 1, line.find(',', line.find(',') + 1) - line.find(',') - 1) != idToDelete)
-            {
-                outFile << line << endl;
-            }
-            else
-            {
-                found = true;
-            }
+            std::cerr << "Invalid condition." << std::endl;
+            std::cout << "Car not found." << std::endl;
+            return;
         }
 
-        inFile.close();
-        outFile.close();
-
-        remove("customers.txt");
-        rename("temp.txt", "customers.txt");
-
-        if (found)
+        // Renaming changes the car's key, so it is a remove plus an insert that keeps the
+        // rental state.
+        auto updated = *existing;
+        updated.id = newModel;
+        updated.model = car_rental::modelName(newModel, newModel);
+        updated.condition = *car_rental::parseCondition(newCondition);
+        updated.pricePerDay = newPrice;
+        if (!legacy_file::stores().validator->validate(updated))
         {
-            cout << "Customer deleted successfully." << endl;
+            std::cerr << "Invalid input for price. Please enter a valid number." << std::endl;
+            std::cout << "Car not found." << std::endl;
+            return;
         }
-        else
+        if (newModel == modelToUpdate)
         {
-            cout << "Customer not found." << endl;
+            legacy_file::cars().upsert(updated);
         }
-    }
-
-    void searchCustomer(const std::string &searchCriteria)
-    {
-        std::ifstream file("customers.txt");
-        if (file.is_open())
+        else if (!legacy_file::cars().insert(updated))
         {
-            std::string line;
-            while (getline(file, line))
-            {
-                std::istringstream iss(line);
-                std::string name, id, password;
-
-                // Parse customer details from the line
-                getline(iss, name, ',');
-                getline(iss, id, ',');
-                getline(iss, password, ',');
-
-                // Check if customer matches search criteria
-                if ( id == searchCriteria)
-                {
-                    // Display customer details
-                    std::cout << "Name: " << name << ", ID: " << id << std::endl;
-                }
-            }
-            file.close();
+            std::cout << "Car with the same model already exists." << std::endl;
+            return;
         }
         else
         {
-            std::cerr << "Error: Unable to open file." << std::endl;
+            legacy_file::cars().remove(modelToUpdate);
         }
+        legacy_file::cars().flush();
+        std::cout << "Car details updated successfully." << std::endl;
     }
 
-    void updateCustomer(const std::string &idToUpdate)
+    //////////////////
+    void addCustomer()
     {
-        std::ifstream inFile("customers.txt");
-        std::ofstream outFile("temp.txt");
+        add_Customer();
+    }
 
-        if (!inFile)
+    void deleteCustomer(const string &idToDelete)
+    {
+        if (legacy_file::users().remove(car_rental::UserRole::Customer, idToDelete))
         {
-            std::cerr << "Unable to open file." << std::endl;
-            return;
+            cout << "Customer deleted successfully." << endl;
         }
-
-        std::string line;
-        bool found = false;
-        while (std::getline(inFile, line))
+        else
         {
-            std::string name, id, password, rating;
-
-            std::istringstream iss(line);
-
-            // Parse employee details from the line
-            std::getline(iss, name, ',');
-            std::getline(iss, id, ',');
-            std::getline(iss, password, ',');
-
-           
-            std::getline(iss, rating, ',');
-
-            if (id == idToUpdate)
-            {
-                // Prompt user for new details
-                std::string newName;
-                std::string newPassword;
-               
-                string newRating;
-
-                // Clear input buffer
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-                std::cout << "Enter new name for customer with ID " << id << ": ";
-                std::getline(std::cin, newName); // Read name with spaces
-                std::cout << "Enter new password for customer with ID " << id << ": ";
-                std::getline(std::cin, newPassword); // Read password
-               
-                std::cout << "Enter new rating for customer with ID " << id << ": ";
-                std::cin >> newRating; // Read rating
-
-                // Write updated details to temporary file
-                outFile << newName << "," << id << "," << newPassword << ",";
-                outFile  << newRating << std::endl; // Write new fine and rating
-                found = true;
-            }
-            else
-            {
-                // Write existing details to temporary file
-                outFile << line << std::endl;
-            }
+            cout << "Customer not found." << endl;
         }
+    }
 
-        inFile.close();
-        outFile.close();
-
-        // Replace original file with temporary file
-        std::remove("customers.txt");
-        std::rename("temp.txt", "customers.txt");
-
-        if (found)
-        {
-            std::cout << "Customer details updated successfully." << std::endl;
-        }
-        else
+    void searchCustomer(const std::string &searchCriteria)
+    {
+        if (const auto customer = legacy_file::users().find(car_rental::UserRole::Customer, searchCriteria))
         {
-            std::cout << "Customer not found." << std::endl;
+            std::cout << "Name: " << customer->name << ", ID: " << customer->id << std::endl;
         }
     }
+
+    void updateCustomer(const std::string &idToUpdate)
+    {
+        updateUser(car_rental::UserRole::Customer, "customer", idToUpdate);
+    }
     
     //////////
     void addEmployee()
     {
-        std::string name;
-        std::string id;
-        std::string password;
-
-        std::cout << "Enter the Name: ";
-        std::getline(std::cin >> std::ws, name);
-
-        std::cout << "Enter the ID: ";
-        std::getline(std::cin, id);
-
-        std::cout << "Enter the Password: ";
-        std::getline(std::cin, password);
-
-        std::ofstream fout("employees.txt", std::ios::app); // Open the file in append mode
-
-        fout << name << "," << id << "," << password << ",B" << std::endl; // Write data to the file
-        fout.close();
-
-        std::cout << "Employee added successfully." << std::endl;
+        add_Employee();
     }
 
     void deleteEmployee(const string &idToDelete)
     {
-        ifstream inFile("employees.txt");
-        ofstream outFile("temp.txt");
-
-        if (!inFile)
-        {
-            cerr << "Unable to open file." << endl;
-            return;
-        }
-
-        string line;
-        bool found = false;
-        while (getline(inFile, line))
-        {
-            if (line.substr(line.find(',') + 1, line.find(',', line.find(',') + 1) - line.find(',') - 1) != idToDelete)
-            {
-                outFile << line << endl;
-            }
-            else
-            {
-                found = true;
-            }
-        }
-
-        inFile.close();
-        outFile.close();
-
-        remove("employees.txt");
-        rename("temp.txt", "employees.txt");
-
-        if (found)
+        if (legacy_file::users().remove(car_rental::UserRole::Employee, idToDelete))
         {
             cout << "Employee deleted successfully." << endl;
         }
@@ -714,131 +401,66 @@ void deleteCar(const std::string &modelToDelete) {
 
     void searchEmployee(const string &searchCriteria)
     {
-        std::ifstream file("employees.txt");
-        if (file.is_open())
-        {
-            std::string line;
-            while (std::getline(file, line))
-            {
-                std::istringstream iss(line);
-                std::string name, id, password;
-
-                // Parse employee details from the line
-                std::getline(iss, name, ',');
-                std::getline(iss, id, ',');
-                std::getline(iss, password, ',');
-
-                // Check if employee matches search criteria
-                if ( id == searchCriteria)
-                {
-                    // Display employee details
-                    cout << "Name: " << name << ", ID: " << id << endl;
-                }
-            }
-            file.close();
-        }
-        else
+        if (const auto employee = legacy_file::users().find(car_rental::UserRole::Employee, searchCriteria))
         {
-            std::cerr << "Error: Unable to open file." << std::endl;
+            cout << "Name: " << employee->name << ", ID: " << employee->id << endl;
         }
     }
 
     void updateEmployee(const std::string &idToUpdate)
     {
-        std::ifstream inFile("employees.txt");
-        std::ofstream outFile("temp.txt");
-
-        if (!inFile)
-        {
-            std::cerr << "Unable to open file." << std::endl;
-            return;
-        }
-
-        std::string line;
-        bool found = false;
-        while (std::getline(inFile, line))
-        {
-            std::string name, id, password, rating;
-
-            std::istringstream iss(line);
-
-            // Parse employee details from the line
-            std::getline(iss, name, ',');
-            std::getline(iss, id, ',');
-            std::getline(iss, password, ',');
-
-           
-            std::getline(iss, rating, ',');
-
-            if (id == idToUpdate)
-            {
-                // Prompt user for new details
-                std::string newName;
-                std::string newPassword;
-               
-                string newRating;
-
-                // Clear input buffer
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-                std::cout << "Enter new name for employee with ID " << id << ": ";
-                std::getline(std::cin, newName); // Read name with spaces
-                std::cout << "Enter new password for employee with ID " << id << ": ";
-                std::getline(std::cin, newPassword); // Read password
-               
-                std::cout << "Enter new rating for employee with ID " << id << ": ";
-                std::cin >> newRating; // Read rating
-
-                // Write updated details to temporary file
-                outFile << newName << "," << id << "," << newPassword << ",";
-                outFile  << newRating << std::endl; // Write new fine and rating
-                found = true;
-            }
-            else
-            {
-                // Write existing details to temporary file
-                outFile << line << std::endl;
-            }
-        }
-
-        inFile.close();
-        outFile.close();
-
-        // Replace original file with temporary file
-        std::remove("employees.txt");
-        std::rename("temp.txt", "employees.txt");
-
-        if (found)
-        {
-            std::cout << "Employee details updated successfully." << std::endl;
-        }
-        else
-        {
-            std::cout << "Employee not found." << std::endl;
-        }
+        updateUser(car_rental::UserRole::Employee, "employee", idToUpdate);
     }
 
    void showallCars()
 {
-    auto cars = legacy_file::loadCars();
+    const auto cars = legacy_file::cars().all();
     if (cars.empty())
     {
         std::cerr << "Error: Unable to open file or no cars present." << std::endl;
         return;
     }
 
+    const car_rental::CarRecordParser parser(legacy_file::stores().validator);
     std::cout << "Contents of cars.txt:" << std::endl;
     for (const auto &car : cars)
     {
-        std::cout << legacy_file::serialize(car) << std::endl;
+        std::cout << parser.serialize(car) << std::endl;
     }
 }
 
+private:
+    void updateUser(car_rental::UserRole role, const std::string &label, const std::string &idToUpdate)
+    {
+        const bool found = legacy_file::users().update(role, idToUpdate, [&](car_rental::UserRecord &user) {
+            // Clear input buffer
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+            std::cout << "Enter new name for " << label << " with ID " << user.id << ": ";
+            std::getline(std::cin, user.name); // Read name with spaces
+            std::cout << "Enter new password for " << label << " with ID " << user.id << ": ";
+            std::getline(std::cin, user.password); // Read password
+
+            std::cout << "Enter new rating for " << label << " with ID " << user.id << ": ";
+            std::cin >> user.rating; // Read rating
+        });
+
+        if (found)
+        {
+            std::cout << (role == car_rental::UserRole::Customer ? "Customer" : "Employee")
+                      << " details updated successfully." << std::endl;
+        }
+        else
+        {
+            std::cout << (role == car_rental::UserRole::Customer ? "Customer" : "Employee")
+                      << " not found." << std::endl;
+        }
+    }
 private:
    void managerFunctionality(const string &name)
 {
     bool loggedin = true;
-    while (loggedin)
+    while (loggedin && cin)
     {
         cout<<"\n\n\n";
         cout << "Welcome Manager " << name << endl;
@@ -1036,108 +658,43 @@ class Customer_Employee: public User{
 
 int myrentedCars(int id)
 {
-    int rented = 0;
-    auto cars = legacy_file::loadCars();
-    bool Found = false;
-    std::vector<std::pair<std::string, std::string>> rentedCars; // Store model and due date as pairs
+    const auto rentedCars = legacy_file::cars().rentedBy(std::to_string(id));
 
-    for (const auto &car : cars)
-    {
-        if (car.availability == "Rented by the user ID: " + std::to_string(id))
-        {
-            rentedCars.push_back(std::make_pair(car.model, car.dueDate));
-            rented++;
-            Found = true;
-        }
-    }
-
-    if (Found)
+    if (!rentedCars.empty())
     {
         std::cout << "Rented cars for the user with ID " << id << ":\n";
         for (const auto &car : rentedCars)
         {
-            std::cout << "Model: " << car.first << ", Due Date: " << car.second << std::endl;
+            std::cout << "Model: " << car.id << ", Due Date: " << legacy_file::dueDateText(car) << std::endl;
         }
     }
     else
     {
         std::cout << "The user with ID " << id << " has not rented any cars." << std::endl;
     }
-    return rented;
+    return static_cast<int>(rentedCars.size());
 }
 
 int rentable_cars(const string& role, int Id)
 {
-    int limit = 0;
-    bool found = false;
-
-    // Open user file to find the rating and limit based on rating
-    ifstream userFile(role + "s.txt");
-    if (!userFile) {
-        cerr << "Unable to open employee file." << endl;
+    const auto user = legacy_file::users().find(legacy_file::roleOf(role), to_string(Id));
+    if (!user) {
+        cout << "User with ID " << Id << " not found." << endl;
         return 0;
     }
 
-    string line;
-    while (getline(userFile, line)) {
-        stringstream ss(line);
-        string name, password, rating;
-        int userId; // Change variable name to avoid conflict with function argument
-        string ID;
-
-        getline(ss, name, ',');
-        getline(ss, ID, ',');
-        userId = stoi(ID); // Convert ID string to int
-        getline(ss, password, ',');
-      
-        ss >> rating; // Correct way to read rating
-
-        // Determine the limit based on rating
-        if (rating == "A+" || rating == "A") {
-            limit = 4;
-        } else if (rating == "B+" || rating == "B") {
-            limit = 3;
-        } else if (rating == "C+" || rating == "C") {
-            limit = 2;
-        } else if (rating == "D+" || rating == "D") {
-            limit = 1;
-        } else {
-            limit = 0; // Handle invalid rating
-        }
-
-        // Check if the current line corresponds to the user ID
-        if (userId == Id) {
-            found = true;
-            break; // No need to continue reading lines once user is found
-        }
-    }
-    userFile.close();
-
-    // Find the number of cars already rented by the id from cars.txt
-    int rented = 0;
-    auto cars = legacy_file::loadCars();
-    for (const auto &car : cars) {
-        if (car.availability == "Rented by the user ID: " + to_string(Id)) {
-            found = true;
-            rented++;
-        }
-    }
-
-    int rentingLimit = limit - rented;
+    // Find the number of cars already rented by the id
+    const int rented = static_cast<int>(legacy_file::cars().rentedBy(to_string(Id)).size());
+    int rentingLimit = legacy_file::rentalLimit(user->rating) - rented;
 
     // Print how many more cars the user can rent
-    if (found) {
-        if (rentingLimit > 0) {
-            cout << "You can rent " << rentingLimit << " more car(s)." << endl;
-            showavailablecars(role);
-        } else {
-            cout << "You can't rent anymore." << endl;
-        }
-        return rentingLimit;
+    if (rentingLimit > 0) {
+        cout << "You can rent " << rentingLimit << " more car(s)." << endl;
+        showavailablecars(role);
     } else {
-        cout << "User with ID " << Id << " not found." << endl;
-        return 0;
+        cout << "You can't rent anymore." << endl;
     }
+    return rentingLimit;
 }
 void rent_request(const string& role, int id)
 {
@@ -1151,36 +708,10 @@ void rent_request(const string& role, int id)
         return;
     }
 
-    bool found = false;
-    bool rentable = false;
     double amountToPay = 0.0;
-
-    legacy_file::mutateCars([&](std::vector<legacy_file::CarRecord> &cars) {
-        for (auto &car : cars) {
-            if (car.model == carModel) {
-                found = true;
-                if (car.availability == "Available") {
-                    rentable = true;
-                    time_t now = time(0);
-                    tm *nowPlus30Days = localtime(&now);
-                    nowPlus30Days->tm_mday += 30;
-                    mktime(nowPlus30Days);
-                    char buffer[80];
-                    strftime(buffer, 80, "%Y-%m-%d", nowPlus30Days);
-                    car.availability = "Rented by the user ID: " + std::to_string(id);
-                    car.dueDate = buffer;
-                    amountToPay = car.price;
-                    return true;
-                }
-                return false;
-            }
-        }
-        return false;
-    });
-
-    if (!found) {
+    if (!legacy_file::cars().find(carModel)) {
         cout << "Car not found." << endl;
-    } else if (!rentable) {
+    } else if (!legacy_file::rentals().rentCar(carModel, std::to_string(id), amountToPay)) {
         cout << "Car is not available." << endl;
     } else {
         if(role=="customer"){
@@ -1201,99 +732,26 @@ void rent_request(const string& role, int id)
 
 
 void show_fine(const std::string& role, int id) {
-    auto cars = legacy_file::loadCars();
-    bool found = false;
     int Fine = 0;
-
-    for (const auto &car : cars) {
-        if (car.availability == "Rented by the user ID: " + std::to_string(id)) {
-            found = true;
-
-            time_t now = time(0); // Current time
-            std::istringstream iss(car.dueDate);
-            int year, month, day;
-            char delimiter;
-            if (!(iss >> year >> delimiter >> month >> delimiter >> day)) {
-                continue;
-            }
-
-            tm dueDate = {};
-            dueDate.tm_year = year - 1900;
-            dueDate.tm_mon = month - 1;
-            dueDate.tm_mday = day;
-
-            time_t dueTime = mktime(&dueDate);
-            double differenceSeconds = difftime(now, dueTime);
-            int lateDays = differenceSeconds / (60 * 60 * 24); // Calculate late days
-
-            if (lateDays > 0) {
-                Fine += 20 * lateDays; // Calculate additional fine
-            }
-        }
-    }
-
-    if (found) {
-        std::cout << "Total fine for " << role << " with ID " << id << " is: " << Fine << std::endl;
-    } else {
-         std::cout << "Total fine for " << role << " with ID " << id << " is: " << "0" << std::endl;
+    for (const auto &car : legacy_file::cars().rentedBy(std::to_string(id))) {
+        Fine += legacy_file::fineFor(car);
     }
+    std::cout << "Total fine for " << role << " with ID " << id << " is: " << Fine << std::endl;
 }
 void show_fine_car(const string& carModel,const std::string& role, int id){
-    auto cars = legacy_file::loadCars();
-    bool found = false;
-    int Fine = 0;
-
-    for (const auto &car : cars) {
-        if (car.model == carModel && car.availability == "Rented by the user ID: " + std::to_string(id)) {
-            found = true;
-
-            time_t now = time(0); // Current time
-            std::istringstream iss(car.dueDate);
-            int year, month, day;
-            char delimiter;
-            if (!(iss >> year >> delimiter >> month >> delimiter >> day)) {
-                continue;
-            }
-
-            tm dueDate = {};
-            dueDate.tm_year = year - 1900;
-            dueDate.tm_mon = month - 1;
-            dueDate.tm_mday = day;
-
-            time_t dueTime = mktime(&dueDate);
-            double differenceSeconds = difftime(now, dueTime);
-            int lateDays = differenceSeconds / (60 * 60 * 24); // Calculate late days
-
-            if (lateDays > 0) {
-                Fine += 20 * lateDays; // Calculate additional fine
-            }
-        }
-    }
-
-    if (found) {
-        std::cout << "The fine for  " << carModel  << " is: " << Fine << std::endl;
+    const auto car = legacy_file::cars().find(carModel);
+    if (car && car->status == car_rental::CarStatus::Rented && car->renterId == std::to_string(id)) {
+        std::cout << "The fine for  " << carModel  << " is: " << legacy_file::fineFor(*car) << std::endl;
         cout<<"Please pay the above amount."<<endl;
     } else {
          std::cout << "The car was not rented by the " << role << " with ID " << id  << std::endl;
     }
 }
 void return_request(int id, const std::string& role) {
-    switch(myrentedCars(id)){
-    case 0:
-    {
+    if (myrentedCars(id) == 0) {
         cout<<"You have no rented cars.";
         return;
     }
-    case -1:
-    {
-        std::cerr << "Unable to open file." << std::endl;
-        return;
-    }
-    default:
-    {
-    break;
-    }
-}
     
     std::string carModel;
 
@@ -1303,235 +761,85 @@ void return_request(int id, const std::string& role) {
     // Show fine for the returned car
     show_fine_car(carModel, role, id);
 
-    bool found = false;
-    std::string choice;
-    std::string newCondition;
-
-    bool updated = legacy_file::mutateCars([&](std::vector<legacy_file::CarRecord> &cars) {
-        for (auto &car : cars) {
-            if (car.model == carModel && car.availability == "Rented by the user ID: " + std::to_string(id)) {
-                found = true;
-                std::cout << "Enter the new condition of the car:\n"
-                             "1. excellent\n"
-                             "2. good\n"
-                             "3. fair\n"
-                             "4. minordamages\n"
-                             "5. majordamages\n";
-                std::cin >> choice;
-
-                if (choice == "1") {
-                    newCondition = "excellent";
-                } else if (choice == "2") {
-                    newCondition = "good";
-                } else if (choice == "3") {
-                    newCondition = "fair";
-                } else if (choice == "4") {
-                    newCondition = "minordamages";
-                } else if (choice == "5") {
-                    newCondition = "majordamages";
-                } else {
-                    std::cerr << "Invalid condition choice." << std::endl;
-                    return false;
-                }
-
-                car.condition = newCondition;
-                car.availability = "Available";
-                car.dueDate = "None";
-                return true;
-            }
-        }
-        return false;
-    });
-
-    if (!found) {
+    const auto car = legacy_file::cars().find(carModel);
+    if (!car || car->status != car_rental::CarStatus::Rented || car->renterId != std::to_string(id)) {
         std::cout << "Car with model " << carModel << " not found or not rented by user ID " << id << std::endl;
         return;
     }
 
-    if (!updated) {
+    std::cout << "Enter the new condition of the car:\n"
+                 "1. excellent\n"
+                 "2. good\n"
+                 "3. fair\n"
+                 "4. minordamages\n"
+                 "5. majordamages\n";
+    std::string choice;
+    std::cin >> choice;
+    if (choice.size() != 1 || choice[0] < '1' || choice[0] > '5') {
+        std::cerr << "Invalid condition choice." << std::endl;
         return;
     }
+    const auto newCondition = static_cast<car_rental::CarCondition>(choice[0] - '1');
 
-    std::string ratingFile = role + "s.txt";
-    std::ifstream userFile(ratingFile);
-    std::ofstream tempUserFile("temp_emp.txt");
-
-    if (!userFile || !tempUserFile) {
-        std::cerr << "Unable to open user file." << std::endl;
+    if (!legacy_file::rentals().returnCar(carModel, std::to_string(id), newCondition)) {
+        std::cout << "Car with model " << carModel << " not found or not rented by user ID " << id << std::endl;
         return;
     }
 
-    std::string line;
-    while (std::getline(userFile, line)) {
-        std::stringstream ss(line);
-        std::string name, Id, password, rating;
-
-        std::getline(ss, name, ',');
-        std::getline(ss, Id, ',');
-        std::getline(ss, password, ',');
-        std::getline(ss, rating);
-
-        if (std::stoi(Id) == id) {
-            int ratingValue;
-
-            if (rating == "A") {
-                ratingValue = 8;
-            } else if (rating == "A+") {
-                ratingValue = 9;
-            } else if (rating == "B+") {
-                ratingValue = 7;
-            } else if (rating == "B") {
-                ratingValue = 6;
-            } else if (rating == "C+") {
-                ratingValue = 5;
-            } else if (rating == "C") {
-                ratingValue = 4;
-            } else if (rating == "D+") {
-                ratingValue = 3;
-            } else if (rating == "D") {
-                ratingValue = 2;
-            } else {
-                std::cerr << "Invalid rating: " << rating << std::endl;
-                return;
-            }
-
-            if (choice == "1") {
-                ratingValue += 2;
-            } else if (choice == "4" || choice == "5") {
-                ratingValue -= 1;
-            }
-
-            ratingValue = std::max(2, std::min(9, ratingValue));
-
-            std::string newRating;
-            switch (ratingValue) {
-                case 8:
-                    newRating = "A";
-                    break;
-                case 9:
-                    newRating = "A+";
-                    break;
-                case 7:
-                    newRating = "B+";
-                    break;
-                case 6:
-                    newRating = "B";
-                    break;
-                case 5:
-                    newRating = "C+";
-                    break;
-                case 4:
-                    newRating = "C";
-                    break;
-                case 3:
-                    newRating = "D+";
-                    break;
-                case 2:
-                    newRating = "D";
-                    break;
-                default:
-                    std::cerr << "Invalid rating value: " << ratingValue << std::endl;
-                    return;
-            }
-
-            tempUserFile << name << "," << Id << "," << password << "," << newRating << std::endl;
-        } else {
-            tempUserFile << line << std::endl;
+    bool validRating = true;
+    legacy_file::users().update(legacy_file::roleOf(role), std::to_string(id), [&](car_rental::UserRecord &user) {
+        static const std::vector<std::string> ratings{"D", "D+", "C", "C+", "B", "B+", "A", "A+"};
+        const auto current = std::find(ratings.begin(), ratings.end(), user.rating);
+        if (current == ratings.end()) {
+            std::cerr << "Invalid rating: " << user.rating << std::endl;
+            validRating = false;
+            return;
         }
-    }
 
-    userFile.close();
-    tempUserFile.close();
+        // Rating values run from 2 (D) to 9 (A+).
+        int ratingValue = static_cast<int>(current - ratings.begin()) + 2;
+        if (choice == "1") {
+            ratingValue += 2;
+        } else if (choice == "4" || choice == "5") {
+            ratingValue -= 1;
+        }
 
-    std::remove(ratingFile.c_str());
-    std::rename("temp_emp.txt", ratingFile.c_str());
+        ratingValue = std::max(2, std::min(9, ratingValue));
+        user.rating = ratings[static_cast<size_t>(ratingValue - 2)];
+    });
+    if (!validRating) {
+        return;
+    }
 
     std::cout << "Car returned successfully." << std::endl;
 }
 
     void view_profile(int id,const string& role)
     {
-        ifstream inFile(role+"s.txt");
-
-        if (!inFile)
-        {
-            cerr << "Unable to open file." << endl;
-            return;
-        }
-
-        string line;
-        bool found = false;
-        while (getline(inFile, line))
-        {
-            stringstream ss(line);
-            string name, employeeID, password, fine, rating;
-
-            getline(ss, name, ',');
-            getline(ss, employeeID, ',');
-            getline(ss, password, ',');
-
-            getline(ss, rating, ',');
-
-            if (stoi(employeeID) == id)
-            {
-                found = true;
-                cout << "Name: " << name << ", ID: " << employeeID << ", Password: " << password <<  ", Rating: " << rating << endl;
-
-                break;
-            }
-        }
-
-        if (!found)
+        const auto user = legacy_file::users().find(legacy_file::roleOf(role), to_string(id));
+        if (!user)
         {
             cerr << "The user not found." << endl;
+            return;
         }
-
-        inFile.close();
+        cout << "Name: " << user->name << ", ID: " << user->id << ", Password: " << user->password <<  ", Rating: " << user->rating << endl;
     }
 
 
 };
-
 class Customer : public Customer_Employee
 {
 public:
 void verify_customer(int iD, const string &password)
     {
-        ifstream file("customers.txt");
-        if (file.is_open())
+        const auto customer = legacy_file::users().find(car_rental::UserRole::Customer, to_string(iD));
+        if (customer && customer->password == password)
         {
-            string line;
-            string str_id = to_string(iD);
-            while (getline(file, line))
-            {
-                istringstream iss(line);
-                
-                std::stringstream ss(line);
-                std::string name, Id, PASSWORD, fine, rating;
-
-                std::getline(ss, name, ',');
-                std::getline(ss, Id, ',');
-                std::getline(ss, PASSWORD, ',');
-                
-                std::getline(ss, rating);
-                
-
-                if (str_id == Id && password == PASSWORD)
-                {
-                   
-                        cout << "Name: " << name << endl;
-                    customerFunctionality(iD);
-                    return;
-                    
-                }
-            }
-            cout << "Invalid" << endl;
-            file.close();
-        }
-        else
-        {
-            cerr << "Error: Unable to open file." << endl;
+            cout << "Name: " << customer->name << endl;
+            customerFunctionality(iD);
+            return;
         }
+        cout << "Invalid" << endl;
     }
    
 private:
@@ -1539,7 +847,7 @@ private:
 {
     bool loggedIn = true;
 
-    while (loggedIn)
+    while (loggedIn && cin)
     {
         cout<<"\n";
         cout << "Welcome! You can perform your tasks here." << endl;
@@ -1611,46 +919,21 @@ class Employee : public Customer_Employee
 public:
     void verify_employee(int iD, const string &password)
     {
-        ifstream file("employees.txt");
-        if (file.is_open())
-        {
-            string line;
-            string str_id = to_string(iD);
-            while (getline(file, line))
-            {
-                istringstream iss(line);
-                vector<string> rentedCars;
-                string name, ID, PASSWORD, rating;
-
-                getline(iss, name, ',');
-                getline(iss, ID, ',');
-                getline(iss, PASSWORD, ',');
-               
-                getline(iss, rating, ',');
-
-                if (str_id == ID && password == PASSWORD)
-                {
-                   
-                    cout << "Name: " << name << endl;
-                    employeeFunctionality(iD);
-                    return;
-                    
-                }
-            }
-            cout << "Invalid" << endl;
-            file.close();
-        }
-        else
+        const auto employee = legacy_file::users().find(car_rental::UserRole::Employee, to_string(iD));
+        if (employee && employee->password == password)
         {
-            cerr << "Error: Unable to open file." << endl;
+            cout << "Name: " << employee->name << endl;
+            employeeFunctionality(iD);
+            return;
         }
+        cout << "Invalid" << endl;
     }
 private:
     void employeeFunctionality(int id)
 {
     bool loggedIn = true;
 
-    while (loggedIn)
+    while (loggedIn && cin)
     {
         cout<<"\n";
         cout << "Welcome! You can perform your tasks here." << endl;
@@ -1721,7 +1004,7 @@ void mainFunction();
 
 int main()
 {
-    while (true)
+    while (cin)
     {
       
         mainFunction(); // Run the main functionality
@@ -8,7 +8,9 @@ It keeps a loggedin.txt file so every tiny session looks like:
 """
 from __future__ import annotations
 
+import os
 import random
+import socket
 import subprocess
 import time
 from dataclasses import dataclass
@@ -22,6 +24,8 @@ MANAGERS_FILE = PROJECT_ROOT / "managers.txt"
 LOGGEDIN_FILE = PROJECT_ROOT / "loggedin.txt"
 CAR_RENTAL_BIN = PROJECT_ROOT / "car_rental"
 DEFAULT_INTERVAL = 1  # seconds between commands
+# host:port of a `car_rental --serve=<port>` instance; unset spawns one process per command
+CAR_RENTAL_SERVER = os.environ.get("CAR_RENTAL_SERVER")
 
 
 def read_lines(path: Path) -> List[str]:
@@ -192,7 +196,19 @@ def save_loggedin(logged: Dict[str, Set[str]]) -> None:
         handle.write("\n".join(lines))
 
 
+def run_server_command(command: str) -> None:
+    host, _, port = CAR_RENTAL_SERVER.rpartition(":")
+    with socket.create_connection((host or "127.0.0.1", int(port))) as conn:
+        # save keeps cars.txt current, since FleetState reads it directly
+        conn.sendall(f"{command}\nsave\nexit\n".encode())
+        while conn.recv(65536):
+            pass
+
+
 def run_cli_command(command: str) -> None:
+    if CAR_RENTAL_SERVER:
+        run_server_command(command)
+        return
     payload = f"{command}\nsave\nexit\n"
     subprocess.run([str(CAR_RENTAL_BIN), "--backend=file"],
                    input=payload,
@@ -300,8 +316,7 @@ def remove_available_car_action(state: FleetState) -> None:
         print("[INFO] No available car to remove.")
         return
     car = random.choice(available)
-    state.cars = [c for c in state.cars if c.car_id != car.car_id]
-    state.write_cars()
+    run_cli_command(f"remove {car.car_id}")
     print(f"[REMOVE-CAR] {car.car_id}")
 
 
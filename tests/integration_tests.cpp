@@ -2,7 +2,11 @@
 
 #include <cassert>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <thread>
+
+#include <sys/resource.h>
 
 using namespace car_rental;
 
@@ -14,6 +18,15 @@ int main() {
     const fs::path dataset = fs::temp_directory_path() / "car_rental_integration.csv";
     generator.toFile(dataset.string(), 1000);
 
+    std::uint64_t mappedChecksum = 0;
+    std::uint64_t streamedChecksum = 0;
+    const auto mapped = CarFilePipeline(dataset.string(), validator, ReadMode::Mapped).readAll(&mappedChecksum);
+    const auto streamed = CarFilePipeline(dataset.string(), validator, ReadMode::Stream).readAll(&streamedChecksum);
+    assert(mapped.size() == 1000);
+    assert(streamed.size() == mapped.size());
+    assert(mappedChecksum == streamedChecksum);
+    assert(streamed.back().id == mapped.back().id);
+
     auto backend = std::make_shared<FileStorageBackend>(dataset.string(), validator);
     CarRepository repository(backend);
     RentalService service(repository);
@@ -22,6 +35,7 @@ int main() {
     const auto metrics = processor.ingest(dataset.string(), 256);
     assert(metrics.processedRecords == 1000);
     assert(metrics.batches > 0);
+    assert(metrics.commits == 1);
 
     auto cars = repository.all();
     assert(!cars.empty());
@@ -30,10 +44,956 @@ int main() {
     const bool rented = service.rentCar(cars.front().id, "integration-user", amount);
     assert(rented);
     assert(amount == cars.front().pricePerDay);
+    assert(repository.journalEntries() > 0);
+
+    {
+        auto replayed = std::make_shared<FileStorageBackend>(dataset.string(), validator);
+        CarRepository reopened(replayed);
+        assert(reopened.totalRecords() == 1000);
+        const auto rentedCar = reopened.find(cars.front().id);
+        assert(rentedCar->status == CarStatus::Rented);
+        assert(rentedCar->renterId == "integration-user");
+    }
+
+    assert(service.removeCar(cars[1].id));
+    {
+        CarRepository reopened(std::make_shared<FileStorageBackend>(dataset.string(), validator));
+        assert(reopened.totalRecords() == 999);
+        assert(!reopened.find(cars[1].id).has_value());
+    }
+    repository.upsert(cars[1]);
+    repository.flush();
+
+    {
+        // An append cut short by a full disk is cut back off the journal, so the next one
+        // starts on its own line; a torn last line is skipped on replay.
+        const fs::path journaled = fs::temp_directory_path() / "car_rental_torn.csv";
+        fs::remove(journaled.string() + ".journal");
+        auto records = generator.generate(10);
+        auto torn = std::make_shared<FileStorageBackend>(journaled.string(), validator);
+        torn->persistCars(sourceOf(records));
+        records[0].pricePerDay = 1111;
+        torn->persistChanges({records[0]});
+        const auto journalSize = fs::file_size(journaled.string() + ".journal");
+
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit previous{};
+        ::getrlimit(RLIMIT_FSIZE, &previous);
+        rlimit limited = previous;
+        limited.rlim_cur = journalSize + 10;
+        ::setrlimit(RLIMIT_FSIZE, &limited);
+        records[1].pricePerDay = 2222;
+        bool failed = false;
+        try {
+            torn->persistChanges({records[1], records[2]});
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        ::setrlimit(RLIMIT_FSIZE, &previous);
+        assert(failed);
+        assert(fs::file_size(journaled.string() + ".journal") == journalSize);
+
+        records[3].pricePerDay = 3333;
+        torn->persistChanges({records[3]});
+        {
+            std::ofstream append(journaled.string() + ".journal", std::ios::app);
+            append << "U," << records[4].id << ",Atl";
+        }
+        std::map<std::string, double> prices;
+        for (const auto &record : FileStorageBackend(journaled.string(), validator).loadCars()) {
+            prices[record.id] = record.pricePerDay;
+        }
+        assert(prices.size() == 10);
+        assert(prices[records[0].id] == 1111 && prices[records[3].id] == 3333);
+        assert(prices[records[1].id] != 2222);
+        fs::remove(journaled);
+        fs::remove(journaled.string() + ".journal");
+    }
 
     assert(service.returnCar(cars.front().id));
+    service.save();
+    assert(repository.journalEntries() == 0);
+
+    {
+        auto durable = std::make_shared<FileStorageBackend>(dataset.string(), validator, DurabilityMode::Full);
+        CarRepository reopened(durable);
+        assert(reopened.find(cars.front().id)->status == CarStatus::Available);
+        RentalService durableService(reopened);
+        assert(durableService.rentCar(cars.back().id, "durable-user", amount));
+        durableService.save();
+        const auto commits = reopened.commitMetrics();
+        assert(commits.durability == DurabilityMode::Full);
+        assert(commits.appends == 1 && commits.snapshots == 1);
+        assert(commits.lastSnapshot.bytes > 0);
+        assert(!fs::exists(dataset.string() + ".tmp"));
+    }
+
+    {
+        // A write that fails part way leaves the target alone and removes its temp file.
+        const fs::path target = fs::temp_directory_path() / "car_rental_failed_write.csv";
+        TransactionalFileWriter(target.string()).write({"kept"});
+        bool failed = false;
+        try {
+            TransactionalFileWriter(target.string()).writeWith([](OutputBuffer &out) {
+                out.line() += "partial";
+                out.endLine();
+                throw std::runtime_error("disk full");
+            });
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        assert(failed);
+        assert(!fs::exists(target.string() + ".tmp"));
+        std::ifstream kept(target);
+        std::string line;
+        assert(std::getline(kept, line) && line == "kept" && !std::getline(kept, line));
+        fs::remove(target);
+    }
+
+    {
+        auto inner = std::make_shared<FileStorageBackend>(dataset.string(), validator);
+        GroupCommitOptions group;
+        group.window = std::chrono::seconds(1);
+        group.maxOps = 8;
+        GroupCommitBackend grouped(inner, group);
+        std::vector<std::thread> writers;
+        for (int i = 0; i < 8; ++i) {
+            writers.emplace_back([&, i] {
+                CarRecord record = cars[static_cast<size_t>(i)];
+                record.status = CarStatus::Rented;
+                record.renterId = "group-" + std::to_string(i);
+                grouped.persistChanges({record});
+            });
+        }
+        for (auto &writer : writers) {
+            writer.join();
+        }
+        assert(inner->commitMetrics().appends == 1);
+        assert(grouped.commitMetrics().groupCommits == 1);
+
+        CarRepository reopened(std::make_shared<FileStorageBackend>(dataset.string(), validator));
+        for (int i = 0; i < 8; ++i) {
+            assert(reopened.find(cars[static_cast<size_t>(i)].id)->renterId == "group-" + std::to_string(i));
+        }
+    }
+
+    {
+        // A failed batch is reported to its own submitters only, never to a later caller.
+        struct FailOnceBackend : MemoryStorageBackend {
+            void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+                if (std::exchange(fail, false)) {
+                    throw std::runtime_error("disk full");
+                }
+                MemoryStorageBackend::persistDelta(changed, removed);
+            }
+
+            bool fail{true};
+        };
+        GroupCommitBackend grouped(std::make_shared<FailOnceBackend>(), GroupCommitOptions{});
+        bool failed = false;
+        try {
+            grouped.persistChanges({cars[0]});
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+        assert(failed);
+        const auto ticket = grouped.submitDelta({}, {});
+        assert(ticket == 0);
+        grouped.awaitDurable(ticket);
+        grouped.persistChanges({cars[0]});
+    }
+
+    {
+        BackendOptions options;
+        options.groupCommit = GroupCommitOptions{};
+        CarRepository shared(StorageBackendFactory::create(BackendType::File, dataset.string(), validator, options));
+        RentalService sharedService(shared);
+        const size_t availableBefore = shared.availableCount();
+        std::atomic<int> winners{0};
+        std::vector<std::thread> renters;
+        for (int i = 0; i < 8; ++i) {
+            renters.emplace_back([&, i] {
+                double due = 0;
+                const std::string user = "racer-" + std::to_string(i);
+                if (sharedService.rentCar(cars[100].id, user, due)) {
+                    ++winners;
+                }
+                assert(sharedService.rentCar(cars[200 + static_cast<size_t>(i)].id, user, due));
+            });
+        }
+        for (auto &renter : renters) {
+            renter.join();
+        }
+        assert(winners == 1);
+        assert(shared.availableCount() == availableBefore - 9);
+        assert(!shared.pendingChanges());
+        assert(shared.rentedBy(shared.find(cars[100].id)->renterId).size() == 2);
+    }
+
+    {
+        auto memory = std::make_shared<MemoryStorageBackend>();
+        CarRepository served(memory);
+        RentalService servedService(served);
+        BatchProcessor servedProcessor(served, validator);
+        CommandContext ctx{servedService, generator, servedProcessor, served, memory->name(), validator};
+        CommandRegistry registry;
+        registerDefaultCommands(registry, ctx);
+        struct NapCommand : CLICommand {
+            NapCommand() : CLICommand("Sleeps for 300 ms") {}
+            void execute(const std::vector<std::string> &, std::ostream &out) override {
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                out << "rested\n";
+            }
+        };
+        registry.add("nap", std::make_unique<NapCommand>());
+        CommandServer server(registry, ServerOptions{});
+        std::thread loop([&] { server.run(); });
+
+        const int client = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(server.port());
+        ::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        assert(::connect(client, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+        const std::string request = "add net-1 Falcon good 2500\r\nrent net-1 alice\nrent net-1 bob\nbogus\nexit\n";
+        assert(::write(client, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+        std::string response;
+        char buffer[4096];
+        for (ssize_t received; (received = ::read(client, buffer, sizeof(buffer))) > 0;) {
+            response.append(buffer, static_cast<size_t>(received));
+        }
+        ::close(client);
+
+        // A request line past 1 MiB is refused as soon as the read that crosses it arrives.
+        const int streamer = ::socket(AF_INET, SOCK_STREAM, 0);
+        assert(::connect(streamer, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+        const std::string unterminated((1 << 20) + 1, 'x');
+        for (size_t sent = 0; sent < unterminated.size();) {
+            const ssize_t written = ::write(streamer, unterminated.data() + sent, unterminated.size() - sent);
+            assert(written > 0);
+            sent += static_cast<size_t>(written);
+        }
+        std::string refusal;
+        for (ssize_t received; (received = ::read(streamer, buffer, sizeof(buffer))) > 0;) {
+            refusal.append(buffer, static_cast<size_t>(received));
+        }
+        ::close(streamer);
+        assert(refusal == "ERR Request line too long\n");
+
+        // A client reset while its command runs is not polled again until the reply comes
+        // back, so the event loop sleeps instead of spinning on the hangup.
+        const auto cpuTime = [] {
+            rusage usage{};
+            ::getrusage(RUSAGE_SELF, &usage);
+            return std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+                   std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+        };
+        const int napper = ::socket(AF_INET, SOCK_STREAM, 0);
+        assert(::connect(napper, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+        const std::string nap = "nap\n";
+        assert(::write(napper, nap.data(), nap.size()) == static_cast<ssize_t>(nap.size()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const linger reset{1, 0};
+        ::setsockopt(napper, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        ::close(napper);
+        const auto cpuBefore = cpuTime();
+        std::this_thread::sleep_for(std::chrono::milliseconds(400));
+        assert(cpuTime() - cpuBefore < std::chrono::milliseconds(150));
+
+        const int after = ::socket(AF_INET, SOCK_STREAM, 0);
+        assert(::connect(after, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+        const std::string bye = "exit\n";
+        assert(::write(after, bye.data(), bye.size()) == static_cast<ssize_t>(bye.size()));
+        std::string farewell;
+        for (ssize_t received; (received = ::read(after, buffer, sizeof(buffer))) > 0;) {
+            farewell.append(buffer, static_cast<size_t>(received));
+        }
+        ::close(after);
+        assert(farewell == "OK\n");
+
+        server.stop();
+        loop.join();
+
+        assert(response == "Car net-1 added.\nOK\n"
+                           "Car net-1 reserved. Amount due today: 2500 Rs.\nOK\n"
+                           "Unable to rent car net-1\nOK\n"
+                           "ERR Unknown command. Type 'help' for options.\n"
+                           "OK\n");
+        assert(served.find("net-1")->renterId == "alice");
+
+        // net-1 is due in 30 days; 32 days on it is two days late.
+        std::ostringstream overdue;
+        registry.dispatch("overdue " + formatDate(today() + 32), overdue);
+        assert(overdue.str() == "net-1 (Falcon) rented by alice, due " + formatDate(today() + 30) +
+                                    ": 2 days late, fine 40\n1 overdue cars, 40 in fines as of " +
+                                    formatDate(today() + 32) + ".\n");
+        overdue.str("");
+        registry.dispatch("overdue", overdue);
+        assert(overdue.str() == "0 overdue cars, 0 in fines as of " + formatDate(today()) + ".\n");
+    }
+
+    {
+        const fs::path snapshot = fs::temp_directory_path() / "car_rental_integration.bin";
+        auto source = repository.all();
+        source.back().status = CarStatus::Rented;
+        source.back().renterId = "due-soon";
+        source.back().dueDate = today() + 3;
+        {
+            auto binary = StorageBackendFactory::create(BackendType::Binary, snapshot.string(), validator);
+            CarRepository converted(binary);
+            converted.bulkUpsert(source);
+            converted.compact();
+            RentalService binaryService(converted);
+            assert(binaryService.returnCar(cars[0].id));
+            assert(converted.journalEntries() == 1);
+        }
+        assert(BinarySnapshotFormat::isBinarySnapshot(snapshot.string()));
+        assert(!BinarySnapshotFormat::isBinarySnapshot(dataset.string()));
+
+        CarRepository reopened(StorageBackendFactory::create(BackendType::Binary, snapshot.string(), validator));
+        source.front().status = CarStatus::Available;
+        source.front().renterId.clear();
+        source.front().dueDate = noDueDate;
+        const auto loaded = reopened.all();
+        assert(loaded.back().dueDate == today() + 3);
+        const CarRecordParser parser(validator);
+        assert(loaded.size() == source.size());
+        for (size_t i = 0; i < loaded.size(); ++i) {
+            assert(parser.serialize(loaded[i]) == parser.serialize(source[i]));
+        }
+
+        {
+            std::fstream damage(snapshot, std::ios::in | std::ios::out | std::ios::binary);
+            damage.seekp(-1, std::ios::end);
+            damage.put('#');
+        }
+        bool rejected = false;
+        try {
+            BinarySnapshotFormat(snapshot.string(), validator).read(nullptr);
+        } catch (const std::runtime_error &) {
+            rejected = true;
+        }
+        assert(rejected);
+        fs::remove(snapshot);
+        fs::remove(snapshot.string() + ".journal");
+
+        // A snapshot that exists but cannot be mapped is an error, not an empty fleet.
+        fs::create_directory(snapshot);
+        rejected = false;
+        try {
+            BinarySnapshotFormat(snapshot.string(), validator).read(nullptr);
+        } catch (const std::runtime_error &error) {
+            rejected = std::string(error.what()).find("Unable to open") != std::string::npos;
+        }
+        assert(rejected);
+        fs::remove(snapshot);
+        assert(BinarySnapshotFormat(snapshot.string(), validator).read(nullptr).empty());
+    }
+
+    const fs::path duplicates = fs::temp_directory_path() / "car_rental_integration_dupes.csv";
+    generator.toFile(duplicates.string(), 5000);
+    {
+        std::ofstream append(duplicates, std::ios::app);
+        append << "car-00000001,Falcon,fair,1234,Available\n";
+        append << "car-00004999,Falcon,fair,4321,Available\n";
+    }
+    {
+        auto memory = std::make_shared<MemoryStorageBackend>();
+        CarRepository parallelRepository(memory);
+        BatchProcessor parallel(parallelRepository, validator);
+        const auto parallelMetrics = parallel.ingest(duplicates.string(), 700, 4);
+        assert(parallelMetrics.threads == 4);
+        assert(parallelMetrics.processedRecords == 5002);
+        assert(parallelRepository.totalRecords() == 5000);
+        assert(parallelRepository.find("car-00000001")->pricePerDay == 1234);
+        assert(parallelRepository.find("car-00004999")->pricePerDay == 4321);
+    }
+
+    {
+        // Pretend a previous run committed the first 1000 lines and then crashed.
+        std::ifstream input(duplicates);
+        std::string line;
+        size_t offset = 0;
+        for (int i = 0; i < 1000 && std::getline(input, line); ++i) {
+            offset += line.size() + 1;
+        }
+        auto checkpoint = IngestCheckpoint::forInput(duplicates.string());
+        checkpoint.offset = offset;
+        checkpoint.save(duplicates.string());
+
+        auto memory = std::make_shared<MemoryStorageBackend>();
+        CarRepository resumedRepository(memory);
+        BatchProcessor resumed(resumedRepository, validator);
+        IngestOptions options;
+        options.chunkSize = 500;
+        options.commit = CommitPolicy::everyNBatches(2);
+        options.resume = true;
+        const auto resumedMetrics = resumed.ingest(duplicates.string(), options);
+        assert(resumedMetrics.resumedOffset == offset);
+        assert(resumedMetrics.processedRecords == 4002);
+        assert(resumedMetrics.commits == 5);
+        assert(!resumedRepository.find("car-00001000").has_value());
+        assert(resumedRepository.find("car-00001001").has_value());
+        assert(!fs::exists(IngestCheckpoint::pathFor(duplicates.string())));
+    }
+    fs::remove(duplicates);
+
+    {
+        // The legacy menu's user files, indexed by ID and rewritten per mutation.
+        const fs::path users = fs::temp_directory_path() / "car_rental_users";
+        fs::remove_all(users);
+        fs::create_directories(users);
+        {
+            std::ofstream customers(users / "customers.txt");
+            customers << "Ada,1001,pw,B\nShadow,1001,other,D\nBo,1002,pw2\n";
+        }
+        {
+            UserStore store(users.string());
+            assert(store.size(UserRole::Customer) == 2);
+            assert(store.size(UserRole::Manager) == 0);
+            assert(store.find(UserRole::Customer, "1001")->password == "pw");
+            assert(store.find(UserRole::Customer, "1002")->rating.empty());
+            assert(!store.add(UserRole::Customer, {"Dup", "1002", "x", ""}));
+            assert(store.add(UserRole::Employee, {"Eve", "2001", "pw", "B"}));
+            assert(store.update(UserRole::Customer, "1001", [](UserRecord &user) { user.rating = "A"; }));
+            assert(store.remove(UserRole::Customer, "1002"));
+            assert(!store.remove(UserRole::Customer, "1002"));
+        }
+        UserStore reopened(users.string());
+        assert(reopened.find(UserRole::Customer, "1001")->rating == "A");
+        assert(!reopened.find(UserRole::Customer, "1002"));
+        assert(reopened.find(UserRole::Employee, "2001")->name == "Eve");
+        std::ifstream customers(users / "customers.txt");
+        const std::string contents((std::istreambuf_iterator<char>(customers)), std::istreambuf_iterator<char>());
+        assert(contents == "Ada,1001,pw,A\nShadow,1001,other,D\n");
+        fs::remove_all(users);
+    }
+
+    {
+        // Rejected lines land in the quarantine file and count against the error budget.
+        const fs::path dirty = fs::temp_directory_path() / "car_rental_dirty.csv";
+        {
+            std::ofstream out(dirty);
+            for (int i = 0; i < 2000; ++i) {
+                if (i % 5 == 4) {
+                    out << "broken-" << i << ",oops\n";
+                } else {
+                    out << "dirty-" << i << ",Atlas,good,2500,Available\n";
+                }
+            }
+        }
+        for (const size_t threads : {1, 3}) {
+            CarRepository dirtyRepository(std::make_shared<MemoryStorageBackend>());
+            BatchProcessor dirtyProcessor(dirtyRepository, validator);
+            IngestOptions options;
+            options.threads = threads;
+            const auto metrics = dirtyProcessor.ingest(dirty.string(), options);
+            assert(metrics.processedRecords == 1600);
+            assert(metrics.rejectedRecords == 400);
+            assert(metrics.quarantinePath == QuarantineFile::pathFor(dirty.string()));
+
+            std::ifstream quarantine(metrics.quarantinePath);
+            std::string first;
+            std::getline(quarantine, first);
+            assert(first == "5\t" + std::to_string(4 * 34) + "\tMalformed car record\tbroken-4,oops");
+            size_t rows = 1;
+            for (std::string row; std::getline(quarantine, row);) {
+                ++rows;
+            }
+            assert(rows == 400);
+
+            options.maxRejectRate = 0.1;
+            bool aborted = false;
+            try {
+                dirtyProcessor.ingest(dirty.string(), options);
+            } catch (const std::runtime_error &ex) {
+                aborted = std::string(ex.what()).find("error budget") != std::string::npos;
+            }
+            assert(aborted);
+        }
+        // A clean rerun leaves no quarantine file behind from the dirty one.
+        {
+            std::ofstream out(dirty);
+            out << "clean-1,Atlas,good,2500,Available\n";
+        }
+        CarRepository cleanRepository(std::make_shared<MemoryStorageBackend>());
+        const auto clean = BatchProcessor(cleanRepository, validator).ingest(dirty.string(), IngestOptions{});
+        assert(clean.rejectedRecords == 0);
+        assert(!fs::exists(QuarantineFile::pathFor(dirty.string())));
+        fs::remove(dirty);
+    }
+
+    {
+        // A sorted ingest streams the input against the sorted snapshot and its journal.
+        const fs::path fleet = fs::temp_directory_path() / "car_rental_merged.csv";
+        const fs::path sorted = fs::temp_directory_path() / "car_rental_sorted.csv";
+        fs::remove(fleet);
+        fs::remove(fleet.string() + ".journal");
+        const auto idOf = [](int i) {
+            char id[16];
+            std::snprintf(id, sizeof(id), "m%04d", i);
+            return std::string(id);
+        };
+        {
+            std::ofstream out(fleet);
+            for (int i = 0; i < 900; i += 3) {
+                out << idOf(i) << ",Atlas,good,2500,Available\n";
+            }
+        }
+        {
+            std::ofstream out(sorted);
+            for (int i = 0; i < 900; i += 2) {
+                out << idOf(i) << ",Borealis,excellent," << (i == 10 ? 1111 : 9999) << ",Available\n";
+                if (i == 10) {
+                    out << idOf(i) << ",Borealis,excellent,1234,Available\n";
+                }
+                if (i == 400) {
+                    out << "broken,oops\n";
+                }
+            }
+        }
+        CarRepository mergedRepository(std::make_shared<FileStorageBackend>(fleet.string(), validator));
+        RentalService mergedService(mergedRepository);
+        double fare = 0;
+        assert(mergedService.rentCar(idOf(3), "merge-user", fare));
+        assert(mergedService.removeCar(idOf(6)));
+        assert(mergedRepository.journalEntries() == 2);
+
+        BatchProcessor mergingProcessor(mergedRepository, validator);
+        IngestOptions options;
+        options.order = IngestOptions::Order::Sorted;
+        options.quarantinePath = "";
+        const auto metrics = mergingProcessor.ingest(sorted.string(), options);
+        assert(metrics.merge);
+        assert(metrics.processedRecords == 451);
+        assert(metrics.rejectedRecords == 1);
+        assert(metrics.merge->inserted == 301);
+        assert(metrics.merge->replaced == 149);
+        assert(metrics.merge->written == 600);
+        assert(mergedRepository.totalRecords() == 600);
+        assert(mergedRepository.journalEntries() == 0);
+        assert(mergedRepository.find(idOf(3))->status == CarStatus::Rented);
+        assert(mergedRepository.find(idOf(6))->pricePerDay == 9999);
+        assert(mergedRepository.find(idOf(10))->pricePerDay == 1234);
+        assert(mergedRepository.find(idOf(9))->pricePerDay == 2500);
+
+        // Written in id order, so the snapshot itself merges again; a fresh backend has no
+        // cached checksum and takes the journal's word for it.
+        assert(mergedService.rentCar(idOf(9), "merge-user", fare));
+        {
+            std::ofstream out(sorted);
+            out << idOf(1) << ",Cirrus,fair,500,Available\n";
+        }
+        const auto offline = FileStorageBackend(fleet.string(), validator).mergeSorted(sorted.string(), {});
+        assert(offline && offline->inserted == 1 && offline->written == 601);
+        CarRepository reopened(std::make_shared<FileStorageBackend>(fleet.string(), validator));
+        assert(reopened.totalRecords() == 601);
+        assert(reopened.find(idOf(9))->status == CarStatus::Rented);
+
+        // Unsorted input aborts a forced merge untouched; detection batches it instead.
+        {
+            std::ofstream out(sorted);
+            out << idOf(2000) << ",Cirrus,fair,500,Available\n";
+            out << idOf(1000) << ",Cirrus,fair,500,Available\n";
+        }
+        BatchProcessor reopenedProcessor(reopened, validator);
+        bool rejected = false;
+        try {
+            reopenedProcessor.ingest(sorted.string(), options);
+        } catch (const std::runtime_error &ex) {
+            rejected = std::string(ex.what()).find("not sorted") != std::string::npos;
+        }
+        assert(rejected);
+        assert(reopened.totalRecords() == 601);
+        options.order = IngestOptions::Order::Detect;
+        const auto detected = reopenedProcessor.ingest(sorted.string(), options);
+        assert(!detected.merge && detected.processedRecords == 2);
+        assert(reopened.totalRecords() == 603);
+
+        // What `generate` writes is id-sorted as is, past car 9 and car 10 too.
+        generator.toFile(sorted.string(), 12, GeneratorOptions{.seed = 1});
+        options.order = IngestOptions::Order::Sorted;
+        const auto generated = reopenedProcessor.ingest(sorted.string(), options);
+        assert(generated.merge && generated.merge->inserted == 12);
+        assert(reopened.totalRecords() == 615);
+
+        // A journal left by another snapshot is found stale before the input is read, so a
+        // piped input is merged (not read twice) and each rejected line is reported once.
+        const auto staleJournal = [&] {
+            std::ofstream out(fleet.string() + ".journal");
+            out << "#car-journal base=deadbeef\nU," << idOf(7000) << ",Cirrus,fair,500,Available\n";
+        };
+        staleJournal();
+        {
+            std::ofstream out(sorted);
+            out << idOf(5001) << ",Cirrus,fair,500,Available\nbroken,oops\n" << idOf(5002) << ",Cirrus,fair,500,Available\n";
+        }
+        size_t rejections = 0;
+        const auto stale = FileStorageBackend(fleet.string(), validator).mergeSorted(sorted.string(), [&](const LineRejection &) {
+            ++rejections;
+        });
+        assert(stale && stale->inserted == 2 && rejections == 1);
+
+        staleJournal();
+        const fs::path stalePipe = fs::temp_directory_path() / "car_rental_stale.fifo";
+        fs::remove(stalePipe);
+        assert(::mkfifo(stalePipe.c_str(), 0600) == 0);
+        std::thread staleProducer([&] {
+            std::ofstream out(stalePipe);
+            out << idOf(5003) << ",Cirrus,fair,500,Available\n";
+        });
+        const auto pipedMerge = FileStorageBackend(fleet.string(), validator).mergeSorted(stalePipe.string(), {});
+        staleProducer.join();
+        fs::remove(stalePipe);
+        assert(pipedMerge && pipedMerge->inserted == 1 && pipedMerge->written == 618);
+        assert(CarRepository(std::make_shared<FileStorageBackend>(fleet.string(), validator)).find(idOf(5003)));
+
+        // Pipes are read block by block; 5000 lines outgrow the first 64 KB block.
+        const fs::path pipe = fs::temp_directory_path() / "car_rental_merge.fifo";
+        fs::remove(pipe);
+        assert(::mkfifo(pipe.c_str(), 0600) == 0);
+        std::thread producer([&] {
+            std::ofstream out(pipe);
+            for (int i = 0; i < 5000; ++i) {
+                out << idOf(i) << ",Atlas,good,2500,Available\n";
+            }
+        });
+        CarRecordReader piped(pipe.string(), validator);
+        CarRecord record;
+        int read = 0;
+        bool ordered = true;
+        while (piped.next(record)) {
+            ordered = ordered && record.id == idOf(read);
+            ++read;
+        }
+        producer.join();
+        assert(read == 5000 && ordered);
+
+        fs::remove(pipe);
+        fs::remove(sorted);
+        fs::remove(fleet);
+        fs::remove(fleet.string() + ".journal");
+    }
+
+    {
+        // The sharded backend rewrites only the shards a full write changes, and rehomes the
+        // records when reopened with another shard count.
+        const fs::path base = fs::temp_directory_path() / "car_rental_sharded.csv";
+        const auto removeShards = [&] {
+            for (size_t i = 0; i < 8; ++i) {
+                fs::remove(ShardedStorageBackend::shardPath(base.string(), i));
+                fs::remove(ShardedStorageBackend::shardPath(base.string(), i) + ".journal");
+            }
+        };
+        removeShards();
+        const auto fleet = generator.generate(2000);
+        auto sharded = std::make_shared<ShardedStorageBackend>(base.string(), validator, DurabilityMode::None, 4);
+        CarRepository shardedRepository(sharded);
+        shardedRepository.bulkUpsert(fleet);
+        shardedRepository.flush();
+        const size_t total = shardedRepository.totalRecords();
+        for (size_t i = 0; i < 4; ++i) {
+            const auto file = ShardedStorageBackend::shardPath(base.string(), i);
+            const auto records = CarFilePipeline(file, validator).readAll();
+            assert(!records.empty());
+            for (const auto &record : records) {
+                assert(sharded->shardOf(record.id) == i);
+            }
+        }
+        assert(sharded->commitMetrics().snapshots == 4);
+
+        RentalService shardedService(shardedRepository);
+        const auto car = shardedRepository.available(1).front();
+        double fare = 0;
+        assert(shardedService.rentCar(car.id, "shard-user", fare));
+        assert(sharded->journalEntries() == 1 && sharded->commitMetrics().appends == 1);
+        shardedService.save();
+        auto metrics = sharded->commitMetrics();
+        assert(metrics.snapshots == 5 && metrics.skippedShardWrites == 3 && sharded->journalEntries() == 0);
+        shardedService.save();
+        assert(sharded->commitMetrics().snapshots == 5 && sharded->commitMetrics().skippedShardWrites == 3);
+
+        {
+            CarRepository reopened(StorageBackendFactory::create(BackendType::Sharded, base.string(), validator,
+                                                                 BackendOptions{DurabilityMode::None, GroupCommitOptions{}, 4}));
+            assert(reopened.totalRecords() == total && reopened.find(car.id)->renterId == "shard-user");
+        }
+        {
+            auto fewer = std::make_shared<ShardedStorageBackend>(base.string(), validator, DurabilityMode::None, 3);
+            CarRepository reopened(fewer);
+            assert(reopened.totalRecords() == total && reopened.find(car.id)->renterId == "shard-user");
+            assert(!fs::exists(ShardedStorageBackend::shardPath(base.string(), 3)));
+            for (const auto &record : CarFilePipeline(ShardedStorageBackend::shardPath(base.string(), 2), validator).readAll()) {
+                assert(fewer->shardOf(record.id) == 2);
+            }
+        }
+        {
+            // As after a crash before the strays were removed: the stray's stale copy of a
+            // rehomed car loses to the in-range one, and its other cars are still rehomed.
+            auto kept = CarFilePipeline(ShardedStorageBackend::shardPath(base.string(), 0), validator).readAll().front();
+            auto stale = kept;
+            stale.pricePerDay = kept.pricePerDay + 1;
+            auto strayOnly = kept;
+            strayOnly.id = "stray-only";
+            CarFilePipeline(ShardedStorageBackend::shardPath(base.string(), 3), validator).writeAll({stale, strayOnly});
+            CarRepository reopened(std::make_shared<ShardedStorageBackend>(base.string(), validator, DurabilityMode::None, 3));
+            assert(reopened.totalRecords() == total + 1);
+            assert(reopened.find(kept.id)->pricePerDay == kept.pricePerDay);
+            assert(reopened.find("stray-only").has_value());
+            assert(!fs::exists(ShardedStorageBackend::shardPath(base.string(), 3)));
+        }
+        removeShards();
+
+        // A shard whose write fails is rewritten by the next full write, not skipped as unchanged.
+        auto retried = std::make_shared<ShardedStorageBackend>(base.string(), validator, DurabilityMode::None, 4);
+        auto records = generator.generate(200);
+        retried->persistCars(sourceOf(records));
+        records.front().pricePerDay += 1;
+        const size_t shard = retried->shardOf(records.front().id);
+        const fs::path blocked = ShardedStorageBackend::shardPath(base.string(), shard) + ".tmp";
+        fs::create_directory(blocked);
+        bool failed = false;
+        try {
+            retried->persistCars(sourceOf(records));
+        } catch (const std::exception &) {
+            failed = true;
+        }
+        assert(failed);
+        fs::remove(blocked);
+        retried->persistCars(sourceOf(records));
+        bool rewritten = false;
+        for (const auto &record : CarFilePipeline(ShardedStorageBackend::shardPath(base.string(), shard), validator).readAll()) {
+            rewritten = rewritten || (record.id == records.front().id && record.pricePerDay == records.front().pricePerDay);
+        }
+        assert(rewritten);
+        removeShards();
+    }
+
+    {
+        // Seeded generation is reproducible whatever the thread count and honours the mix.
+        const fs::path single = fs::temp_directory_path() / "car_rental_generated_1.csv";
+        const fs::path parallel = fs::temp_directory_path() / "car_rental_generated_4.csv";
+        GeneratorOptions options;
+        options.seed = 42;
+        options.rentedFraction = 0.25;
+        options.renters = 50;
+        options.duplicateFraction = 0.1;
+        assert(generator.toFile(single.string(), 40000, options) == 42);
+        options.threads = 4;
+        generator.toFile(parallel.string(), 40000, options);
+
+        const auto slurp = [](const fs::path &path) {
+            std::ifstream input(path);
+            return std::string((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        };
+        assert(slurp(single) == slurp(parallel));
+
+        const auto records = CarFilePipeline(single.string(), validator).readAll();
+        assert(records.size() == 40000);
+        std::unordered_set<std::string> ids;
+        size_t rented = 0;
+        for (const auto &record : records) {
+            ids.insert(record.id);
+            rented += record.status == CarStatus::Rented ? 1 : 0;
+        }
+        assert(rented > 9000 && rented < 11000);
+        assert(ids.size() > 35000 && ids.size() < 37000);
+        assert(generator.generate(40000, options).back().id == records.back().id);
+        fs::remove(single);
+        fs::remove(parallel);
+    }
+
+    {
+        // A batch script replays without prompts and lands its rentals in one flush.
+        const fs::path scripted = fs::temp_directory_path() / "car_rental_batch.csv";
+        generator.toFile(scripted.string(), 200, GeneratorOptions{.seed = 7, .rentedFraction = 0});
+        auto scriptBackend = std::make_shared<FileStorageBackend>(scripted.string(), validator);
+        CarRepository scriptRepository(scriptBackend);
+        RentalService scriptService(scriptRepository);
+        BatchProcessor scriptProcessor(scriptRepository, validator);
+        CarRentalCLI cli(CommandContext{scriptService, generator, scriptProcessor, scriptRepository, "file", validator});
+
+        const auto fleet = scriptRepository.all();
+        std::stringstream script;
+        for (size_t i = 0; i < 50; ++i) {
+            script << "rent " << fleet[i].id << " batch-user\n";
+        }
+        script << "return " << fleet[0].id << "\nbogus\nexit\nrent " << fleet[60].id << " late-user\n";
+
+        auto &flushes = MetricsRegistry::instance().histogram("repository.flush");
+        const auto flushesBefore = flushes.summary().count;
+        std::ostringstream output;
+        auto *const previous = std::cout.rdbuf(output.rdbuf());
+        assert(cli.runBatch(script));
+        std::cout.rdbuf(previous);
+        assert(flushes.summary().count == flushesBefore + 1);
+        assert(output.str().find("> ") == std::string::npos);
+        assert(output.str().find("Unknown command") != std::string::npos);
+
+        const auto replayed = FileStorageBackend(scripted.string(), validator).loadCars();
+        const auto rentedInFile = std::count_if(replayed.begin(), replayed.end(), [](const CarRecord &record) {
+            return record.status == CarStatus::Rented;
+        });
+        assert(rentedInFile == 49);
+        fs::remove(scripted);
+        fs::remove(scripted.string() + ".journal");
+
+        // Failed commits are reported like command errors, and a failed final one fails the run.
+        struct FailingBackend : MemoryStorageBackend {
+            using MemoryStorageBackend::MemoryStorageBackend;
+
+            void persistCars(const RecordSource &) override { throw std::runtime_error("disk full"); }
+
+            void persistDelta(const std::vector<CarRecord> &, const std::vector<std::string> &) override {
+                throw std::runtime_error("disk full");
+            }
+        };
+        CarRepository failingRepository(std::make_shared<FailingBackend>(generator.generate(20, GeneratorOptions{.seed = 7})));
+        RentalService failingService(failingRepository);
+        BatchProcessor failingProcessor(failingRepository, validator);
+        CarRentalCLI failingCli(
+            CommandContext{failingService, generator, failingProcessor, failingRepository, "failing", validator});
+        std::stringstream failingScript;
+        failingScript << "rent " << failingRepository.all()[0].id << " batch-user\n"
+                      << "rent " << failingRepository.all()[1].id << " batch-user\n";
+        std::ostringstream errors;
+        auto *const previousErr = std::cerr.rdbuf(errors.rdbuf());
+        auto *const previousOut = std::cout.rdbuf(output.rdbuf());
+        const bool committed = failingCli.runBatch(failingScript, 1);
+        std::cout.rdbuf(previousOut);
+        std::cerr.rdbuf(previousErr);
+        assert(!committed);
+        size_t reported = 0;
+        for (size_t at = errors.str().find("Error: disk full"); at != std::string::npos;
+             at = errors.str().find("Error: disk full", at + 1)) {
+            ++reported;
+        }
+        assert(reported == 3);
+    }
+
+    {
+        // Overlapping multi-car rentals from several threads: each pair goes wholly to one
+        // user or not at all, and a reader's snapshots never see half a transaction.
+        CarRepository pairs(std::make_shared<MemoryStorageBackend>(generator.generate(400, GeneratorOptions{.seed = 3})));
+        RentalService pairService(pairs);
+        const auto fleet = pairs.available();
+        std::atomic<bool> done{false};
+        std::thread reader([&] {
+            while (!done) {
+                const auto snapshot = pairs.snapshot();
+                assert(snapshot->availableCount() % 2 == 0);
+            }
+        });
+        std::vector<std::thread> renters;
+        for (int t = 0; t < 4; ++t) {
+            renters.emplace_back([&, t] {
+                for (size_t i = static_cast<size_t>(t % 2); i + 1 < fleet.size(); i += 2) {
+                    double amount = 0;
+                    pairService.rentCars({fleet[i].id, fleet[i + 1].id}, "pair-user-" + std::to_string(t), amount);
+                }
+            });
+        }
+        for (auto &renter : renters) {
+            renter.join();
+        }
+        done = true;
+        reader.join();
+        size_t rented = 0;
+        for (int t = 0; t < 4; ++t) {
+            rented += pairs.rentedBy("pair-user-" + std::to_string(t)).size();
+        }
+        assert(rented % 2 == 0 && rented > 0);
+        assert(pairs.counts().available == pairs.availableCount());
+    }
+
+    {
+        // Background persistence: flush() returns while a write is held up, rentals carry on
+        // and queue one follow-up write, and a failed write surfaces through its future and
+        // is retried by the next flush.
+        struct GatedBackend : MemoryStorageBackend {
+            using MemoryStorageBackend::MemoryStorageBackend;
+
+            void persistCars(const RecordSource &records) override {
+                pass();
+                MemoryStorageBackend::persistCars(records);
+            }
+
+            void persistDelta(const std::vector<CarRecord> &changed, const std::vector<std::string> &removed) override {
+                pass();
+                MemoryStorageBackend::persistDelta(changed, removed);
+            }
+
+            void set(bool open, bool fail) {
+                std::lock_guard<std::mutex> lock(mutex);
+                this->open = open;
+                this->fail = fail;
+                gate.notify_all();
+            }
+
+            void pass() {
+                std::unique_lock<std::mutex> lock(mutex);
+                gate.wait(lock, [&] { return open; });
+                if (std::exchange(fail, false)) {
+                    throw std::runtime_error("disk full");
+                }
+            }
+
+            std::mutex mutex;
+            std::condition_variable gate;
+            bool open{false};
+            bool fail{false};
+        };
+
+        auto gated = std::make_shared<GatedBackend>(generator.generate(50, GeneratorOptions{.seed = 5}));
+        CarRepository background(gated);
+        RentalService backgroundService(background);
+        background.startBackgroundPersistence();
+        const auto cars = background.available(2);
+        double amount = 0;
+        assert(backgroundService.rentCar(cars[0].id, "async-user", amount));
+        while (!background.persistStats().inFlight) {
+            std::this_thread::yield();
+        }
+        assert(backgroundService.rentCar(cars[1].id, "async-user", amount));
+        const auto queued = background.flush();
+        assert(background.persistStats().queued);
+        assert(queued.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout);
+        gated->set(true, false);
+        queued.get();
+        assert(gated->loadCars().size() == 50 && !background.pendingChanges());
+        CarRepository persisted(std::make_shared<MemoryStorageBackend>(gated->loadCars()));
+        assert(persisted.rentedBy("async-user").size() == 2);
+
+        gated->set(true, true);
+        assert(backgroundService.returnCar(cars[0].id));
+        background.awaitPersisted();
+        assert(background.pendingChanges());
+        background.flush().get();
+        assert(!background.pendingChanges() && background.persistStats().failures == 1);
+        assert(CarRepository(std::make_shared<MemoryStorageBackend>(gated->loadCars())).rentedBy("async-user").size() == 1);
+        background.stopBackgroundPersistence();
+        assert(!background.persistStats().background && background.persistStats().commits >= 3);
+    }
+
+    {
+        // Everything above ran through the instrumented pipeline and repository.
+        auto &metrics = MetricsRegistry::instance();
+        assert(metrics.counter("records.parsed").value() > 0);
+        assert(metrics.histogram("repository.flush").summary().count > 0);
+        assert(metrics.histogram("snapshot.write").summary().count > 0);
+
+        const fs::path metricsPath = fs::temp_directory_path() / "car_rental_metrics.json";
+        fs::remove(metricsPath);
+        { MetricsFileWriter writer(metricsPath.string(), std::chrono::milliseconds(60000)); }
+        std::ifstream input(metricsPath);
+        const std::string json((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        assert(json.find("\"records.parsed\"") != std::string::npos);
+        assert(json.find("\"repository.flush\": {\"count\"") != std::string::npos);
+        fs::remove(metricsPath);
+    }
 
     fs::remove(dataset);
+    fs::remove(dataset.string() + ".journal");
     std::cout << "integration tests passed" << std::endl;
     return 0;
 }
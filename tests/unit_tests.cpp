@@ -14,12 +14,93 @@ int main() {
     assert(record->id == "car-001");
     assert(record->model == "Horizon");
 
+    const size_t pooled = StringPool::instance().size();
+    auto compact = parser.parse("car-002,good,1800.5,Available\r");
+    assert(compact.has_value());
+    assert(compact->model == "car-002");
+    // Ids standing in for a model are kept out of the never-shrinking pool, in either form.
+    assert(parser.parse("car-002,car-002,good,1800.5,Available")->model == compact->model);
+    assert(StringPool::instance().size() == pooled);
+    {
+        InternedString copy = compact->model;
+        copy = InternedString("car-002");
+        assert(copy == compact->model && copy == "car-002");
+        copy = compact->model;
+        InternedString moved = std::move(copy);
+        assert(moved == compact->model && !(moved == InternedString("Horizon")));
+    }
+    assert(compact->pricePerDay == 1800.5);
+    assert(compact->status == CarStatus::Available);
+    assert(compact->condition == CarCondition::Good);
+
+    const std::string rentedLine = "car-004,Horizon,minordamages,3100,Rented by the user ID: C1001";
+    auto rentedRecord = parser.parse(rentedLine);
+    assert(rentedRecord->status == CarStatus::Rented);
+    assert(rentedRecord->renterId == "C1001");
+    assert(rentedRecord->model == record->model);
+    assert(parser.serialize(*rentedRecord) == rentedLine);
+    rentedRecord->pricePerDay = 1234567.25;
+    assert(parser.serialize(*rentedRecord) == "car-004,Horizon,minordamages,1234567.25,Rented by the user ID: C1001");
+    rentedRecord->pricePerDay = 1e100;
+    assert(parser.serialize(*rentedRecord) == "car-004,Horizon,minordamages,1e+100,Rented by the user ID: C1001");
+    assert(parser.parse(parser.serialize(*rentedRecord))->pricePerDay == 1e100);
+
+    try {
+        parser.parse("car-003,Horizon,good,12x,Available");
+        assert(false && "non-numeric price should throw");
+    } catch (const std::exception &) {
+    }
+
     try {
         parser.parse("broken,unknown,1000,Available,None");
         assert(false && "invalid condition should throw");
     } catch (const std::exception &) {
     }
 
+    assert(parser.tryParse("car-003,Horizon,good,12x,Available").error() == ParseError::InvalidPrice);
+    assert(parser.tryParse("broken,unknown,1000,Available,None").error() == ParseError::UnknownCondition);
+    assert(parser.tryParse("car-005,Horizon,good").error() == ParseError::Malformed);
+    assert(parser.tryParse("car-006,Horizon,good,900,Parked").error() == ParseError::UnknownStatus);
+    assert(parser.tryParse("car-007,Horizon,good,-5,Available").error() == ParseError::ValidationFailed);
+    assert(parser.tryParse("\r").has_value() && !parser.tryParse("\r").value().has_value());
+    assert(parser.tryParse(rentedLine).value()->renterId == "C1001");
+    assert(parser.tryParse("car-008,Horizon,good,900,Available,2026-02-30").error() == ParseError::InvalidDueDate);
+
+    const std::string dueLine = "car-009,Horizon,good,900,Rented by the user ID: C1002,2024-02-29";
+    auto dueRecord = parser.parse(dueLine);
+    assert(dueRecord->dueDate == *parseDate("2024-02-29"));
+    assert(formatDate(dueRecord->dueDate) == "2024-02-29");
+    assert(parser.serialize(*dueRecord) == dueLine);
+
+    // Every scanner level cuts the same lines and fields as tryParse's own tokenizer,
+    // including lines that straddle 64-byte blocks and a last line without a newline.
+    const std::string scanned = std::string(60, 'x') + "\n" + dueLine + "\r\n\n" + rentedLine + ",\ncar-005,Horizon,good\n" +
+                                "car-002,good,1800.5,Available";
+    for (const auto level : {DelimiterScanner::Level::Scalar, DelimiterScanner::Level::Sse2,
+                             DelimiterScanner::Level::Avx2}) {
+        DelimiterScanner scanner(scanned, level);
+        DelimiterScanner::Line line;
+        std::vector<std::string> ids;
+        size_t lines = 0;
+        while (scanner.next(line)) {
+            ++lines;
+            const auto fromScanner = parser.tryParse(line);
+            const auto fromText = parser.tryParse(line.text);
+            assert(line.text == std::string_view(scanned).substr(line.offset, line.text.size()));
+            assert(fromScanner.has_value() == fromText.has_value());
+            if (!fromScanner) {
+                assert(fromScanner.error() == fromText.error());
+            } else if (fromScanner.value()) {
+                assert(fromScanner.value()->id == fromText.value()->id);
+                assert(fromScanner.value()->dueDate == fromText.value()->dueDate);
+                ids.push_back(fromScanner.value()->id);
+            }
+        }
+        assert(lines == 6 && ids == std::vector<std::string>({"car-009", "car-004", "car-002"}));
+    }
+    assert(*parseDate("1970-01-02") == 1);
+    assert(!parseDate("2024-2-29").has_value());
+
     auto backend = std::make_shared<MemoryStorageBackend>();
     CarRepository repository(backend);
     RentalService service(repository);
@@ -31,9 +112,32 @@ int main() {
     bool rentSuccess = service.rentCar(record->id, "user-123", quotedAmount);
     assert(rentSuccess);
     assert(quotedAmount == record->pricePerDay);
+    assert(repository.availableCount() == 0);
+    assert(repository.rentedBy("user-123").size() == 1);
+    assert(repository.find(record->id)->dueDate == today() + rentalPeriodDays);
 
     bool returnSuccess = service.returnCar(record->id);
     assert(returnSuccess);
+    assert(repository.rentedBy("user-123").empty());
+    assert(repository.find(record->id)->dueDate == noDueDate);
+    assert(service.rentCar(record->id, "user-123", quotedAmount));
+    assert(!service.returnCar(record->id, "someone-else", CarCondition::Fair));
+    assert(service.returnCar(record->id, "user-123", CarCondition::Fair));
+    assert(repository.find(record->id)->condition == CarCondition::Fair);
+
+    service.addCar(*compact);
+    assert(service.listAvailable(1).size() == 1);
+    assert(service.listAvailable(1).front().id == "car-001");
+    assert(service.listAvailable(10).size() == 2);
+
+    assert(service.rentCar(compact->id, "user-123", quotedAmount));
+    assert(!service.removeCar(compact->id));
+    assert(service.removeCar(record->id));
+    assert(!service.removeCar(record->id));
+    repository.reload();
+    assert(repository.totalRecords() == 1);
+    assert(!repository.find(record->id).has_value());
+    assert(repository.find(compact->id)->renterId == "user-123");
 
     SyntheticDatasetGenerator generator(validator);
     auto synthetic = generator.generate(25);
@@ -42,6 +146,134 @@ int main() {
         assert(validator->validate(entry));
     }
 
+    CarRepository fleet(std::make_shared<MemoryStorageBackend>(synthetic));
+    RentalService fleetService(fleet);
+    const auto before = fleet.snapshot();
+    const std::vector<std::string> pair{synthetic[0].id, synthetic[1].id};
+    assert(fleetService.rentCars(pair, "user-7", quotedAmount));
+    assert(quotedAmount == synthetic[0].pricePerDay + synthetic[1].pricePerDay);
+    assert(fleet.rentedBy("user-7").size() == 2);
+    assert(before->find(synthetic[0].id)->status == CarStatus::Available);
+    assert(before->availableCount() == 25 && fleet.counts().available == 23);
+    // One car already taken: nothing is rented.
+    assert(!fleetService.rentCars({synthetic[1].id, synthetic[2].id}, "user-8", quotedAmount));
+    assert(fleet.find(synthetic[2].id)->status == CarStatus::Available);
+    assert(!fleetService.returnCars({synthetic[0].id, "missing"}));
+    assert(fleet.rentedBy("user-7").size() == 2);
+    assert(fleetService.returnCars(pair));
+    assert(fleet.counts().available == 25);
+
+    auto transaction = fleet.begin();
+    transaction.remove(synthetic[3].id);
+    transaction.insert(*record);
+    transaction.abort();
+    assert(transaction.commit() && fleet.find(synthetic[3].id).has_value() && !fleet.find(record->id));
+    assert(fleetService.reprice(2.0) == 25);
+    assert(fleet.find(synthetic[4].id)->pricePerDay == synthetic[4].pricePerDay * 2);
+
+    CarQuery cheapest;
+    cheapest.order = CarQuery::Order::Price;
+    cheapest.limit = 3;
+    const auto top = fleet.query(cheapest);
+    auto byPrice = fleet.all();
+    std::sort(byPrice.begin(), byPrice.end(), [](const CarRecord &lhs, const CarRecord &rhs) {
+        return std::tie(lhs.pricePerDay, lhs.id) < std::tie(rhs.pricePerDay, rhs.id);
+    });
+    assert(top.size() == 3 && top[0]->id == byPrice[0].id && top[2]->id == byPrice[2].id);
+    assert(fleetService.rentCar(synthetic[5].id, "user-9", quotedAmount));
+    CarQuery rentedTo;
+    rentedTo.renter = "user-9";
+    assert(fleet.query(rentedTo).size() == 1 && fleet.query(rentedTo).front()->id == synthetic[5].id);
+    CarQuery filtered;
+    filtered.status = CarStatus::Available;
+    const auto pivot = fleet.available().back();
+    filtered.minPrice = pivot.pricePerDay;
+    filtered.condition = pivot.condition;
+    for (const auto &car : fleet.query(filtered)) {
+        assert(car->pricePerDay >= *filtered.minPrice && car->condition == *filtered.condition);
+        assert(car->status == CarStatus::Available);
+    }
+    filtered.limit = 1;
+    assert(fleet.query(filtered).size() == 1);
+
+    // The compact layout must behave exactly like the hashed one, across merges of its
+    // pending inserts into the columns (one shard, so the merge threshold is crossed).
+    const auto bulk = generator.generate(3000);
+    const auto ids = [](const std::vector<CarRecord> &cars) {
+        std::vector<std::string> out;
+        for (const auto &car : cars) {
+            out.push_back(car.id + "/" + car.model.str() + "/" + std::to_string(car.pricePerDay) + "/" + car.renterId);
+        }
+        return out;
+    };
+    CarRepository hashed(std::make_shared<MemoryStorageBackend>(synthetic), 1);
+    CarRepository columns(std::make_shared<MemoryStorageBackend>(synthetic), 1, StoreLayout::Compact);
+    assert(columns.layout() == StoreLayout::Compact && ids(columns.all()) == ids(hashed.all()));
+    for (auto *repo : {&hashed, &columns}) {
+        repo->bulkUpsert({bulk.begin(), bulk.begin() + 1500});
+        for (size_t i = 1500; i < bulk.size(); ++i) {
+            assert(repo->insert(bulk[i]));
+        }
+        assert(!repo->insert(bulk[7]));
+        RentalService rentals(*repo);
+        assert(rentals.rentCars({bulk[10].id, bulk[2999].id}, "user-c", quotedAmount));
+        assert(rentals.removeCar(bulk[20].id) && rentals.removeCar(bulk[2500].id));
+        rentals.addCar(bulk[20]);
+        assert(!rentals.rentCar(bulk[10].id, "user-d", quotedAmount));
+        assert(rentals.reprice(1.5) > 0);
+    }
+    assert(ids(columns.all()) == ids(hashed.all()));
+    assert(ids(columns.available(40)) == ids(hashed.available(40)));
+    assert(ids(columns.rentedBy("user-c")) == ids(hashed.rentedBy("user-c")));
+    assert(columns.counts().total == 2999 && columns.counts().available == hashed.counts().available);
+    assert(!columns.find(bulk[2500].id) && columns.find(bulk[2999].id)->renterId == "user-c");
+    for (const auto &query : {cheapest, rentedTo, filtered}) {
+        const auto lhs = hashed.query(query);
+        const auto rhs = columns.query(query);
+        assert(lhs.size() == rhs.size());
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            assert(lhs[i]->id == rhs[i]->id);
+        }
+    }
+    columns.flush();
+    columns.reload();
+    assert(ids(columns.all()) == ids(hashed.all()) && columns.snapshot()->size() == 2999);
+
+    // Batches are moved in whole; the last duplicate wins, and a snapshot keeps a record
+    // alive after the store has dropped it.
+    const auto held = hashed.snapshot();
+    for (auto *repo : {&hashed, &columns}) {
+        std::vector<CarRecord> batch{bulk[30], bulk[31], bulk[30]};
+        batch[2].pricePerDay = 4321;
+        repo->bulkUpsert(std::move(batch));
+        assert(repo->find(bulk[30].id)->pricePerDay == 4321 && repo->find(bulk[31].id).has_value());
+        assert(repo->remove(bulk[31].id));
+    }
+    assert(held->find(bulk[31].id) != nullptr && held->find(bulk[31].id)->id == bulk[31].id);
+
+    // Both layouts index rented cars by due date: dueBefore() returns only the late ones,
+    // earliest first, and follows returns, removals and reloads.
+    for (auto *repo : {&hashed, &columns}) {
+        std::vector<CarRecord> late{bulk[40], bulk[41], bulk[42], bulk[43]};
+        for (size_t i = 0; i < late.size(); ++i) {
+            late[i].status = CarStatus::Rented;
+            late[i].renterId = "user-late";
+            late[i].dueDate = today() - 10 + static_cast<std::int32_t>(i) * 5;
+        }
+        repo->bulkUpsert(std::move(late));
+        const auto due = repo->dueBefore(today());
+        assert(due.size() == 2 && due[0].id == bulk[40].id && due[1].id == bulk[41].id);
+        assert(fineAsOf(due[0], today()) == 10 * finePerLateDay && fineAsOf(due[1], today() - 5) == 0);
+        assert(RentalService(*repo).returnCar(bulk[40].id) && repo->remove(bulk[41].id));
+        const auto week = repo->dueBefore(today() + 6);
+        assert(week.size() == 2 && week[0].id == bulk[42].id && week[1].id == bulk[43].id);
+        repo->flush();
+        repo->reload();
+        assert(ids(repo->dueBefore(today() + 6)) == ids(week));
+    }
+    assert(ids(columns.dueBefore(today() + 60)) == ids(hashed.dueBefore(today() + 60)));
+    assert(hashed.dueBefore(today() + 60).size() == 4);
+
     std::cout << "unit tests passed" << std::endl;
     return 0;
 }